@@ -26,24 +26,44 @@ Args::Args() {
   minCount = 5;
   minCountLabel = 0;
   neg = 5;
+  sharedNeg = 0;
   wordNgrams = 1;
   loss = loss_name::ns;
   model = model_name::sg;
+  storage = storage_name::fp32;
   bucket = 2000000;
   minn = 3;
   maxn = 6;
   thread = 12;
+  readers = 0;
   lrUpdateRate = 100;
   t = 1e-4;
   label = "__label__";
   verbose = 2;
   pretrainedModel = "";
+  checkpointTokens = 0;
+  checkpointMinutes = 0.0;
+  resume = 0;
   pretrainedVectors = "";
   saveOutput = 0;
+  normalize = 0;
+  saveWordMatrix = 0;
+  binaryVectors = 0;
+  quant = quant_name::pq;
+  dsub = 2;
+  hnswM = 16;
+  efConstruction = 100;
+  ef = 64;
+  maxVocab = 0;
+  minLength = 3;
+  skipLatin = 1;
+  vocabMemory = 0;
 
   dict_source_path.clear();
   log_path = "";
+  log_interval = 5.0;
   dict_vocab_freq_path = "";
+  dict_cache_path = "";
 }
 
 void Args::parseArgs(int argc, char** argv) {
@@ -77,18 +97,36 @@ void Args::parseArgs(int argc, char** argv) {
       output = std::string(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-dict_vocab_freq_path") == 0) {
       dict_vocab_freq_path = std::string(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-dict_cache_path") == 0) {
+      dict_cache_path = std::string(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-pretrainedModel") == 0) {
       pretrainedModel = std::string(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-checkpointTokens") == 0) {
+      checkpointTokens = atoll(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-checkpointMinutes") == 0) {
+      checkpointMinutes = atof(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-resume") == 0) {
+      resume = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-context_cooccurences_path") == 0) {
       context_cooccurences_path = std::string(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-source") == 0) {
-      dict_source_path.insert(std::make_pair(
-          argv[ai + 1], source_info_t(argv[ai + 2], argv[ai + 3])));
-      ai += 2;
+      if (strcmp(argv[ai + 1], "ngram") == 0 &&
+          strcmp(argv[ai + 2], "hash") == 0) {
+        // the hashed char ngrams, no paths
+        dict_source_path.insert(
+            std::make_pair(argv[ai + 1], source_info_t("", "")));
+        ai += 1;
+      } else {
+        dict_source_path.insert(std::make_pair(
+            argv[ai + 1], source_info_t(argv[ai + 2], argv[ai + 3])));
+        ai += 2;
+      }
     } else if (strcmp(argv[ai], "-lr") == 0) {
       lr = atof(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-log_path") == 0) {
       log_path = std::string(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-log_interval") == 0) {
+      log_interval = atof(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-lrUpdateRate") == 0) {
       lrUpdateRate = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-dim") == 0) {
@@ -103,6 +141,8 @@ void Args::parseArgs(int argc, char** argv) {
       minCountLabel = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-neg") == 0) {
       neg = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-sharedNeg") == 0) {
+      sharedNeg = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-wordNgrams") == 0) {
       wordNgrams = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-loss") == 0) {
@@ -117,6 +157,18 @@ void Args::parseArgs(int argc, char** argv) {
         printHelp();
         exit(EXIT_FAILURE);
       }
+    } else if (strcmp(argv[ai], "-storage") == 0) {
+      if (strcmp(argv[ai + 1], "fp32") == 0) {
+        storage = storage_name::fp32;
+      } else if (strcmp(argv[ai + 1], "bf16") == 0) {
+        storage = storage_name::bf16;
+      } else if (strcmp(argv[ai + 1], "fp16") == 0) {
+        storage = storage_name::fp16;
+      } else {
+        std::cout << "Unknown storage: " << argv[ai + 1] << std::endl;
+        printHelp();
+        exit(EXIT_FAILURE);
+      }
     } else if (strcmp(argv[ai], "-bucket") == 0) {
       bucket = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-minn") == 0) {
@@ -125,6 +177,8 @@ void Args::parseArgs(int argc, char** argv) {
       maxn = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-thread") == 0) {
       thread = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-readers") == 0) {
+      readers = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-t") == 0) {
       t = atof(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-label") == 0) {
@@ -135,6 +189,38 @@ void Args::parseArgs(int argc, char** argv) {
       pretrainedVectors = std::string(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-saveOutput") == 0) {
       saveOutput = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-normalize") == 0) {
+      normalize = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-saveWordMatrix") == 0) {
+      saveWordMatrix = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-binaryVectors") == 0) {
+      binaryVectors = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-quant") == 0) {
+      if (strcmp(argv[ai + 1], "int8") == 0) {
+        quant = quant_name::int8;
+      } else if (strcmp(argv[ai + 1], "pq") == 0) {
+        quant = quant_name::pq;
+      } else {
+        std::cout << "Unknown quantization: " << argv[ai + 1] << std::endl;
+        printHelp();
+        exit(EXIT_FAILURE);
+      }
+    } else if (strcmp(argv[ai], "-dsub") == 0) {
+      dsub = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-hnswM") == 0) {
+      hnswM = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-efConstruction") == 0) {
+      efConstruction = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-ef") == 0) {
+      ef = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-maxVocab") == 0) {
+      maxVocab = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-minLength") == 0) {
+      minLength = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-skipLatin") == 0) {
+      skipLatin = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-vocabMemory") == 0) {
+      vocabMemory = atoi(argv[ai + 1]);
     } else {
       ai--;
       // std::cout << "Unknown argument: " << argv[ai] << std::endl;
@@ -151,6 +237,13 @@ void Args::parseArgs(int argc, char** argv) {
   if (wordNgrams <= 1 && maxn == 0) {
     bucket = 0;
   }
+  auto ngram = dict_source_path.find("ngram");
+  if (ngram != dict_source_path.end() && ngram->second.path.empty() &&
+      (maxn <= 0 || bucket <= 0)) {
+    std::cerr << "-source ngram hash needs -maxn and -bucket above 0!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
 }
 
 void Args::printHelp() {
@@ -159,7 +252,9 @@ void Args::printHelp() {
   if (loss == loss_name::softmax) lname = "softmax";
   std::cout << "\n"
             << "The following arguments are mandatory:\n"
-            << "  -input              training file path\n"
+            << "  -input              training file path: text, .tok or a "
+               ".manifest listing shard files,\n"
+            << "                      or - to stream text from stdin\n"
             << "  -output             output file path\n\n"
             << "The following arguments are optional:\n"
             << "  -lr                 learning rate [" << lr << "]\n"
@@ -176,22 +271,77 @@ void Args::printHelp() {
             << minCountLabel << "]\n"
             << "  -neg                number of negatives sampled [" << neg
             << "]\n"
+            << "  -sharedNeg          draw one negative set per center word "
+               "and score the whole window at once ["
+            << sharedNeg << "]\n"
             << "  -wordNgrams         max length of word ngram [" << wordNgrams
             << "]\n"
             << "  -loss               loss function {ns, hs, softmax} [ns]\n"
-            << "  -bucket             number of buckets [" << bucket << "]\n"
+            << "  -storage            matrix storage {fp32, bf16, fp16}, "
+               "arithmetic stays fp32 [fp32]\n"
+            << "  -bucket             number of buckets of the hashed char "
+               "ngrams of -source ngram hash ["
+            << bucket << "]\n"
             << "  -minn               min length of char ngram [" << minn
             << "]\n"
-            << "  -maxn               max length of char ngram [" << maxn
-            << "]\n"
+            << "  -maxn               max length of char ngram, 0 disables "
+               "the hashed char ngrams ["
+            << maxn << "]\n"
             << "  -thread             number of threads [" << thread << "]\n"
+            << "  -readers            threads reading and subsampling the "
+               "input for the others,\n"
+            << "                      0 for each thread reading its own ["
+            << readers << "]\n"
             << "  -t                  sampling threshold [" << t << "]\n"
             << "  -label              labels prefix [" << label << "]\n"
             << "  -verbose            verbosity level [" << verbose << "]\n"
             << "  -pretrainedVectors  pretrained word vectors for supervised "
-               "learning []"
+               "learning []\n"
+            << "  -log_path           JSON-lines file of training telemetry "
+               "[]\n"
+            << "  -log_interval       seconds between telemetry lines ["
+            << log_interval << "]\n"
+            << "  -checkpointTokens   snapshot the training to <output>.ckpt "
+               "every so many tokens, 0 for never ["
+            << checkpointTokens << "]\n"
+            << "  -checkpointMinutes  same every so many minutes ["
+            << checkpointMinutes << "]\n"
+            << "  -resume             continue from <output>.ckpt if it "
+               "exists [" << resume << "]\n"
+            << "  -dict_cache_path    binary cache of the built dictionary, "
+               "rebuilt when its inputs change []\n"
             << "  -saveOutput         whether output params should be saved ["
             << saveOutput << "]\n"
+            << "  -normalize          L2-normalize the exported word vectors ["
+            << normalize << "]\n"
+            << "  -saveWordMatrix     also save the word vectors as a binary "
+               ".wvec matrix ["
+            << saveWordMatrix << "]\n"
+            << "  -binaryVectors      write .vec and .vectors in word2vec's "
+               "binary format ["
+            << binaryVectors << "]\n"
+            << "  -quant              quantize: per-row int8 or product "
+               "quantization {int8, pq} [pq]\n"
+            << "  -dsub               quantize: size of each pq sub-vector ["
+            << dsub << "]\n"
+            << "  -hnswM              build-index: links per node and layer ["
+            << hnswM << "]\n"
+            << "  -efConstruction     build-index: candidate list size ["
+            << efConstruction << "]\n"
+            << "  -ef                 nn-query: candidate list size [" << ef
+            << "]\n"
+            << "  -maxVocab           build-vocab: most frequent words kept, "
+               "0 keeps all ["
+            << maxVocab << "]\n"
+            << "  -minLength          build-vocab: min characters of a word ["
+            << minLength << "]\n"
+            << "  -skipLatin          build-vocab: skip words with latin "
+               "letters ["
+            << skipLatin << "]\n"
+            << "  -vocabMemory        build-vocab, build-cooc: MB for the "
+               "counters, 0 for no limit; build-vocab then estimates heavy "
+               "hitters, build-cooc spills to disk ["
+            << vocabMemory << "]\n"
             << std::endl;
 }
 
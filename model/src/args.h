@@ -17,10 +17,13 @@
 #include <ostream>
 #include <string>
 
+#include "real.h"
+
 namespace fasttext {
 
 enum class model_name : int { cbow = 1, sg, sup };
 enum class loss_name : int { hs = 1, ns, softmax };
+enum class quant_name : int { int8 = 1, pq };
 
 struct lexem_ns_record {
   int32_t h;
@@ -43,12 +46,17 @@ class Args {
   std::string output;
 
   std::string log_path;
+  double log_interval;
   std::string pretrainedModel;
+  int64_t checkpointTokens;
+  double checkpointMinutes;
+  int resume;
   std::string context_cooccurences_path;
 
   std::map<std::string, source_info_t> dict_source_path;
 
   std::string dict_vocab_freq_path;
+  std::string dict_cache_path;
 
   double lr;
   int lrUpdateRate;
@@ -58,18 +66,33 @@ class Args {
   int minCount;
   int minCountLabel;
   int neg;
+  int sharedNeg;
   int wordNgrams;
   loss_name loss;
   model_name model;
+  storage_name storage;
   int bucket;
   int minn;
   int maxn;
   int thread;
+  int readers;
   double t;
   std::string label;
   int verbose;
   std::string pretrainedVectors;
   int saveOutput;
+  int normalize;
+  int saveWordMatrix;
+  int binaryVectors;
+  quant_name quant;
+  int dsub;
+  int hnswM;
+  int efConstruction;
+  int ef;
+  int maxVocab;
+  int minLength;
+  int skipLatin;
+  int vocabMemory;
 
   void parseArgs(int, char**);
   void printHelp();
@@ -0,0 +1,278 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#include "checkpoint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#include "utils.h"
+
+namespace fasttext {
+
+const char Checkpointer::MAGIC[8] = {'F', 'T', 'C', 'K', 'P', 'T', '0', '1'};
+const int32_t Checkpointer::VERSION;
+const int32_t Checkpointer::POLL_MS;
+
+checkpoint_header_t Checkpointer::header(const Args& args, int64_t nlexems,
+                                         int64_t nitems, int64_t total_tokens) {
+  checkpoint_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.nthreads = args.thread;
+  header.nitems = nitems;
+  header.total_tokens = total_tokens;
+  header.nlexems = nlexems;
+  header.dim = args.dim;
+  header.storage = int32_t(args.storage);
+  return header;
+}
+
+bool Checkpointer::load(const std::string& path,
+                        const checkpoint_header_t& expected,
+                        checkpoint_t& checkpoint) {
+  std::ifstream in(path, std::ifstream::binary);
+  if (!in.is_open()) return false;
+  checkpoint_header_t header;
+  in.read((char*)&header, sizeof(header));
+  if (!in || memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header.version != VERSION) {
+    std::cerr << path << " is not a checkpoint!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (header.nthreads != expected.nthreads ||
+      header.nitems != expected.nitems ||
+      header.total_tokens != expected.total_tokens ||
+      header.nlexems != expected.nlexems || header.dim != expected.dim ||
+      header.storage != expected.storage) {
+    std::cerr << "Checkpoint " << path << " was taken with other arguments "
+              << "or input: resume with the same -thread, -epoch, -dim, "
+              << "-storage and dictionary" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  checkpoint.workers.resize(header.nthreads);
+  for (int32_t i = 0; i < header.nthreads; i++) {
+    worker_state_t& state = checkpoint.workers[i];
+    utils::readPod(in, state.item);
+    utils::readPod(in, state.offset);
+    utils::readPod(in, state.tokens);
+    utils::readString(in, state.model);
+  }
+  checkpoint.ranges.resize(header.nthreads);
+  for (int32_t i = 0; i < header.nthreads; i++) {
+    utils::readPod(in, checkpoint.ranges[i].first);
+    utils::readPod(in, checkpoint.ranges[i].second);
+  }
+  checkpoint.input = std::make_shared<Matrix>();
+  checkpoint.output = std::make_shared<Matrix>();
+  checkpoint.input->loadAligned(in);
+  checkpoint.output->loadAligned(in);
+  if (!in) {
+    std::cerr << "Checkpoint " << path << " is truncated or corrupted!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::cerr << "resuming from " << path << " at " << header.tokens
+            << " tokens" << std::endl;
+  return true;
+}
+
+Checkpointer::Checkpointer(std::shared_ptr<Args> args,
+                           const checkpoint_header_t& header,
+                           std::shared_ptr<Matrix> input,
+                           std::shared_ptr<Matrix> output,
+                           std::shared_ptr<ChunkScheduler> scheduler,
+                           std::shared_ptr<Telemetry> telemetry)
+    : args_(args),
+      header_(header),
+      path_(args->output + ".ckpt"),
+      input_(input),
+      output_(output),
+      scheduler_(scheduler),
+      telemetry_(telemetry),
+      states_(header.nthreads),
+      snapshot_tokens_(0),
+      requested_(false),
+      active_(header.nthreads),
+      arrived_(0),
+      copied_(0),
+      nslices_(0),
+      next_slice_(0),
+      copying_(false),
+      generation_(0),
+      ready_(false),
+      last_tokens_(0),
+      stopped_(false) {}
+
+Checkpointer::~Checkpointer() { stop(); }
+
+void Checkpointer::start(const std::vector<worker_state_t>& states) {
+  last_tokens_ = 0;
+  for (size_t i = 0; i < states.size(); i++) {
+    states_[i] = states[i];
+    last_tokens_ += states[i].tokens;
+  }
+  last_time_ = std::chrono::steady_clock::now();
+  writer_ = std::thread([this]() { run(); });
+}
+
+void Checkpointer::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopped_) return;
+    stopped_ = true;
+  }
+  wakeup_.notify_all();
+  if (writer_.joinable()) writer_.join();
+}
+
+bool Checkpointer::due() const {
+  if (args_->checkpointTokens > 0 &&
+      telemetry_->tokens() - last_tokens_ >= args_->checkpointTokens) {
+    return true;
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - last_time_;
+  return args_->checkpointMinutes > 0 &&
+         elapsed.count() >= args_->checkpointMinutes * 60;
+}
+
+void Checkpointer::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    wakeup_.wait_for(lock, std::chrono::milliseconds(POLL_MS));
+    if (ready_) {
+      // a snapshot taken just before the end is still written
+      ready_ = false;
+      lock.unlock();
+      write();
+      lock.lock();
+    }
+    if (stopped_) break;
+    if (!requested_ && active_ > 0 && due()) requested_ = true;
+  }
+}
+
+// Called with the lock held once every active worker has paused: nobody
+// takes items or touches the matrices until the copy is done.
+void Checkpointer::beginCopy() {
+  if (snapshot_.input == nullptr) {
+    snapshot_.input = std::make_shared<Matrix>(input_->m_, input_->n_,
+                                               input_->storage_);
+    snapshot_.output = std::make_shared<Matrix>(output_->m_, output_->n_,
+                                                output_->storage_);
+  }
+  nslices_ = arrived_;
+  next_slice_ = 0;
+  copied_ = 0;
+  copying_ = true;
+  workers_.notify_all();
+}
+
+void Checkpointer::copySlices() {
+  for (int32_t s = next_slice_++; s < nslices_; s = next_slice_++) {
+    snapshot_.input->copyRows(*input_, s * input_->m_ / nslices_,
+                              (s + 1) * input_->m_ / nslices_);
+    snapshot_.output->copyRows(*output_, s * output_->m_ / nslices_,
+                               (s + 1) * output_->m_ / nslices_);
+  }
+}
+
+void Checkpointer::pause(int32_t worker, const worker_state_t& state) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  const int64_t generation = generation_;
+  states_[worker] = state;
+  if (++arrived_ == active_) beginCopy();
+  workers_.wait(lock, [&]() { return copying_; });
+  lock.unlock();
+  copySlices();
+  lock.lock();
+  if (++copied_ < nslices_) {
+    workers_.wait(lock, [&]() { return generation_ != generation; });
+    return;
+  }
+  snapshot_.workers = states_;
+  snapshot_.ranges = scheduler_->ranges();
+  snapshot_tokens_ = 0;
+  for (size_t i = 0; i < states_.size(); i++) {
+    snapshot_tokens_ += states_[i].tokens;
+  }
+  last_tokens_ = snapshot_tokens_;
+  last_time_ = std::chrono::steady_clock::now();
+  arrived_ = 0;
+  copying_ = false;
+  requested_ = false;
+  ready_ = true;
+  generation_++;
+  workers_.notify_all();
+  wakeup_.notify_all();
+}
+
+void Checkpointer::leave(int32_t worker, const worker_state_t& state) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  states_[worker] = state;
+  active_--;
+  if (!requested_) return;
+  if (active_ == 0) {
+    requested_ = false;
+  } else if (arrived_ == active_) {
+    beginCopy();
+  }
+}
+
+void Checkpointer::write() {
+  auto start = std::chrono::steady_clock::now();
+  const std::string tmp = path_ + ".tmp";
+  std::ofstream ofs(tmp, std::ofstream::binary);
+  if (!ofs.is_open()) {
+    std::cerr << "Checkpoint file " << tmp << " cannot be opened!"
+              << std::endl;
+    return;
+  }
+  checkpoint_header_t header = header_;
+  header.tokens = snapshot_tokens_;
+  ofs.write((char*)&header, sizeof(header));
+  for (size_t i = 0; i < snapshot_.workers.size(); i++) {
+    const worker_state_t& state = snapshot_.workers[i];
+    utils::writePod(ofs, state.item);
+    utils::writePod(ofs, state.offset);
+    utils::writePod(ofs, state.tokens);
+    utils::writeString(ofs, state.model);
+  }
+  for (size_t i = 0; i < snapshot_.ranges.size(); i++) {
+    utils::writePod(ofs, snapshot_.ranges[i].first);
+    utils::writePod(ofs, snapshot_.ranges[i].second);
+  }
+  snapshot_.input->saveAligned(ofs);
+  snapshot_.output->saveAligned(ofs);
+  ofs.close();
+  // a failed write leaves the previous checkpoint in place
+  if (!ofs || rename(tmp.c_str(), path_.c_str()) != 0) {
+    std::cerr << "Error writing checkpoint " << path_ << std::endl;
+    remove(tmp.c_str());
+    return;
+  }
+  if (args_->verbose > 0) {
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    std::cerr << "\ncheckpoint at " << snapshot_tokens_ << " tokens written to "
+              << path_ << " in " << seconds << "s" << std::endl;
+  }
+}
+
+}  // namespace fasttext
@@ -0,0 +1,150 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#ifndef FASTTEXT_CHECKPOINT_H
+#define FASTTEXT_CHECKPOINT_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "args.h"
+#include "chunks.h"
+#include "matrix.h"
+#include "telemetry.h"
+
+namespace fasttext {
+
+// Checkpoint file: this 64-byte header, the state of every worker, the
+// scheduler ranges, then the input and output matrices in the aligned
+// layout. A checkpoint only resumes the run it was taken from, so the
+// header also holds that run's shape.
+struct checkpoint_header_t {
+  char magic[8];
+  int32_t version;
+  int32_t nthreads;
+  int64_t nitems;
+  int64_t total_tokens;
+  int64_t nlexems;
+  int32_t dim;
+  int32_t storage;
+  int64_t tokens;
+  char reserved[8];
+};
+
+// Where a worker stands: the work item it is in (-1 once it has run out),
+// the offset in it (bytes into a text chunk, the id position in a tokenized
+// one), its token count and its model's sampling state.
+struct worker_state_t {
+  int64_t item;
+  int64_t offset;
+  int64_t tokens;
+  std::string model;
+
+  worker_state_t() : item(-1), offset(0), tokens(0) {}
+};
+
+struct checkpoint_t {
+  std::vector<worker_state_t> workers;
+  std::vector<std::pair<int64_t, int64_t>> ranges;
+  std::shared_ptr<Matrix> input;
+  std::shared_ptr<Matrix> output;
+};
+
+// Periodic snapshots of a training run. A background thread polls the
+// token count and the clock like the telemetry monitor does; when a
+// checkpoint is due it raises a flag that the workers check between lines.
+// Each worker then records its state and waits until all of them have, and
+// together they copy the matrices in slices of rows. They go back to
+// training while the background thread writes the copy to <output>.ckpt.tmp
+// and renames it over <output>.ckpt, so the file is always a complete
+// checkpoint. The copy doubles the memory taken by the matrices.
+class Checkpointer {
+ private:
+  std::shared_ptr<Args> args_;
+  checkpoint_header_t header_;
+  std::string path_;
+  std::shared_ptr<Matrix> input_;
+  std::shared_ptr<Matrix> output_;
+  std::shared_ptr<ChunkScheduler> scheduler_;
+  std::shared_ptr<Telemetry> telemetry_;
+
+  std::vector<worker_state_t> states_;
+  checkpoint_t snapshot_;
+  int64_t snapshot_tokens_;
+
+  std::atomic<bool> requested_;
+  int32_t active_;
+  int32_t arrived_;
+  int32_t copied_;
+  int32_t nslices_;
+  std::atomic<int32_t> next_slice_;
+  bool copying_;
+  int64_t generation_;
+  bool ready_;
+
+  int64_t last_tokens_;
+  std::chrono::steady_clock::time_point last_time_;
+
+  std::thread writer_;
+  std::mutex mutex_;
+  std::condition_variable workers_;
+  std::condition_variable wakeup_;
+  bool stopped_;
+
+  Checkpointer(const Checkpointer&);
+  Checkpointer& operator=(const Checkpointer&);
+
+  bool due() const;
+  void beginCopy();
+  void copySlices();
+  void run();
+  void write();
+
+ public:
+  static const char MAGIC[8];
+  static const int32_t VERSION = 1;
+  static const int32_t POLL_MS = 100;
+
+  // the header of a run training nitems work items over total_tokens tokens
+  static checkpoint_header_t header(const Args&, int64_t, int64_t, int64_t);
+  // reads a checkpoint of the run described by the header; false if there
+  // is none, exits if it belongs to another run or is damaged
+  static bool load(const std::string&, const checkpoint_header_t&,
+                   checkpoint_t&);
+
+  Checkpointer(std::shared_ptr<Args>, const checkpoint_header_t&,
+               std::shared_ptr<Matrix>, std::shared_ptr<Matrix>,
+               std::shared_ptr<ChunkScheduler>, std::shared_ptr<Telemetry>);
+  ~Checkpointer();
+
+  // the workers' states to start from, empty ones for a fresh run
+  void start(const std::vector<worker_state_t>&);
+  void stop();
+
+  bool requested() const { return requested_.load(std::memory_order_relaxed); }
+  // called by a worker between lines once requested() is set; returns when
+  // the matrices are copied
+  void pause(int32_t, const worker_state_t&);
+  // called by a worker that ran out of items, with its final state
+  void leave(int32_t, const worker_state_t&);
+};
+
+}  // namespace fasttext
+
+#endif
@@ -0,0 +1,334 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#include "chunks.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+#include "utils.h"
+
+namespace fasttext {
+
+const int64_t ChunkIndex::MAX_CHUNK_BYTES;
+const int64_t ChunkIndex::MIN_CHUNK_BYTES;
+const int32_t ChunkIndex::CHUNKS_PER_THREAD;
+
+// Whether a chunk may end after byte c, followed by next, once it has run
+// extra bytes past its nominal end. It ends at a newline; a line running on
+// for limit more bytes is cut after the next whitespace, so no word is
+// split, and past 2 * limit anywhere outside a UTF-8 sequence.
+static bool endsChunk(int c, int next, int64_t extra, int64_t limit) {
+  if (c == '\n') return true;
+  if (extra < limit) return false;
+  if (c == ' ' || c == '\r' || c == '\t' || c == '\v' || c == '\f' ||
+      c == '\0') {
+    return true;
+  }
+  return extra >= 2 * limit && (next & 0xC0) != 0x80;
+}
+
+ChunkIndex::ChunkIndex() : tokenized_(false) {}
+
+bool ChunkIndex::isManifest(const std::string& path) {
+  const std::string ext = ".manifest";
+  return path.size() > ext.size() &&
+         path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+bool ChunkIndex::readManifest(const std::string& path) {
+  std::ifstream ifs(path);
+  if (!ifs.is_open()) {
+    std::cerr << "Manifest " << path << " cannot be opened!" << std::endl;
+    return false;
+  }
+  std::string dir;
+  size_t slash = path.rfind('/');
+  if (slash != std::string::npos) dir = path.substr(0, slash + 1);
+
+  std::string line;
+  while (std::getline(ifs, line)) {
+    size_t first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos || line[first] == '#') continue;
+    size_t last = line.find_last_not_of(" \t\r");
+    std::string shard = line.substr(first, last - first + 1);
+    paths_.push_back(shard[0] == '/' ? shard : dir + shard);
+  }
+  if (paths_.empty()) {
+    std::cerr << "Manifest " << path << " lists no shards!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void ChunkIndex::splitText(int32_t file, int64_t chunk_bytes) {
+  std::ifstream ifs(paths_[file], std::ifstream::binary);
+  const int64_t size = utils::size(ifs);
+  int64_t begin = 0;
+  while (begin < size) {
+    int64_t end = begin + chunk_bytes;
+    if (end >= size) {
+      end = size;
+    } else {
+      // extend the chunk up to and including the next newline, within
+      // bounds for text with few or no newlines
+      const int64_t nominal = end;
+      utils::seek(ifs, end - 1);
+      int c;
+      while ((c = ifs.get()) != EOF &&
+             !endsChunk(c, ifs.peek(), end - nominal, chunk_bytes)) {
+        end++;
+      }
+      end = std::min(end, size);
+    }
+    chunk_t chunk = {file, begin, end};
+    chunks_.push_back(chunk);
+    begin = end;
+  }
+}
+
+void ChunkIndex::splitTokenized(int32_t file, int64_t chunk_ids) {
+  const TokenizedCorpus& corpus = *corpora_[file];
+  const int32_t* ids = corpus.ids();
+  const int64_t size = corpus.size();
+  int64_t begin = 0;
+  while (begin < size) {
+    int64_t end = std::min(begin + chunk_ids, size);
+    while (end < size && ids[end - 1] != TokenizedCorpus::EOL) end++;
+    chunk_t chunk = {file, begin, end};
+    chunks_.push_back(chunk);
+    begin = end;
+  }
+}
+
+bool ChunkIndex::build(const std::string& input, const Dictionary& dict,
+                       int32_t nthreads) {
+  return index(input, &dict, nthreads);
+}
+
+bool ChunkIndex::buildText(const std::string& input, int32_t nthreads) {
+  return index(input, nullptr, nthreads);
+}
+
+bool ChunkIndex::index(const std::string& input, const Dictionary* dict,
+                       int32_t nthreads) {
+  paths_.clear();
+  corpora_.clear();
+  chunks_.clear();
+  if (isManifest(input)) {
+    if (!readManifest(input)) return false;
+  } else {
+    paths_.push_back(input);
+  }
+
+  int64_t total_bytes = 0;
+  for (size_t i = 0; i < paths_.size(); i++) {
+    std::ifstream ifs(paths_[i], std::ifstream::binary);
+    if (!ifs.is_open()) {
+      std::cerr << "Input file " << paths_[i] << " cannot be opened!"
+                << std::endl;
+      return false;
+    }
+    total_bytes += utils::size(ifs);
+    bool tokenized = TokenizedCorpus::isTokenized(paths_[i]);
+    if (i == 0) tokenized_ = tokenized;
+    if (tokenized != tokenized_) {
+      std::cerr << "Input shards mix text and tokenized files: " << paths_[i]
+                << std::endl;
+      return false;
+    }
+    if (tokenized && dict == nullptr) {
+      std::cerr << "Input " << paths_[i] << " must be text, not tokenized!"
+                << std::endl;
+      return false;
+    }
+    std::shared_ptr<TokenizedCorpus> corpus;
+    if (tokenized) {
+      corpus = std::make_shared<TokenizedCorpus>();
+      if (!corpus->open(paths_[i], *dict)) return false;
+    }
+    corpora_.push_back(corpus);
+  }
+
+  int64_t chunk_bytes = total_bytes / (int64_t(nthreads) * CHUNKS_PER_THREAD);
+  chunk_bytes =
+      std::max(MIN_CHUNK_BYTES, std::min(MAX_CHUNK_BYTES, chunk_bytes));
+  for (int32_t i = 0; i < paths_.size(); i++) {
+    if (tokenized_) {
+      splitTokenized(i, chunk_bytes / sizeof(int32_t));
+    } else {
+      splitText(i, chunk_bytes);
+    }
+  }
+  if (chunks_.empty()) {
+    std::cerr << "Training input " << input << " is empty!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int64_t ChunkIndex::ntokens() const {
+  if (!tokenized_) return -1;
+  int64_t result = 0;
+  for (size_t i = 0; i < corpora_.size(); i++) {
+    result += corpora_[i]->ntokens();
+  }
+  return result;
+}
+
+ChunkReader::ChunkReader(const ChunkIndex& index) : index_(index), file_(-1) {
+  buffer_.reserve(ChunkIndex::MAX_CHUNK_BYTES);
+}
+
+bool ChunkReader::load(const chunk_t& chunk) {
+  if (chunk.file != file_) {
+    ifs_.close();
+    ifs_.clear();
+    ifs_.open(index_.path(chunk.file), std::ifstream::binary);
+    file_ = chunk.file;
+  }
+  buffer_.resize(chunk.end - chunk.begin);
+  utils::seek(ifs_, chunk.begin);
+  ifs_.read(buffer_.data(), buffer_.size());
+  buffer_.resize(ifs_.gcount());
+  setg(buffer_.data(), buffer_.data(), buffer_.data() + buffer_.size());
+  return !buffer_.empty();
+}
+
+// Serves a block of stdin as a stream.
+struct block_reader_t : public std::streambuf {
+  explicit block_reader_t(std::vector<char>& block) {
+    setg(block.data(), block.data(), block.data() + block.size());
+  }
+};
+
+bool forEachTextChunk(const std::string& input, int32_t nthreads,
+                      const std::function<void(int32_t, std::istream&)>& fn) {
+  if (input == "-") {
+    // stdin cannot be split up front: blocks ending like chunks are read
+    // one per thread and processed together
+    std::vector<std::vector<char>> blocks(nthreads);
+    while (std::cin) {
+      int32_t n = 0;
+      for (; n < nthreads && std::cin; n++) {
+        std::vector<char>& block = blocks[n];
+        block.resize(ChunkIndex::MAX_CHUNK_BYTES);
+        std::cin.read(block.data(), block.size());
+        block.resize(std::cin.gcount());
+        int c;
+        while (std::cin && (c = std::cin.get()) != EOF) {
+          block.push_back(c);
+          if (endsChunk(c, std::cin.peek(),
+                        int64_t(block.size()) - ChunkIndex::MAX_CHUNK_BYTES,
+                        ChunkIndex::MAX_CHUNK_BYTES)) {
+            break;
+          }
+        }
+      }
+      utils::parallelFor(n, nthreads, [&](int64_t i) {
+        block_reader_t reader(blocks[i]);
+        std::istream text(&reader);
+        fn(i, text);
+      });
+    }
+    return true;
+  }
+
+  ChunkIndex index;
+  if (!index.buildText(input, nthreads)) return false;
+  std::atomic<int64_t> next(0);
+  std::vector<std::thread> threads;
+  for (int32_t t = 0; t < nthreads; t++) {
+    threads.push_back(std::thread([&, t]() {
+      ChunkReader reader(index);
+      std::istream text(&reader);
+      for (int64_t i = next++; i < index.size(); i = next++) {
+        reader.load(index.chunk(i));
+        text.clear();
+        fn(t, text);
+      }
+    }));
+  }
+  for (int32_t t = 0; t < nthreads; t++) threads[t].join();
+  return true;
+}
+
+ChunkScheduler::ChunkScheduler(int64_t n, int32_t nworkers)
+    : ranges_(new range_t[nworkers]), nworkers_(nworkers) {
+  for (int32_t i = 0; i < nworkers; i++) {
+    ranges_[i].begin = i * n / nworkers;
+    ranges_[i].end = (i + 1) * n / nworkers;
+  }
+}
+
+bool ChunkScheduler::next(int32_t worker, int64_t& item) {
+  do {
+    std::lock_guard<std::mutex> lock(ranges_[worker].mutex);
+    if (ranges_[worker].begin < ranges_[worker].end) {
+      item = ranges_[worker].begin++;
+      return true;
+    }
+  } while (steal(worker));
+  return false;
+}
+
+std::vector<std::pair<int64_t, int64_t>> ChunkScheduler::ranges() {
+  std::vector<std::pair<int64_t, int64_t>> ranges;
+  for (int32_t i = 0; i < nworkers_; i++) {
+    std::lock_guard<std::mutex> lock(ranges_[i].mutex);
+    ranges.push_back(std::make_pair(ranges_[i].begin, ranges_[i].end));
+  }
+  return ranges;
+}
+
+void ChunkScheduler::restore(
+    const std::vector<std::pair<int64_t, int64_t>>& ranges) {
+  for (int32_t i = 0; i < nworkers_; i++) {
+    std::lock_guard<std::mutex> lock(ranges_[i].mutex);
+    ranges_[i].begin = ranges[i].first;
+    ranges_[i].end = ranges[i].second;
+  }
+}
+
+bool ChunkScheduler::steal(int32_t worker) {
+  while (true) {
+    int32_t victim = -1;
+    int64_t largest = 0;
+    for (int32_t i = 0; i < nworkers_; i++) {
+      if (i == worker) continue;
+      std::lock_guard<std::mutex> lock(ranges_[i].mutex);
+      if (ranges_[i].end - ranges_[i].begin > largest) {
+        largest = ranges_[i].end - ranges_[i].begin;
+        victim = i;
+      }
+    }
+    if (victim < 0) return false;
+
+    int64_t begin, end;
+    {
+      std::lock_guard<std::mutex> lock(ranges_[victim].mutex);
+      int64_t remaining = ranges_[victim].end - ranges_[victim].begin;
+      // someone else got there first, look again
+      if (remaining <= 0) continue;
+      end = ranges_[victim].end;
+      begin = end - (remaining + 1) / 2;
+      ranges_[victim].end = begin;
+    }
+    std::lock_guard<std::mutex> lock(ranges_[worker].mutex);
+    ranges_[worker].begin = begin;
+    ranges_[worker].end = end;
+    return true;
+  }
+}
+
+}  // namespace fasttext
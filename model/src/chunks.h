@@ -0,0 +1,134 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#ifndef FASTTEXT_CHUNKS_H
+#define FASTTEXT_CHUNKS_H
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "corpus.h"
+#include "dictionary.h"
+
+namespace fasttext {
+
+// A line-aligned piece of one input file: a byte range of a text shard or
+// an id range of a tokenized one. Chunks end at line ends, except that a
+// text line much longer than a chunk is cut, at whitespace if there is
+// any, so that text without newlines still splits up; never inside a UTF-8
+// sequence.
+struct chunk_t {
+  int32_t file;
+  int64_t begin;
+  int64_t end;
+};
+
+// Splits the training input into chunks. The input is either a single file
+// (text or .tok) or a ".manifest" listing one shard path per line; relative
+// paths are taken from the manifest's directory, blank lines and lines
+// starting with '#' are skipped. All shards must be of the same kind.
+class ChunkIndex {
+ private:
+  std::vector<std::string> paths_;
+  std::vector<std::shared_ptr<TokenizedCorpus>> corpora_;
+  std::vector<chunk_t> chunks_;
+  bool tokenized_;
+
+  bool readManifest(const std::string&);
+  bool index(const std::string&, const Dictionary*, int32_t);
+  void splitText(int32_t, int64_t);
+  void splitTokenized(int32_t, int64_t);
+
+ public:
+  static const int64_t MAX_CHUNK_BYTES = 4 << 20;
+  static const int64_t MIN_CHUNK_BYTES = 64 << 10;
+  // chunks per worker aimed for on small inputs, so stealing can balance
+  static const int32_t CHUNKS_PER_THREAD = 8;
+
+  ChunkIndex();
+
+  static bool isManifest(const std::string&);
+  bool build(const std::string&, const Dictionary&, int32_t);
+  // same for commands without a dictionary: the input must be text
+  bool buildText(const std::string&, int32_t);
+
+  int64_t size() const { return chunks_.size(); }
+  const chunk_t& chunk(int64_t i) const { return chunks_[i]; }
+  int32_t nfiles() const { return paths_.size(); }
+  const std::string& path(int32_t file) const { return paths_[file]; }
+  bool tokenized() const { return tokenized_; }
+  const TokenizedCorpus& corpus(int32_t file) const { return *corpora_[file]; }
+  // number of corpus tokens if known without a pass over the text, else -1
+  int64_t ntokens() const;
+};
+
+// Reads a text chunk into memory and serves it as a stream, so
+// Dictionary::getLine can consume it and stop exactly at its end.
+class ChunkReader : public std::streambuf {
+ private:
+  const ChunkIndex& index_;
+  std::ifstream ifs_;
+  int32_t file_;
+  std::vector<char> buffer_;
+
+ public:
+  explicit ChunkReader(const ChunkIndex&);
+  bool load(const chunk_t&);
+  bool done() { return sgetc() == traits_type::eof(); }
+  // bytes of the loaded chunk consumed so far, and skipping to such a point
+  int64_t offset() const { return gptr() - eback(); }
+  void seek(int64_t offset) { setg(eback(), eback() + offset, egptr()); }
+};
+
+// Hands out work items [0, n) to workers. Every worker owns a contiguous
+// range and takes items from its front; an idle worker steals the back half
+// of the largest remaining range. Items are coarse (whole chunks), so one
+// mutex per range is cheap.
+class ChunkScheduler {
+ private:
+  struct range_t {
+    std::mutex mutex;
+    int64_t begin;
+    int64_t end;
+    char padding[64];
+  };
+  std::unique_ptr<range_t[]> ranges_;
+  int32_t nworkers_;
+
+  bool steal(int32_t);
+
+ public:
+  ChunkScheduler(int64_t, int32_t);
+  bool next(int32_t, int64_t&);
+  // the [begin, end) items left to every worker, and handing out exactly
+  // those again on resume
+  std::vector<std::pair<int64_t, int64_t>> ranges();
+  void restore(const std::vector<std::pair<int64_t, int64_t>>&);
+};
+
+// Runs fn(thread, text) over every line-aligned piece of a text input (a
+// file, a .manifest or "-" for stdin) on nthreads threads; calls with the
+// same thread number never overlap. Returns false if the input cannot be
+// indexed.
+bool forEachTextChunk(const std::string&, int32_t,
+                      const std::function<void(int32_t, std::istream&)>&);
+
+}  // namespace fasttext
+
+#endif
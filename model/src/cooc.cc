@@ -0,0 +1,280 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#include "cooc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+#include "chunks.h"
+#include "corpus.h"
+#include "matrix.h"
+#include "utils.h"
+
+namespace fasttext {
+
+const char CoocCounter::MAGIC[8] = {'F', 'T', 'C', 'O', 'O', 'C', '0', '1'};
+const int32_t CoocCounter::VERSION;
+const int32_t CoocCounter::NSHARDS;
+const uint64_t CoocCounter::EMPTY;
+
+CoocCounter::CoocCounter(const Dictionary& dict, const Args& args,
+                         int64_t capacity, const std::string& prefix)
+    : dict_(dict),
+      ws_(args.ws),
+      minCount_(args.minCount),
+      capacity_(capacity),
+      prefix_(prefix),
+      shards_(NSHARDS),
+      bytes_(0),
+      npairs_(0) {
+  for (int32_t s = 0; s < NSHARDS; s++) {
+    shards_[s].size = 0;
+    shards_[s].shift = 64;
+  }
+}
+
+bool CoocCounter::isCooc(const std::string& path) {
+  std::ifstream in(path, std::ifstream::binary);
+  char magic[sizeof(MAGIC)];
+  if (!in.read(magic, sizeof(magic))) return false;
+  return memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+int32_t CoocCounter::shardOf(int32_t w) const {
+  return int64_t(w) * NSHARDS / dict_.nwords;
+}
+
+void CoocCounter::grow(table_t& table) {
+  const int64_t size = std::max(int64_t(64), int64_t(table.keys.size()) * 2);
+  std::vector<uint64_t> keys(size, EMPTY);
+  std::vector<int64_t> weights(size, 0);
+  int32_t shift = 64;
+  while ((int64_t(1) << (64 - shift)) < size) shift--;
+  for (size_t i = 0; i < table.keys.size(); i++) {
+    if (table.keys[i] == EMPTY) continue;
+    uint64_t h = (table.keys[i] * 0x9E3779B97F4A7C15ull) >> shift;
+    while (keys[h] != EMPTY) h = (h + 1) & (size - 1);
+    keys[h] = table.keys[i];
+    weights[h] = table.weights[i];
+  }
+  bytes_ += (size - int64_t(table.keys.size())) *
+            (sizeof(uint64_t) + sizeof(int64_t));
+  table.keys.swap(keys);
+  table.weights.swap(weights);
+  table.shift = shift;
+}
+
+void CoocCounter::add(int32_t w1, int32_t w2, int64_t weight) {
+  table_t& table = shards_[shardOf(w1)];
+  if (2 * (table.size + 1) > int64_t(table.keys.size())) grow(table);
+  const uint64_t key = uint64_t(w1) << 32 | uint32_t(w2);
+  const uint64_t mask = table.keys.size() - 1;
+  uint64_t h = (key * 0x9E3779B97F4A7C15ull) >> table.shift;
+  while (table.keys[h] != key && table.keys[h] != EMPTY) h = (h + 1) & mask;
+  if (table.keys[h] == EMPTY) {
+    table.keys[h] = key;
+    table.size++;
+  }
+  table.weights[h] += weight;
+  npairs_++;
+}
+
+void CoocCounter::countLine() {
+  const int32_t n = line_.size();
+  for (int32_t i = 0; i < n; i++) {
+    if (line_[i] < 0) continue;
+    for (int32_t j = std::max(i - ws_, 0); j < std::min(i + ws_, n); j++) {
+      if (j == i || line_[j] < 0) continue;
+      add(line_[i], line_[j], ws_ - std::abs(i - j) + 1);
+    }
+  }
+  line_.clear();
+  if (capacity_ > 0 && bytes_ > capacity_) spill();
+}
+
+void CoocCounter::count(std::istream& in) {
+  std::string token;
+  line_.clear();
+  while (Dictionary::readWord(in, token)) {
+    if (token == Dictionary::EOS) {
+      countLine();
+      continue;
+    }
+    int32_t id = dict_.getWordIndex(token);
+    if (id >= 0 && dict_.getWordFreq(id) < minCount_) id = -1;
+    line_.push_back(id);
+  }
+  countLine();
+}
+
+void CoocCounter::collect(int32_t s, std::vector<entry_t>& out) const {
+  const table_t& table = shards_[s];
+  for (size_t i = 0; i < table.keys.size(); i++) {
+    if (table.keys[i] != EMPTY) {
+      out.push_back(entry_t(table.keys[i], table.weights[i]));
+    }
+  }
+}
+
+void CoocCounter::spill() {
+  run_t run;
+  run.path = prefix_ + "." + std::to_string(runs_.size());
+  std::ofstream ofs(run.path, std::ofstream::binary);
+  if (!ofs.is_open()) {
+    std::cerr << "Spill file " << run.path << " cannot be opened!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::vector<entry_t> entries;
+  int64_t offset = 0;
+  for (int32_t s = 0; s < NSHARDS; s++) {
+    run.offsets.push_back(offset);
+    entries.clear();
+    collect(s, entries);
+    ofs.write((char*)entries.data(), entries.size() * sizeof(entry_t));
+    offset += entries.size() * sizeof(entry_t);
+    table_t& table = shards_[s];
+    std::vector<uint64_t>().swap(table.keys);
+    std::vector<int64_t>().swap(table.weights);
+    table.size = 0;
+    table.shift = 64;
+  }
+  run.offsets.push_back(offset);
+  ofs.close();
+  if (!ofs) {
+    std::cerr << "Error writing spill file " << run.path << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  bytes_ = 0;
+  runs_.push_back(run);
+}
+
+void CoocCounter::readRuns(int32_t s, std::vector<entry_t>& out) const {
+  for (size_t r = 0; r < runs_.size(); r++) {
+    const run_t& run = runs_[r];
+    const int64_t n = (run.offsets[s + 1] - run.offsets[s]) / sizeof(entry_t);
+    std::ifstream ifs(run.path, std::ifstream::binary);
+    utils::seek(ifs, run.offsets[s]);
+    const size_t size = out.size();
+    out.resize(size + n);
+    ifs.read((char*)(out.data() + size), n * sizeof(entry_t));
+    if (!ifs) {
+      std::cerr << "Error reading spill file " << run.path << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+void CoocCounter::build(const Args& args, const Dictionary& dict) {
+  auto start = std::chrono::steady_clock::now();
+  const int32_t nthreads = std::max(args.thread, 1);
+  const int64_t capacity =
+      args.vocabMemory > 0 ? (int64_t(args.vocabMemory) << 20) / nthreads : 0;
+  const std::string path = args.output + ".cooc";
+  std::vector<std::shared_ptr<CoocCounter>> counters;
+  for (int32_t t = 0; t < nthreads; t++) {
+    counters.push_back(std::make_shared<CoocCounter>(
+        dict, args, capacity, path + ".tmp" + std::to_string(t)));
+  }
+  if (!forEachTextChunk(args.input, nthreads,
+                        [&](int32_t t, std::istream& text) {
+                          counters[t]->count(text);
+                        })) {
+    exit(EXIT_FAILURE);
+  }
+  int64_t npairs = 0, nruns = 0;
+  for (int32_t t = 0; t < nthreads; t++) {
+    npairs += counters[t]->npairs();
+    nruns += counters[t]->runs_.size();
+  }
+
+  std::ofstream ofs(path, std::ofstream::binary);
+  if (!ofs.is_open()) {
+    std::cerr << "Co-occurrence file cannot be opened for saving!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  cooc_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.nwords = dict.nwords;
+  header.vocab_hash = TokenizedCorpus::vocabHash(dict);
+  header.ws = args.ws;
+  std::vector<int64_t> offsets(dict.nwords + 1, 0);
+  ofs.write((char*)&header, sizeof(header));
+  Matrix::writeAligned(ofs, offsets.data(), offsets.size() * sizeof(int64_t));
+
+  // shards are merged nthreads at a time and written in order, so the rows
+  // come out sorted by word and then by context
+  std::vector<std::vector<context_info_t>> merged(nthreads);
+  for (int32_t first = 0; first < NSHARDS; first += nthreads) {
+    const int32_t n = std::min(nthreads, NSHARDS - first);
+    utils::parallelFor(n, nthreads, [&](int64_t i) {
+      std::vector<entry_t> entries;
+      for (int32_t t = 0; t < nthreads; t++) {
+        counters[t]->readRuns(first + i, entries);
+        counters[t]->collect(first + i, entries);
+      }
+      std::sort(entries.begin(), entries.end());
+      merged[i].clear();
+      for (size_t k = 0; k < entries.size();) {
+        const uint64_t key = entries[k].first;
+        int64_t weight = 0;
+        for (; k < entries.size() && entries[k].first == key; k++) {
+          weight += entries[k].second;
+        }
+        const int32_t w1 = key >> 32;
+        const int32_t w2 = key & 0xFFFFFFFF;
+        merged[i].push_back(
+            context_info_t(w2, real(weight) / dict.getWordFreq(w1)));
+        offsets[w1 + 1]++;
+      }
+    });
+    for (int32_t i = 0; i < n; i++) {
+      ofs.write((char*)merged[i].data(),
+                merged[i].size() * sizeof(context_info_t));
+      header.nnz += merged[i].size();
+    }
+  }
+  for (int32_t w = 0; w < dict.nwords; w++) offsets[w + 1] += offsets[w];
+
+  ofs.seekp(0);
+  ofs.write((char*)&header, sizeof(header));
+  ofs.write((char*)offsets.data(), offsets.size() * sizeof(int64_t));
+  ofs.close();
+  for (int32_t t = 0; t < nthreads; t++) {
+    for (size_t r = 0; r < counters[t]->runs_.size(); r++) {
+      remove(counters[t]->runs_[r].path.c_str());
+    }
+  }
+  if (!ofs) {
+    std::cerr << "Error writing co-occurrences " << path << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  std::cerr << "co-occurrences: " << npairs << " window pairs, " << header.nnz
+            << " distinct, " << nruns << " spilled runs, written to " << path
+            << " in " << seconds << "s" << std::endl;
+}
+
+}  // namespace fasttext
@@ -0,0 +1,106 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#ifndef FASTTEXT_COOC_H
+#define FASTTEXT_COOC_H
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "args.h"
+#include "dictionary.h"
+
+namespace fasttext {
+
+// Context scores file: this 64-byte header, the nwords + 1 row offsets
+// (int64) and, from the next 64-byte boundary, nnz context_info_t entries.
+// Row w holds the contexts of word w sorted by word id, each scored by its
+// window weight over the frequency of w, as loadContextCooccurences used to
+// compute from the text triples.
+struct cooc_header_t {
+  char magic[8];
+  int32_t version;
+  int32_t nwords;
+  uint64_t vocab_hash;
+  int64_t nnz;
+  int32_t ws;
+  char reserved[28];
+};
+
+// Windowed co-occurrence counts like get_context_scores.pl: the word at i
+// and the one at j, with i - ws <= j < i + ws and j != i, add
+// ws - |i - j| + 1 to the pair. Words rarer than minCount are skipped but
+// keep their positions.
+//
+// Every thread adds into its own open-addressing tables, one per shard of
+// rows. With a memory cap a thread that outgrows its share spills its
+// tables to a run file, one section per shard, and starts over. The shards
+// are then merged one at a time from the runs and the tables left in
+// memory, so the merge needs about a shard's worth of memory per thread.
+class CoocCounter {
+ private:
+  // pair (w1 << 32 | w2) -> weight
+  struct table_t {
+    std::vector<uint64_t> keys;
+    std::vector<int64_t> weights;
+    int64_t size;
+    int32_t shift;
+  };
+  // a spill file with the byte offset of each shard's section
+  struct run_t {
+    std::string path;
+    std::vector<int64_t> offsets;
+  };
+  typedef std::pair<uint64_t, int64_t> entry_t;
+
+  const Dictionary& dict_;
+  int32_t ws_;
+  int64_t minCount_;
+  int64_t capacity_;
+  std::string prefix_;
+  std::vector<table_t> shards_;
+  int64_t bytes_;
+  int64_t npairs_;
+  std::vector<run_t> runs_;
+  std::vector<int32_t> line_;
+
+  int32_t shardOf(int32_t) const;
+  void add(int32_t, int32_t, int64_t);
+  void grow(table_t&);
+  void collect(int32_t, std::vector<entry_t>&) const;
+  void countLine();
+  void spill();
+  void readRuns(int32_t, std::vector<entry_t>&) const;
+
+ public:
+  static const char MAGIC[8];
+  static const int32_t VERSION = 1;
+  static const int32_t NSHARDS = 256;
+  static const uint64_t EMPTY = ~uint64_t(0);
+
+  // capacity is the table bytes allowed before spilling, 0 for no limit;
+  // spill files are named <prefix>.<n>
+  CoocCounter(const Dictionary&, const Args&, int64_t, const std::string&);
+
+  void count(std::istream&);
+  int64_t npairs() const { return npairs_; }
+
+  static bool isCooc(const std::string&);
+  // counts args.input with args.thread threads and writes <output>.cooc
+  static void build(const Args&, const Dictionary&);
+};
+
+}  // namespace fasttext
+
+#endif
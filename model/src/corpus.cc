@@ -0,0 +1,151 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#include "corpus.h"
+
+#include <string.h>
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace fasttext {
+
+const int32_t TokenizedCorpus::EOL;
+const int32_t TokenizedCorpus::VERSION;
+const char TokenizedCorpus::MAGIC[8] = {'F', 'T', 'T', 'O', 'K', 'E', 'N', 'S'};
+
+TokenizedCorpus::TokenizedCorpus() : ids_(nullptr) {
+  memset(&header_, 0, sizeof(header_));
+}
+
+bool TokenizedCorpus::isTokenized(const std::string& path) {
+  std::ifstream in(path, std::ifstream::binary);
+  char magic[sizeof(MAGIC)];
+  if (!in.read(magic, sizeof(magic))) return false;
+  return memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+uint64_t TokenizedCorpus::vocabHash(const Dictionary& dict) {
+  uint64_t h = 14695981039346656037ull;
+  for (int32_t i = 0; i < dict.nwords; i++) {
+    const std::string word = dict.getWord(i);
+    for (size_t j = 0; j <= word.size(); j++) {
+      h = (h ^ uint8_t(j < word.size() ? word[j] : '\n')) * 1099511628211ull;
+    }
+  }
+  return h;
+}
+
+bool TokenizedCorpus::readLines(const Dictionary& dict, std::istream& in,
+                                std::string& token, std::vector<int32_t>& ids,
+                                size_t n) {
+  const size_t start = ids.size();
+  bool line_open = false;
+  while (dict.readWord(in, token)) {
+    int32_t id = dict.getWordIndex(token);
+    if (id >= 0) {
+      ids.push_back(id);
+      line_open = true;
+    }
+    if (token == Dictionary::EOS) {
+      ids.push_back(EOL);
+      line_open = false;
+      if (ids.size() >= n) return true;
+    }
+  }
+  if (line_open) ids.push_back(EOL);
+  return ids.size() > start;
+}
+
+void TokenizedCorpus::build(const Dictionary& dict, std::istream& in,
+                            const std::string& path) {
+  TokenizedWriter writer;
+  if (!writer.open(path, dict)) {
+    std::cerr << "Tokenized corpus file cannot be opened for saving!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  const size_t BUFFER_SIZE = 1 << 20;
+  std::vector<int32_t> buffer;
+  buffer.reserve(BUFFER_SIZE + 1);
+  std::string token;
+  while (readLines(dict, in, token, buffer, BUFFER_SIZE)) {
+    writer.write(buffer);
+    buffer.clear();
+  }
+  if (!writer.close()) {
+    std::cerr << "Error writing tokenized corpus " << path << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::cerr << "tokenized: " << writer.header().ntokens << " tokens, "
+            << writer.header().nlines << " lines" << std::endl;
+}
+
+bool TokenizedCorpus::open(const std::string& path, const Dictionary& dict) {
+  if (!file_.open(path) || file_.size() < sizeof(corpus_header_t)) {
+    std::cerr << "tokenized corpus: bad path " << path << std::endl;
+    return false;
+  }
+  memcpy(&header_, file_.data(), sizeof(header_));
+  if (memcmp(header_.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header_.version != VERSION ||
+      file_.size() != sizeof(header_) + header_.size * sizeof(int32_t)) {
+    std::cerr << "tokenized corpus: bad format " << path << std::endl;
+    return false;
+  }
+  if (header_.nwords != dict.nwords || header_.vocab_hash != vocabHash(dict)) {
+    std::cerr << "tokenized corpus: " << path
+              << " was built with another vocabulary" << std::endl;
+    return false;
+  }
+  ids_ = reinterpret_cast<const int32_t*>(file_.data() + sizeof(header_));
+  return true;
+}
+
+int64_t TokenizedCorpus::alignToLine(int64_t pos) const {
+  if (pos <= 0) return 0;
+  while (pos < header_.size && ids_[pos - 1] != EOL) pos++;
+  return pos < header_.size ? pos : 0;
+}
+
+bool TokenizedWriter::open(const std::string& path, const Dictionary& dict) {
+  ofs_.open(path, std::ofstream::binary);
+  if (!ofs_.is_open()) return false;
+  memset(&header_, 0, sizeof(header_));
+  memcpy(header_.magic, TokenizedCorpus::MAGIC, sizeof(header_.magic));
+  header_.version = TokenizedCorpus::VERSION;
+  header_.nwords = dict.nwords;
+  header_.vocab_hash = TokenizedCorpus::vocabHash(dict);
+  ofs_.write((char*)&header_, sizeof(header_));
+  return true;
+}
+
+void TokenizedWriter::write(const std::vector<int32_t>& ids) {
+  for (size_t i = 0; i < ids.size(); i++) {
+    if (ids[i] == TokenizedCorpus::EOL) {
+      header_.nlines++;
+    } else {
+      header_.ntokens++;
+    }
+  }
+  header_.size += ids.size();
+  ofs_.write((char*)ids.data(), ids.size() * sizeof(int32_t));
+}
+
+bool TokenizedWriter::close() {
+  ofs_.seekp(0);
+  ofs_.write((char*)&header_, sizeof(header_));
+  ofs_.close();
+  return bool(ofs_);
+}
+
+}  // namespace fasttext
@@ -0,0 +1,86 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#ifndef FASTTEXT_CORPUS_H
+#define FASTTEXT_CORPUS_H
+
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "dictionary.h"
+#include "utils.h"
+
+namespace fasttext {
+
+// Pre-tokenized corpus: a 64-byte header followed by a stream of int32 word
+// ids in corpus order, every line terminated by EOL. Out-of-vocabulary
+// tokens are dropped, subsampling is left to training time.
+struct corpus_header_t {
+  char magic[8];
+  int32_t version;
+  int32_t nwords;
+  uint64_t vocab_hash;
+  int64_t ntokens;
+  int64_t nlines;
+  int64_t size;
+  char reserved[16];
+};
+
+class TokenizedCorpus {
+ private:
+  utils::MappedFile file_;
+  const int32_t* ids_;
+  corpus_header_t header_;
+
+ public:
+  static const int32_t EOL = -1;
+  static const char MAGIC[8];
+  static const int32_t VERSION = 1;
+
+  TokenizedCorpus();
+
+  static bool isTokenized(const std::string&);
+  static uint64_t vocabHash(const Dictionary&);
+  static void build(const Dictionary&, std::istream&, const std::string&);
+  // appends the ids of whole lines read from in, each ended by EOL, until
+  // ids holds at least n of them or the input ends; false if nothing was
+  // left to read. token is only a buffer.
+  static bool readLines(const Dictionary&, std::istream&, std::string&,
+                        std::vector<int32_t>&, size_t);
+
+  bool open(const std::string&, const Dictionary&);
+
+  const int32_t* ids() const { return ids_; }
+  int64_t size() const { return header_.size; }
+  int64_t ntokens() const { return header_.ntokens; }
+  int64_t nlines() const { return header_.nlines; }
+  int64_t alignToLine(int64_t) const;
+};
+
+// Writes a tokenized corpus piece by piece; close() fills in the header.
+class TokenizedWriter {
+ private:
+  std::ofstream ofs_;
+  corpus_header_t header_;
+
+ public:
+  bool open(const std::string&, const Dictionary&);
+  void write(const std::vector<int32_t>&);
+  bool close();
+  const corpus_header_t& header() const { return header_; }
+};
+
+}  // namespace fasttext
+
+#endif
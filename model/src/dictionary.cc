@@ -13,63 +13,277 @@
 
 #include <assert.h>
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <algorithm>
 #include <iostream>
 #include <iterator>
+#include <sstream>
 #include <unordered_map>
 
+#include "cooc.h"
+#include "corpus.h"
+#include "matrix.h"
+#include "utils.h"
+
 namespace fasttext {
 
 const std::string Dictionary::EOS = "</s>";
 const std::string Dictionary::BOW = "<";
 const std::string Dictionary::EOW = ">";
 
-Dictionary::Dictionary(std::shared_ptr<Args> args) {
+const char Dictionary::CACHE_MAGIC[8] = {'F', 'T', 'D', 'I', 'C', 'T', 'C', 'H'};
+const int32_t Dictionary::CACHE_VERSION;
+const int32_t Dictionary::MAX_SOURCE_LEXEMS;
+
+Dictionary::Dictionary(std::shared_ptr<Args> args)
+    : ngram_begin_(0), context_offsets_(nullptr), contexts_(nullptr) {
   args_ = *args;
 
+  if (!args_.dict_cache_path.empty() && loadCache(args_.dict_cache_path)) {
+    std::cerr << "dictionary loaded from cache " << args_.dict_cache_path
+              << "\nwords: " << nwords << ", lexems: " << nlexems << "\n\n";
+  } else {
+    build();
+    if (!args_.dict_cache_path.empty()) {
+      saveCache(args_.dict_cache_path);
+    }
+  }
+  if (!args_.context_cooccurences_path.empty()) {
+    loadContextCooccurences(args_.context_cooccurences_path);
+  }
+}
+
+void Dictionary::build() {
   std::cerr << "---------------------\npreparing dictionary...\n\n";
 
   loadWordsVocabulary(args_.dict_vocab_freq_path);
   ntokens = sum_freq_words_full;
-  //  loadContextCooccurences(args_.context_cooccurences_path);
 
+  loadSources();
+
+  //	std::vector<std::string> names = {"ngram", "morph", "smart_morph",
+  //"syns_RT", "analogy"};
+  const std::vector<std::string> names = {"ngram", "morph", "smart_morph"};
+
+  //, "contexts"};
+  // ngram, morph, smart_morph, analogy
+  cnt_sources = names.size() + 1;
+
+  const size_t block = 4096;
+  utils::parallelFor(
+      (words_.size() + block - 1) / block, args_.thread, [&](int64_t b) {
+        for (size_t w = b * block; w < words_.size() && w < (b + 1) * block;
+             w++) {
+          word_info_t& word = words_[w];
+          int32_t word_ind = getWordIndex(word.word);
+
+          word.lexems.resize(cnt_sources);
+          // base
+          if (word_ind >= 0) word.lexems[0].push_back(word_ind);
+
+          for (size_t i = 0; i < names.size(); ++i) {
+            int32_t cnt = 0;
+            std::vector<int32_t>& buf_v = word.source_lexems[names[i]];
+            for (size_t j = 0; j < buf_v.size() && cnt < MAX_SOURCE_LEXEMS;
+                 ++j) {
+              word.lexems[i + 1].push_back(buf_v[j]);
+              cnt++;
+            }
+          }
+        }
+      });
+  //  shrinkContexts(0.1);
+  shrinkLexemsDict();
+  freezeLexems();
+  loadSynonyms("syns_RT");
+  nlexems = lexems_.size() + ngram_buckets_.size();
+  std::cerr << "words: " << nwords << ", lexems: " << nlexems
+            << " (hashed ngrams: " << ngram_buckets_.size() << ")" << std::endl;
+  std::cerr << "dictionary prepared!\n---------------------\n\n";
+
+  initTableDiscard();
+  initNSCounts();
+}
+
+// Everything the built dictionary depends on: the format version, every
+// input file (path, size, mtime) and the source names they are loaded under.
+std::string Dictionary::cacheKey() const {
+  std::ostringstream key;
+  key << CACHE_VERSION << '\n' << utils::fingerprint(args_.dict_vocab_freq_path);
   for (auto it = args_.dict_source_path.begin();
        it != args_.dict_source_path.end(); it++) {
-    loadSource(it->first, it->second.path, it->second.lexems_info_path);
+    if (it->second.path.empty()) continue;
+    key << '\n'
+        << it->first << ' ' << utils::fingerprint(it->second.path) << ' '
+        << utils::fingerprint(it->second.lexems_info_path);
+  }
+  if (hashNgrams()) {
+    key << "\nngram " << args_.minn << ' ' << args_.maxn << ' '
+        << args_.bucket;
   }
+  return key.str();
+}
 
-  for (auto& word : words_) {
-    int32_t word_ind = getWordIndex(word.word);
-    //	std::vector<std::string> names = {"ngram", "morph", "smart_morph",
-    //"syns_RT", "analogy"};
-    std::vector<std::string> names = {"ngram", "morph", "smart_morph"};
+bool Dictionary::loadCache(const std::string& path) {
+  std::ifstream in(path, std::ifstream::binary);
+  if (!in.is_open()) return false;
+  char magic[sizeof(CACHE_MAGIC)];
+  std::string key;
+  in.read(magic, sizeof(magic));
+  utils::readString(in, key);
+  if (!in || memcmp(magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+      key != cacheKey()) {
+    std::cerr << "dictionary cache " << path << " is stale, rebuilding\n";
+    return false;
+  }
+  load(in);
+  if (!in) {
+    std::cerr << "dictionary cache " << path << " is corrupted, rebuilding\n";
+    return false;
+  }
+  return true;
+}
 
-    //, "contexts"};
-    // ngram, morph, smart_morph, analogy
-    cnt_sources = names.size() + 1;
+void Dictionary::saveCache(const std::string& path) const {
+  std::string tmp_path = path + ".tmp";
+  std::ofstream out(tmp_path, std::ofstream::binary);
+  if (!out.is_open()) {
+    std::cerr << "dictionary cache " << path << " cannot be written\n";
+    return;
+  }
+  out.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  utils::writeString(out, cacheKey());
+  save(out);
+  out.close();
+  if (!out || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    std::cerr << "dictionary cache " << path << " cannot be written\n";
+    remove(tmp_path.c_str());
+  }
+}
 
-    word.lexems.resize(cnt_sources);
-    // base
-    if (word_ind >= 0) word.lexems[0].push_back(word_ind);
+void Dictionary::save(std::ostream& out) const {
+  utils::writePod(out, nwords);
+  utils::writePod(out, nlexems);
+  utils::writePod(out, ntokens);
+  utils::writePod(out, cnt_sources);
+  utils::writePod(out, sum_freq_words_full);
+  utils::writePod(out, sum_freq_words_uniq);
+
+  for (int32_t i = 0; i < nwords; i++) {
+    const word_info_t& info = words_[i];
+    utils::writeString(out, info.word);
+    utils::writePod(out, info.freq);
+    utils::writePod(out, info.zipf_rate);
+    std::vector<int32_t> synonyms(info.synonyms.begin(), info.synonyms.end());
+    std::sort(synonyms.begin(), synonyms.end());
+    utils::writeVector(out, synonyms);
+  }
 
-    for (size_t i = 0; i < names.size(); ++i) {
-      int32_t cnt = 0;
-      std::vector<int32_t>& buf_v = word.source_lexems[names[i]];
-      for (size_t j = 0; j < buf_v.size() && cnt < 10; ++j) {
-        word.lexems[i + 1].push_back(buf_v[j]);
-        cnt++;
-      }
-    }
+  utils::writeVector(out, ngram_buckets_);
+  for (size_t i = 0; i < lexems_.size(); i++) {
+    utils::writeString(out, lexems_[i]);
   }
-  //  shrinkContexts(0.1);
-  shrinkLexemsDict();
-  loadSynonyms("syns_RT");
-  nlexems = lexems_.size();
-  std::cerr << "words: " << nwords << ", lexems: " << nlexems << std::endl;
-  std::cerr << "dictionary prepared!\n---------------------\n\n";
+  utils::writeVector(out, lexem_offsets_);
+  utils::writeVector(out, lexem_ids_);
+
+  utils::writePod(out, int32_t(sources_.size()));
+  for (size_t i = 0; i < sources_.size(); i++) {
+    utils::writeString(out, sources_[i].name);
+    utils::writePod(out, sources_[i].sum_freq_uniq);
+    utils::writePod(out, sources_[i].sum_freq_full);
+  }
+  utils::writeVector(out, lexem_freq_uniq_);
+  utils::writeVector(out, lexem_freq_full_);
+  utils::writeVector(out, lexem_zipf_rate_);
+  utils::writeVector(out, lexem_source_);
+
+  std::vector<int32_t> ns_ids;
+  std::vector<int64_t> ns_counts;
+  for (size_t i = 0; i < lexems_ns_counts_.size(); i++) {
+    ns_ids.push_back(lexems_ns_counts_[i].h);
+    ns_counts.push_back(lexems_ns_counts_[i].cnt);
+  }
+  utils::writeVector(out, ns_ids);
+  utils::writeVector(out, ns_counts);
+  utils::writePod(out, args_.t);
+  utils::writeVector(out, pdiscard_);
+}
 
-  initTableDiscard();
-  initNSCounts();
+void Dictionary::load(std::istream& in) {
+  utils::readPod(in, nwords);
+  utils::readPod(in, nlexems);
+  utils::readPod(in, ntokens);
+  utils::readPod(in, cnt_sources);
+  utils::readPod(in, sum_freq_words_full);
+  utils::readPod(in, sum_freq_words_uniq);
+
+  words_.clear();
+  word2index_.clear();
+  words_.reserve(nwords);
+  std::string word;
+  std::vector<int32_t> synonyms;
+  for (int32_t i = 0; i < nwords && in; i++) {
+    int64_t freq;
+    int32_t zipf_rate;
+    utils::readString(in, word);
+    utils::readPod(in, freq);
+    utils::readPod(in, zipf_rate);
+    words_.push_back(word_info_t(word, freq, zipf_rate));
+    word2index_.insert(std::make_pair(word, i));
+    utils::readVector(in, synonyms);
+    words_[i].synonyms.insert(synonyms.begin(), synonyms.end());
+  }
+
+  lexems_.clear();
+  lexem2index_.clear();
+  utils::readVector(in, ngram_buckets_);
+  const int64_t nstrings = int64_t(nlexems) - int64_t(ngram_buckets_.size());
+  if (nstrings < 0) in.setstate(std::ios::failbit);
+  for (int64_t i = 0; i < nstrings && in; i++) {
+    utils::readString(in, word);
+    lexem2index_.insert(std::make_pair(word, i));
+    lexems_.push_back(word);
+  }
+  utils::readVector(in, lexem_offsets_);
+  utils::readVector(in, lexem_ids_);
+  if (lexem_offsets_.size() != int64_t(nwords) * cnt_sources + 1) {
+    in.setstate(std::ios::failbit);
+  }
+
+  int32_t nsources = 0;
+  sources_.clear();
+  utils::readPod(in, nsources);
+  for (int32_t i = 0; i < nsources && in; i++) {
+    source_stats_t src;
+    utils::readString(in, src.name);
+    utils::readPod(in, src.sum_freq_uniq);
+    utils::readPod(in, src.sum_freq_full);
+    sources_.push_back(src);
+  }
+  utils::readVector(in, lexem_freq_uniq_);
+  utils::readVector(in, lexem_freq_full_);
+  utils::readVector(in, lexem_zipf_rate_);
+  utils::readVector(in, lexem_source_);
+  if (lexem_source_.size() != nlexems) {
+    in.setstate(std::ios::failbit);
+  }
+
+  std::vector<int32_t> ns_ids;
+  std::vector<int64_t> ns_counts;
+  utils::readVector(in, ns_ids);
+  utils::readVector(in, ns_counts);
+  lexems_ns_counts_.clear();
+  for (size_t i = 0; i < ns_ids.size() && i < ns_counts.size(); i++) {
+    lexems_ns_counts_.push_back(lexem_ns_record(ns_ids[i], ns_counts[i]));
+  }
+  double t;
+  utils::readPod(in, t);
+  utils::readVector(in, pdiscard_);
+  // the discard table is cheap to redo, so a sweep over -t keeps the cache
+  if (in && t != args_.t) initTableDiscard();
 }
 
 void Dictionary::loadSynonyms(const std::string& src_name) {
@@ -93,64 +307,76 @@ bool Dictionary::isWordsCorrelated(const int32_t w_1, const int32_t w_2) const {
 }
 
 void Dictionary::shrinkContexts(const real threshold) {
+  if (contexts_ == nullptr) return;
   std::cerr << "shrinking contexts...\n";
-  int32_t cnt_removed = 0;
-  for (size_t i = 0; i < words_context.size(); ++i) {
-    auto it = std::remove_if(
-        words_context[i].begin(), words_context[i].end(),
-        [threshold](const context_info_t& a) { return a.score < threshold; });
-    cnt_removed += std::distance(it, words_context[i].end());
-    words_context[i].erase(it, words_context[i].end());
+  std::vector<int64_t> offsets(1, 0);
+  std::vector<context_info_t> contexts;
+  for (int32_t w = 0; w < nwords; ++w) {
+    for (int64_t i = context_offsets_[w]; i < context_offsets_[w + 1]; ++i) {
+      if (contexts_[i].score >= threshold) contexts.push_back(contexts_[i]);
+    }
+    offsets.push_back(contexts.size());
   }
+  const int64_t cnt_removed = context_offsets_[nwords] - int64_t(contexts.size());
+  owned_context_offsets_.swap(offsets);
+  owned_contexts_.swap(contexts);
+  context_file_.reset();
+  context_offsets_ = owned_context_offsets_.data();
+  contexts_ = owned_contexts_.data();
   std::cerr << "contexts shrinked! " << cnt_removed << std::endl;
 }
 
 bool Dictionary::isLexemInSource(const int32_t id) const {
-  for (const auto& source : dict_src_lexem_)
-    if (source.second.containsLexem(id)) return true;
-  return false;
+  return id >= 0 && id < lexem_source_.size() && lexem_source_[id] >= 0;
 }
 
 real Dictionary::getContextScore(const int32_t w_1, const int32_t w_2) const {
+  if (contexts_ == nullptr) return 0.0;
+  const context_info_t* begin = contexts_ + context_offsets_[w_1];
+  const context_info_t* end = contexts_ + context_offsets_[w_1 + 1];
   auto it = std::lower_bound(
-      words_context[w_1].begin(), words_context[w_1].end(), w_2,
+      begin, end, w_2,
       [](const context_info_t& a, const int32_t b) { return a.w_ind < b; });
-  return (it == words_context[w_1].end()) ? 0ll : (it->score);
+  return (it == end || it->w_ind != w_2) ? 0.0 : it->score;
 }
 
+// Maps a build-cooc file, which must have been built with this vocabulary.
+// The text triples of get_context_scores.pl are turned into one with
+// build-cooc instead of being parsed on every run.
 void Dictionary::loadContextCooccurences(const std::string& path) {
-  words_context.clear();
-  words_context.resize(words_.size());
-  words_context.shrink_to_fit();
-
-  std::string word_1, word_2;
-  int64_t cnt_ocur;
-  std::ifstream in(path);
-  if (!in.is_open()) {
+  auto file = std::make_shared<utils::MappedFile>();
+  cooc_header_t header;
+  if (!file->open(path)) {
     std::cerr << "contexts: bad path " << path << std::endl;
-    exit(0);
+    exit(EXIT_FAILURE);
   }
-  std::cerr << "loading contexts...\n";
-
-  while (in >> word_1 >> word_2 >> cnt_ocur) {
-    int32_t w_1 = getWordIndex(word_1);
-    int32_t w_2 = getWordIndex(word_2);
-    if (w_1 != -1 && w_2 != -1) {
-      real score = (cnt_ocur + .0) / words_[w_1].freq;
-      words_context[w_1].push_back(context_info_t(w_2, score));
-    }
+  if (!CoocCounter::isCooc(path) || file->size() < sizeof(header)) {
+    std::cerr << "contexts: " << path << " is not a build-cooc file. The "
+              << "text triples of get_context_scores.pl are no longer read: "
+              << "count the corpus with\n  fasttext build-cooc -input "
+              << "<corpus> -output <prefix> -ws <n> <dictionary args>\nand "
+              << "pass <prefix>.cooc instead" << std::endl;
+    exit(EXIT_FAILURE);
   }
-
-  for (size_t i = 0; i < words_context.size(); ++i) {
-    std::sort(words_context[i].begin(), words_context[i].end(),
-              [](const context_info_t& a, const context_info_t& b) {
-                return a.w_ind < b.w_ind;
-              });
-    words_context[i].shrink_to_fit();
+  memcpy(&header, file->data(), sizeof(header));
+  const int64_t offsets = sizeof(header);
+  int64_t entries = offsets + (int64_t(header.nwords) + 1) * sizeof(int64_t);
+  entries += Matrix::alignedPadding(entries);
+  if (header.version != CoocCounter::VERSION ||
+      file->size() != entries + header.nnz * sizeof(context_info_t)) {
+    std::cerr << "contexts: bad format " << path << std::endl;
+    exit(EXIT_FAILURE);
   }
-
-  std::cerr << "contexts loaded!\n\n";
-  in.close();
+  if (header.nwords != nwords ||
+      header.vocab_hash != TokenizedCorpus::vocabHash(*this)) {
+    std::cerr << "contexts: " << path << " was built with another vocabulary"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  context_file_ = file;
+  context_offsets_ = (const int64_t*)(file->data() + offsets);
+  contexts_ = (const context_info_t*)(file->data() + entries);
+  std::cerr << "contexts mapped: " << header.nnz << " pairs\n\n";
 }
 
 void Dictionary::shrinkLexemsDict() {
@@ -177,16 +403,35 @@ void Dictionary::shrinkLexemsDict() {
     }
   }
   lexems_.shrink_to_fit();
-  for (auto it_s = dict_src_lexem_.begin(); it_s != dict_src_lexem_.end();
-       ++it_s) {
-    auto lexems(it_s->second.lexems);
-    it_s->second.lexems.clear();
-    for (auto it_l = lexems.begin(); it_l != lexems.end(); ++it_l) {
-      if (remap[it_l->first] != -1)
-        it_s->second.lexems.insert(
-            std::make_pair(remap[it_l->first], it_l->second));
+  // the hashed n-gram rows have no strings; the used ones follow in bucket
+  // order
+  std::vector<uint32_t> buckets;
+  for (size_t k = 0; k < ngram_buckets_.size(); k++) {
+    const int32_t id = ngram_begin_ + k;
+    if (remap[id] == 1) {
+      remap[id] = last_ind++;
+      buckets.push_back(ngram_buckets_[k]);
+    } else {
+      remap[id] = -1;
     }
   }
+  ngram_buckets_.swap(buckets);
+  ngram_begin_ = lexems_.size();
+  std::vector<int64_t> freq_uniq(last_ind, 0);
+  std::vector<int64_t> freq_full(last_ind, 0);
+  std::vector<int32_t> zipf_rate(last_ind, 0);
+  std::vector<int32_t> source(last_ind, -1);
+  for (size_t i = 0; i < lexem_source_.size(); ++i) {
+    if (remap[i] == -1) continue;
+    freq_uniq[remap[i]] = lexem_freq_uniq_[i];
+    freq_full[remap[i]] = lexem_freq_full_[i];
+    zipf_rate[remap[i]] = lexem_zipf_rate_[i];
+    source[remap[i]] = lexem_source_[i];
+  }
+  lexem_freq_uniq_.swap(freq_uniq);
+  lexem_freq_full_.swap(freq_full);
+  lexem_zipf_rate_.swap(zipf_rate);
+  lexem_source_.swap(source);
 
   for (int32_t w_ind = 0; w_ind < words_.size(); ++w_ind) {
     for (auto it_s = words_[w_ind].source_lexems.begin();
@@ -211,91 +456,205 @@ void Dictionary::shrinkLexemsDict() {
   }
 
   lexem2index_.clear();
-  for (size_t i = 0; i < last_ind; ++i)
+  for (size_t i = 0; i < lexems_.size(); ++i)
     lexem2index_.insert(std::make_pair(lexems_[i], i));
 
   std::cerr << "dicts shrinked! " << nlexems << " -> " << last_ind << std::endl;
 }
 
-void Dictionary::loadSource(const std::string src_name,
-                            const std::string& src_path,
+// Moves the per-word lexem lists into one contiguous offsets + ids table
+// once they are final; training reads spans of it without copying.
+void Dictionary::freezeLexems() {
+  lexem_offsets_.assign(1, 0);
+  lexem_offsets_.reserve(int64_t(words_.size()) * cnt_sources + 1);
+  lexem_ids_.clear();
+  for (size_t w = 0; w < words_.size(); w++) {
+    std::vector<std::vector<int32_t>>& lexems = words_[w].lexems;
+    for (int32_t src = 0; src < cnt_sources; src++) {
+      if (src < lexems.size()) {
+        lexem_ids_.insert(lexem_ids_.end(), lexems[src].begin(),
+                          lexems[src].end());
+      }
+      lexem_offsets_.push_back(lexem_ids_.size());
+    }
+    std::vector<std::vector<int32_t>>().swap(lexems);
+  }
+  lexem_ids_.shrink_to_fit();
+}
+
+// Sources are independent files: each is parsed on its own thread with local
+// lexem ids, the per-word sort and filter passes run over blocks of words,
+// and the results are merged in the order of the -source names, so the
+// global lexem ids do not depend on thread timing.
+void Dictionary::loadSources() {
+  std::vector<source_build_t> sources;
+  std::vector<source_info_t> paths;
+  for (auto it = args_.dict_source_path.begin();
+       it != args_.dict_source_path.end(); it++) {
+    if (it->second.path.empty()) continue;
+    sources.push_back(source_build_t());
+    sources.back().name = it->first;
+    paths.push_back(it->second);
+  }
+  if (hashNgrams()) {
+    sources.push_back(source_build_t());
+    sources.back().name = "ngram";
+    paths.push_back(source_info_t("", ""));
+  }
+  std::cerr << "preparing " << sources.size() << " sources..." << std::endl;
+
+  utils::parallelFor(sources.size(), args_.thread, [&](int64_t i) {
+    loadSource(sources[i], paths[i].path, paths[i].lexems_info_path);
+  });
+  for (size_t i = 0; i < sources.size(); i++) {
+    std::cerr << "loaded " << sources[i].name << ' ' << sources[i].info.size()
+              << std::endl;
+  }
+
+  const size_t block = 4096;
+  std::vector<std::pair<size_t, size_t>> blocks;
+  for (size_t i = 0; i < sources.size(); i++) {
+    for (size_t b = 0; b < sources[i].word_ids.size(); b += block) {
+      blocks.push_back(std::make_pair(i, b));
+    }
+  }
+  utils::parallelFor(blocks.size(), args_.thread, [&](int64_t i) {
+    source_build_t& src = sources[blocks[i].first];
+    size_t begin = blocks[i].second;
+    size_t end = std::min(begin + block, src.word_ids.size());
+    sortSourceLexems(src, begin, end);
+    filterSourceByFreq(src, begin, end, 20);
+  });
+
+  utils::parallelFor(sources.size(), args_.thread, [&](int64_t i) {
+    source_build_t& src = sources[i];
+    src.kept.assign(src.info.size(), 0);
+    for (size_t j = 0; j < src.info.size(); j++) {
+      src.kept[j] = src.info[j].freq_full > src.thres_lw &&
+                    src.info[j].freq_full < src.thres_up;
+    }
+  });
+
+  for (size_t i = 0; i < sources.size(); i++) {
+    mergeSource(sources[i]);
+    std::cerr << "prepared " << sources[i].name << ' '
+              << std::count(sources[i].kept.begin(), sources[i].kept.end(), 1)
+              << std::endl;
+    source_build_t().word_lexems.swap(sources[i].word_lexems);
+  }
+  std::cerr << std::endl;
+}
+
+// A source without paths is the hashed char n-gram source.
+void Dictionary::loadSource(source_build_t& src, const std::string& src_path,
                             const std::string& src_lexems_info_path) {
-  std::cerr << "preparing " << src_name << "..." << std::endl;
-
-  loadSourceLexemsInfo(src_name, src_lexems_info_path);
-  loadSourceWordLexems(src_name, src_path);
-  std::cerr << "loaded " << src_name << ' ' << dict_src_lexem_[src_name].size()
-            << std::endl;
-
-  sortSourceLexems(src_name);
-  std::cerr << "sorted " << src_name << std::endl;
-
-  filterSourceByFreq(src_name, 0.99, 0.01, 20);
-  std::cerr << "filtered " << src_name << ' '
-            << dict_src_lexem_[src_name].size() << std::endl;
-
-  std::cerr << "prepared " << src_name << std::endl << std::endl;
-}
-
-void Dictionary::sortSourceLexems(const std::string& src_name) {
-  const auto& lexems_info = dict_src_lexem_[src_name].lexems;
-  for (auto& word_info : words_)
-    if (word_info.isInSource(src_name)) {
-      auto& lexems = word_info.source_lexems[src_name];
-      std::sort(lexems.begin(), lexems.end(),
-                [&lexems_info](const int32_t a, const int32_t b) {
-                  auto it_a = lexems_info.find(a);
-                  auto it_b = lexems_info.find(b);
-                  return it_a->second.freq_full > it_b->second.freq_full ||
-                         (it_a->second.freq_full == it_b->second.freq_full &&
-                          it_a->second.freq_uniq > it_b->second.freq_uniq);
-                });
+  if (src_path.empty()) {
+    loadSourceNgrams(src);
+  } else {
+    loadSourceLexemsInfo(src, src_lexems_info_path);
+    loadSourceWordLexems(src, src_path);
+  }
+  computeFreqThresholds(src, 0.99, 0.01);
+}
+
+void Dictionary::mergeSource(source_build_t& src) {
+  std::vector<int32_t> remap(src.info.size());
+  if (!src.buckets.empty()) {
+    // string-less rows, kept in one range for shrinkLexemsDict
+    ngram_begin_ = lexems_.size();
+    ngram_buckets_ = src.buckets;
+    lexems_.resize(lexems_.size() + src.buckets.size());
+    for (size_t i = 0; i < src.buckets.size(); i++) remap[i] = ngram_begin_ + i;
+  } else {
+    for (size_t i = 0; i < src.lexems.size(); i++) {
+      addLexemToIndex(src.lexems[i]);
+      remap[i] = getLexemIndex(src.lexems[i]);
     }
+  }
+
+  const int32_t source = sources_.size();
+  source_stats_t stats = {src.name, src.sum_freq_uniq, src.sum_freq_full};
+  sources_.push_back(stats);
+  lexem_freq_uniq_.resize(lexems_.size(), 0);
+  lexem_freq_full_.resize(lexems_.size(), 0);
+  lexem_zipf_rate_.resize(lexems_.size(), 0);
+  lexem_source_.resize(lexems_.size(), -1);
+  for (size_t i = 0; i < src.info.size(); i++) {
+    if (!src.kept[i]) continue;
+    lexem_freq_uniq_[remap[i]] = src.info[i].freq_uniq;
+    lexem_freq_full_[remap[i]] = src.info[i].freq_full;
+    lexem_zipf_rate_[remap[i]] = src.info[i].zipf_rate;
+    lexem_source_[remap[i]] = source;
+  }
+
+  // every word appears at most once per source, so blocks never share a word
+  const size_t block = 4096;
+  utils::parallelFor((src.word_ids.size() + block - 1) / block, args_.thread,
+                     [&](int64_t b) {
+    for (size_t k = b * block; k < src.word_ids.size() && k < (b + 1) * block;
+         k++) {
+      std::vector<int32_t>& lexems = src.word_lexems[k];
+      for (size_t j = 0; j < lexems.size(); j++) lexems[j] = remap[lexems[j]];
+      words_[src.word_ids[k]].source_lexems[src.name].swap(lexems);
+    }
+  });
+}
+
+void Dictionary::sortSourceLexems(source_build_t& src, size_t begin,
+                                  size_t end) const {
+  const std::vector<lexem_info_t>& info = src.info;
+  for (size_t k = begin; k < end; k++) {
+    auto& lexems = src.word_lexems[k];
+    std::sort(lexems.begin(), lexems.end(),
+              [&info](const int32_t a, const int32_t b) {
+                return info[a].freq_full > info[b].freq_full ||
+                       (info[a].freq_full == info[b].freq_full &&
+                        info[a].freq_uniq > info[b].freq_uniq);
+              });
+  }
 }
 
-void Dictionary::filterSourceByFreq(const std::string& src_name,
-                                    const real upper_quant,
-                                    const real lower_quant,
-                                    const int32_t threshold) {
-  auto& lexems_info = dict_src_lexem_[src_name].lexems;
-  const int32_t dict_lexems_size = lexems_info.size();
+void Dictionary::computeFreqThresholds(source_build_t& src,
+                                       const real upper_quant,
+                                       const real lower_quant) const {
+  const int32_t dict_lexems_size = src.info.size();
+  src.thres_lw = src.thres_up = 0;
+  if (dict_lexems_size == 0) return;
 
   std::vector<int64_t> freqs;
-  for (auto& lexem_info : lexems_info) {
-    freqs.push_back(lexem_info.second.freq_full);
+  for (size_t i = 0; i < src.info.size(); i++) {
+    freqs.push_back(src.info[i].freq_full);
   }
   std::sort(freqs.begin(), freqs.end());
   int32_t upper_ind = std::floor(dict_lexems_size * upper_quant);
   if (upper_ind >= dict_lexems_size) upper_ind = dict_lexems_size - 1;
   int32_t lower_ind = std::floor(dict_lexems_size * lower_quant);
   if (lower_ind >= dict_lexems_size) lower_ind = dict_lexems_size - 1;
-  int64_t thres_up = freqs[upper_ind];
-  int64_t thres_lw = freqs[lower_ind];
-
-  for (auto& word_info : words_) {
-    if (word_info.isInSource(src_name)) {
-      auto& lexems = word_info.source_lexems[src_name];
-
-      lexems.erase(std::remove_if(
-                       lexems.begin(), lexems.end(),
-                       [thres_lw, thres_up, &lexems_info](const int32_t lexem) {
-                         auto it_lexem = lexems_info.find(lexem);
-                         return it_lexem->second.freq_full <= thres_lw ||
-                                it_lexem->second.freq_full >= thres_up;
-                       }),
-                   lexems.end());
-
-      if (lexems.size() > threshold) {
-        lexems.erase(lexems.begin() + threshold, lexems.end());
-      }
-    }
-  }
+  src.thres_up = freqs[upper_ind];
+  src.thres_lw = freqs[lower_ind];
+}
 
-  for (auto it = lexems_info.begin(); it != lexems_info.end();) {
-    if (it->second.freq_full <= thres_lw || it->second.freq_full >= thres_up)
-      it = lexems_info.erase(it);
-    else
-      ++it;
+void Dictionary::filterSourceByFreq(source_build_t& src, size_t begin,
+                                    size_t end,
+                                    const int32_t threshold) const {
+  const std::vector<lexem_info_t>& info = src.info;
+  const int64_t thres_lw = src.thres_lw;
+  const int64_t thres_up = src.thres_up;
+
+  for (size_t k = begin; k < end; k++) {
+    auto& lexems = src.word_lexems[k];
+
+    lexems.erase(std::remove_if(
+                     lexems.begin(), lexems.end(),
+                     [thres_lw, thres_up, &info](const int32_t lexem) {
+                       return info[lexem].freq_full <= thres_lw ||
+                              info[lexem].freq_full >= thres_up;
+                     }),
+                 lexems.end());
+
+    if (lexems.size() > threshold) {
+      lexems.erase(lexems.begin() + threshold, lexems.end());
+    }
   }
 }
 
@@ -338,15 +697,11 @@ void Dictionary::loadWordsVocabulary(const std::string& vocab_path) {
   in.close();
 }
 
-void Dictionary::loadSourceLexemsInfo(const std::string& src_name,
+void Dictionary::loadSourceLexemsInfo(source_build_t& src,
                                       const std::string& dict_info_path) {
-  dict_src_lexem_.insert(std::make_pair(src_name, source_lexem_info_t()));
-  source_lexem_info_t& src_lexems_info = dict_src_lexem_[src_name];
-  auto& lexems_info = src_lexems_info.lexems;
-
   int64_t freq_uniq, freq_full;
-  src_lexems_info.sum_freq_uniq = 0;
-  src_lexems_info.sum_freq_full = 0;
+  src.sum_freq_uniq = 0;
+  src.sum_freq_full = 0;
 
   std::ifstream in(dict_info_path);
   if (!in.is_open()) {
@@ -360,16 +715,22 @@ void Dictionary::loadSourceLexemsInfo(const std::string& src_name,
   std::string lexem;
 
   while (in >> lexem >> freq_uniq >> freq_full) {
-    lexem += "_" + src_name;
-    addLexemToIndex(lexem);
-    int32_t h = getLexemIndex(lexem);
-    lexems_info.insert(std::make_pair(h, lexem_info_t(freq_uniq, freq_full)));
+    lexem += "_" + src.name;
+    auto it_l = src.lexem2index.find(lexem);
+    int32_t h = src.lexems.size();
+    if (it_l == src.lexem2index.end()) {
+      src.lexem2index.insert(std::make_pair(lexem, h));
+      src.lexems.push_back(lexem);
+      src.info.push_back(lexem_info_t(freq_uniq, freq_full));
+    } else {
+      h = it_l->second;
+    }
     lexems.push_back(h);
     freqs.push_back(freq_full);
     indices.push_back(indices.size());
 
-    src_lexems_info.sum_freq_uniq += freq_uniq;
-    src_lexems_info.sum_freq_full += freq_full;
+    src.sum_freq_uniq += freq_uniq;
+    src.sum_freq_full += freq_full;
   }
 
   // Zipf
@@ -379,18 +740,18 @@ void Dictionary::loadSourceLexemsInfo(const std::string& src_name,
             });
 
   for (size_t i = 0; i < lexems.size(); ++i) {
-    auto it = lexems_info.find(lexems[i]);
-    it->second.zipf_rate = i + 1;
+    src.info[lexems[i]].zipf_rate = i + 1;
   }
 
   in.close();
 }
 
-void Dictionary::loadSourceWordLexems(const std::string& src_name,
+void Dictionary::loadSourceWordLexems(source_build_t& src,
                                       const std::string& dict_word_lexem_path,
                                       int32_t threshold) {
   std::string word, lexem;
   std::vector<int32_t> lexems;
+  std::vector<bool> seen(words_.size(), false);
 
   std::ifstream in(dict_word_lexem_path);
   if (!in.is_open()) {
@@ -401,38 +762,176 @@ void Dictionary::loadSourceWordLexems(const std::string& src_name,
   while (true) {
     if (lexem == EOS) {
       int32_t i = getWordIndex(word);
-      if (i != -1) {
-        words_[i].source_lexems.insert(std::make_pair(src_name, lexems));
+      if (i != -1 && !seen[i]) {
+        seen[i] = true;
+        src.word_ids.push_back(i);
+        src.word_lexems.push_back(lexems);
       }
       if (!readWord(in, word)) break;
       lexems.clear();
     } else {
-      if (lexem != "" && lexems.size() <= threshold)
-        lexems.push_back(getLexemIndex(lexem + "_" + src_name));
+      if (lexem != "" && lexems.size() <= threshold) {
+        auto it = src.lexem2index.find(lexem + "_" + src.name);
+        if (it != src.lexem2index.end()) lexems.push_back(it->second);
+      }
     }
     readWord(in, lexem);
   }
   in.close();
 }
 
+// Only on request, with -source ngram hash.
+bool Dictionary::hashNgrams() const {
+  auto it = args_.dict_source_path.find("ngram");
+  return it != args_.dict_source_path.end() && it->second.path.empty() &&
+         args_.maxn > 0 && args_.bucket > 0;
+}
+
+// The buckets of the UTF-8 substrings of <word> from minn to maxn code
+// points, sorted and without repeats. The FNV-1a hash of hash() is extended
+// byte by byte, so no substring is ever copied.
+void Dictionary::computeNgramBuckets(const std::string& word,
+                                     std::vector<int32_t>& buckets) const {
+  const std::string w = BOW + word + EOW;
+  buckets.clear();
+  for (size_t i = 0; i < w.size(); i++) {
+    if ((w[i] & 0xC0) == 0x80) continue;
+    uint32_t h = 2166136261;
+    size_t j = i;
+    for (int32_t n = 1; j < w.size() && n <= args_.maxn; n++) {
+      do {
+        h = h ^ uint32_t(w[j]);
+        h = h * 16777619;
+        j++;
+      } while (j < w.size() && (w[j] & 0xC0) == 0x80);
+      if (n >= args_.minn) buckets.push_back(h % args_.bucket);
+    }
+  }
+  std::sort(buckets.begin(), buckets.end());
+  buckets.erase(std::unique(buckets.begin(), buckets.end()), buckets.end());
+}
+
+// Builds the n-gram source from the vocabulary alone, like get_ngrams.pl
+// does from the corpus vocabulary: freq_uniq counts the words that have a
+// bucket and freq_full sums their frequencies.
+void Dictionary::loadSourceNgrams(source_build_t& src) {
+  const int32_t n = words_.size();
+  src.word_ids.resize(n);
+  src.word_lexems.assign(n, std::vector<int32_t>());
+  const int32_t block = 4096;
+  utils::parallelFor((n + block - 1) / block, args_.thread, [&](int64_t b) {
+    for (int32_t w = b * block; w < n && w < (b + 1) * block; w++) {
+      src.word_ids[w] = w;
+      computeNgramBuckets(words_[w].word, src.word_lexems[w]);
+    }
+  });
+
+  std::vector<int32_t> local(args_.bucket, -1);
+  for (int32_t w = 0; w < n; w++) {
+    for (int32_t b : src.word_lexems[w]) local[b] = 0;
+  }
+  for (int32_t b = 0; b < args_.bucket; b++) {
+    if (local[b] < 0) continue;
+    local[b] = src.buckets.size();
+    src.buckets.push_back(b);
+  }
+  src.info.assign(src.buckets.size(), lexem_info_t());
+  src.sum_freq_uniq = src.sum_freq_full = 0;
+  for (int32_t w = 0; w < n; w++) {
+    for (int32_t& b : src.word_lexems[w]) {
+      b = local[b];
+      src.info[b].freq_uniq++;
+      src.info[b].freq_full += words_[w].freq;
+      src.sum_freq_uniq++;
+      src.sum_freq_full += words_[w].freq;
+    }
+  }
+
+  // Zipf
+  std::vector<int32_t> order(src.info.size());
+  for (size_t i = 0; i < order.size(); i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [&src](int32_t a, int32_t b) {
+    return src.info[a].freq_full > src.info[b].freq_full ||
+           src.info[a].freq_full == src.info[b].freq_full && a < b;
+  });
+  for (size_t i = 0; i < order.size(); i++) {
+    src.info[order[i]].zipf_rate = i + 1;
+  }
+}
+
+void Dictionary::getNgramLexems(const std::string& word,
+                                std::vector<int32_t>& lexems) const {
+  lexems.clear();
+  if (ngram_buckets_.empty()) return;
+  std::vector<int32_t> buckets;
+  computeNgramBuckets(word, buckets);
+  for (int32_t b : buckets) {
+    auto it = std::lower_bound(ngram_buckets_.begin(), ngram_buckets_.end(),
+                               uint32_t(b));
+    if (it != ngram_buckets_.end() && *it == uint32_t(b)) {
+      lexems.push_back(lexems_.size() + (it - ngram_buckets_.begin()));
+    }
+  }
+  // the same pick as for the vocabulary words
+  const std::vector<int64_t>& uniq = lexem_freq_uniq_;
+  const std::vector<int64_t>& full = lexem_freq_full_;
+  std::sort(lexems.begin(), lexems.end(), [&](int32_t a, int32_t b) {
+    return full[a] > full[b] || (full[a] == full[b] && uniq[a] > uniq[b]);
+  });
+  if (lexems.size() > MAX_SOURCE_LEXEMS) lexems.resize(MAX_SOURCE_LEXEMS);
+}
+
 int32_t Dictionary::getWordIndex(const std::string& word) const {
   auto it = word2index_.find(word);
   return it != word2index_.end() ? it->second : -1;
 }
 
-const std::vector<std::vector<int32_t>>& Dictionary::getWordLexems(
-    int32_t id) const {
+word_lexems_t Dictionary::getWordLexems(int32_t id) const {
   assert(id >= 0);
   assert(id < nwords);
-  return words_[id].lexems;
+  word_lexems_t lexems;
+  lexems.offsets = lexem_offsets_.data() + int64_t(id) * cnt_sources;
+  lexems.ids = lexem_ids_.data();
+  lexems.nsources = cnt_sources;
+  return lexems;
+}
+
+int64_t Dictionary::getMaxWordLexems() const {
+  int64_t result = 0;
+  for (int64_t i = 0; i < nwords; i++) {
+    const int64_t* offsets = lexem_offsets_.data() + i * cnt_sources;
+    result = std::max(result, offsets[cnt_sources] - offsets[0]);
+  }
+  return result;
 }
 
 void Dictionary::getLexemsStrings(const std::vector<int32_t>& lexems,
                                   std::vector<std::string>& strings) const {
   strings.clear();
   for (auto h : lexems) {
-    strings.push_back(lexems_[h]);
+    if (h < lexems_.size()) {
+      strings.push_back(lexems_[h]);
+    } else {
+      strings.push_back(
+          std::to_string(ngram_buckets_[h - lexems_.size()]) + "_ngram");
+    }
+  }
+}
+
+int32_t Dictionary::getRowIndex(const std::string& name) const {
+  const int32_t id = getLexemIndex(name);
+  const std::string suffix = "_ngram";
+  if (id >= 0 || ngram_buckets_.empty() || name.size() <= suffix.size() ||
+      name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+    return id;
   }
+  char* end = nullptr;
+  const uint32_t bucket = strtoul(name.c_str(), &end, 10);
+  if (end != name.c_str() + name.size() - suffix.size()) return -1;
+  auto it =
+      std::lower_bound(ngram_buckets_.begin(), ngram_buckets_.end(), bucket);
+  if (it == ngram_buckets_.end() || *it != bucket) return -1;
+  return lexems_.size() + (it - ngram_buckets_.begin());
 }
 
 std::string Dictionary::getWord(int32_t id) const {
@@ -441,6 +940,12 @@ std::string Dictionary::getWord(int32_t id) const {
   return words_[id].word;
 }
 
+int64_t Dictionary::getWordFreq(int32_t id) const {
+  assert(id >= 0);
+  assert(id < nwords);
+  return words_[id].freq;
+}
+
 bool Dictionary::tryDiscard(int32_t id, real rand) const {
   assert(id >= 0);
   assert(id < nwords);
@@ -477,11 +982,7 @@ real Dictionary::getWordWeight(const int32_t ind) const {
 real Dictionary::getLexemWeight(const int32_t ind) const {
   assert(ind >= 0);
   assert(ind < nlexems);
-  for (auto it = dict_src_lexem_.begin(); it != dict_src_lexem_.end(); it++)
-    if (it->second.containsLexem(ind)) {
-      auto it_lex = it->second.lexems.find(ind);
-      return 1.0 / it_lex->second.zipf_rate;
-    }
+  if (isLexemInSource(ind)) return 1.0 / lexem_zipf_rate_[ind];
   return 1.0 / nlexems;
 }
 
@@ -494,7 +995,7 @@ uint32_t Dictionary::hash(const std::string& str) const {
   return h;
 }
 
-bool Dictionary::readWord(std::istream& in, std::string& word) const {
+bool Dictionary::readWord(std::istream& in, std::string& word) {
   char c;
   std::streambuf& sb = *in.rdbuf();
   word.clear();
@@ -543,6 +1044,14 @@ const std::vector<lexem_ns_record>& Dictionary::getNSCounts() const {
 
 int32_t Dictionary::getLine(std::istream& in, std::vector<int32_t>& words,
                             std::minstd_rand& rng) const {
+  std::string token;
+  return getLine(in, words, token, rng);
+}
+
+// token is only a buffer; passing the same one every time keeps the reading
+// loop free of heap allocations once it has grown to the longest token.
+int32_t Dictionary::getLine(std::istream& in, std::vector<int32_t>& words,
+                            std::string& token, std::minstd_rand& rng) const {
   std::uniform_real_distribution<> uniform(0, 1);
   words.clear();
   if (in.eof()) {
@@ -550,7 +1059,6 @@ int32_t Dictionary::getLine(std::istream& in, std::vector<int32_t>& words,
     in.seekg(std::streampos(0));
   }
 
-  std::string token;
   int32_t ntokens = 0;
   while (readWord(in, token)) {
     int32_t id = getWordIndex(token);
@@ -564,4 +1072,24 @@ int32_t Dictionary::getLine(std::istream& in, std::vector<int32_t>& words,
   return ntokens;
 }
 
+// Same as above over a pre-tokenized id stream where a negative id ends a
+// line; pos wraps around to the beginning at the end of the stream.
+int32_t Dictionary::getLine(const int32_t* ids, int64_t size, int64_t& pos,
+                            std::vector<int32_t>& words,
+                            std::minstd_rand& rng) const {
+  std::uniform_real_distribution<> uniform(0, 1);
+  words.clear();
+  if (pos >= size) pos = 0;
+
+  int32_t ntokens = 0;
+  while (pos < size) {
+    int32_t id = ids[pos++];
+    if (id < 0) break;
+    ntokens++;
+    if (!tryDiscard(id, uniform(rng))) words.push_back(id);
+    if (words.size() > MAX_LINE_SIZE) break;
+  }
+  return ntokens;
+}
+
 }  // namespace fasttext
@@ -26,6 +26,7 @@
 
 #include "args.h"
 #include "real.h"
+#include "utils.h"
 
 namespace fasttext {
 
@@ -35,25 +36,37 @@ struct lexem_info_t {
   int64_t freq_uniq;
   int64_t freq_full;
   int32_t zipf_rate;
-  lexem_info_t(int64_t _freq_uniq, int64_t _freq_full) {
+  lexem_info_t(int64_t _freq_uniq = 0, int64_t _freq_full = 0) {
     freq_uniq = _freq_uniq;
     freq_full = _freq_full;
     zipf_rate = 0;
   }
 };
 
-struct source_lexem_info_t {
-  std::unordered_map<int32_t, lexem_info_t> lexems;
+struct source_stats_t {
+  std::string name;
   int64_t sum_freq_uniq;
   int64_t sum_freq_full;
+};
 
-  source_lexem_info_t() { sum_freq_uniq = sum_freq_full = 0; }
-
-  bool containsLexem(const int32_t h) const {
-    return lexems.find(h) != lexems.end();
-  }
-
-  int32_t size() const { return lexems.size(); }
+// A knowledge-base source parsed on its own, with lexem ids local to it.
+// Sources are parsed concurrently and get global ids when merged in order.
+// info and kept are indexed by the local ids. The hashed char n-gram source
+// has no lexem strings: its local ids are the used buckets in increasing
+// order, listed in buckets.
+struct source_build_t {
+  std::string name;
+  std::vector<std::string> lexems;
+  std::unordered_map<std::string, int32_t> lexem2index;
+  std::vector<uint32_t> buckets;
+  std::vector<lexem_info_t> info;
+  std::vector<char> kept;
+  int64_t sum_freq_uniq;
+  int64_t sum_freq_full;
+  std::vector<int32_t> word_ids;
+  std::vector<std::vector<int32_t>> word_lexems;
+  int64_t thres_lw;
+  int64_t thres_up;
 };
 
 struct word_info_t {
@@ -79,6 +92,38 @@ struct word_info_t {
   }
 };
 
+// Read-only view of a run of lexem ids; plain vectors convert to it, so the
+// training code takes spans of the frozen lexem table and scratch vectors
+// alike.
+struct lexem_span_t {
+  const int32_t* data;
+  size_t n;
+
+  lexem_span_t() : data(nullptr), n(0) {}
+  lexem_span_t(const int32_t* _data, size_t _n) : data(_data), n(_n) {}
+  lexem_span_t(const std::vector<int32_t>& v) : data(v.data()), n(v.size()) {}
+
+  size_t size() const { return n; }
+  const int32_t& operator[](size_t i) const { return data[i]; }
+  const int32_t* begin() const { return data; }
+  const int32_t* end() const { return data + n; }
+};
+
+// Lexems of one word, one span per source, stored back to back.
+struct word_lexems_t {
+  const int64_t* offsets;
+  const int32_t* ids;
+  size_t nsources;
+
+  size_t size() const { return nsources; }
+  lexem_span_t operator[](size_t src) const {
+    return lexem_span_t(ids + offsets[src], offsets[src + 1] - offsets[src]);
+  }
+  lexem_span_t all() const {
+    return lexem_span_t(ids + offsets[0], offsets[nsources] - offsets[0]);
+  }
+};
+
 struct context_info_t {
   int32_t w_ind;
   real score;
@@ -89,12 +134,21 @@ struct context_info_t {
 class Dictionary {
  private:
   //    static const int32_t MAX_VOCAB_SIZE = 50*1000*1000;
-  static const int32_t MAX_LINE_SIZE = 1024;
+
+  static const char CACHE_MAGIC[8];
+  static const int32_t CACHE_VERSION = 5;
+  // lexems a word takes from one source
+  static const int32_t MAX_SOURCE_LEXEMS = 10;
 
   void initTableDiscard();
   void initLexems();
   void initNSCounts();
 
+  void build();
+  std::string cacheKey() const;
+  bool loadCache(const std::string&);
+  void saveCache(const std::string&) const;
+
   Args args_;
   std::vector<word_info_t> words_;
   std::unordered_map<std::string, int32_t> word2index_;
@@ -102,9 +156,35 @@ class Dictionary {
   std::vector<std::string> lexems_;
   std::unordered_map<std::string, int32_t> lexem2index_;
 
-  std::unordered_map<std::string, source_lexem_info_t> dict_src_lexem_;
-
-  std::vector<std::vector<context_info_t>> words_context;
+  // rows of the hashed char n-grams follow the string lexems: row
+  // lexems_.size() + k is bucket ngram_buckets_[k], in increasing order.
+  // While building, the rows start at ngram_begin_ instead.
+  std::vector<uint32_t> ngram_buckets_;
+  int32_t ngram_begin_;
+
+  // per-word lexem lists in CSR form: the lexems of word w from source s
+  // are lexem_ids_[lexem_offsets_[w * cnt_sources + s] ...
+  // lexem_offsets_[w * cnt_sources + s + 1])
+  std::vector<int64_t> lexem_offsets_;
+  std::vector<int32_t> lexem_ids_;
+
+  // knowledge-base sources in merge order, and the metadata of every lexem
+  // in arrays indexed by lexem id; lexem_source_ is -1 for the lexems no
+  // source describes, such as the words' own "_base" rows
+  std::vector<source_stats_t> sources_;
+  std::vector<int64_t> lexem_freq_uniq_;
+  std::vector<int64_t> lexem_freq_full_;
+  std::vector<int32_t> lexem_zipf_rate_;
+  std::vector<int32_t> lexem_source_;
+
+  // context scores in CSR form: the contexts of word w, sorted by word id,
+  // are contexts_[context_offsets_[w] ... context_offsets_[w + 1]), owned or
+  // mapped from a build-cooc file; null when none are loaded
+  std::shared_ptr<utils::MappedFile> context_file_;
+  std::vector<int64_t> owned_context_offsets_;
+  std::vector<context_info_t> owned_contexts_;
+  const int64_t* context_offsets_;
+  const context_info_t* contexts_;
 
   std::vector<lexem_ns_record> lexems_ns_counts_;
 
@@ -113,15 +193,21 @@ class Dictionary {
   std::string main_lexems_src_name;
 
   void loadSynonyms(const std::string&);
-  void loadSource(const std::string, const std::string&, const std::string&);
+  void loadSources();
+  void loadSource(source_build_t&, const std::string&, const std::string&);
   void loadWordsVocabulary(const std::string&);
-  void loadSourceWordLexems(const std::string&, const std::string&,
-                            int32_t = 20);
-  void loadSourceLexemsInfo(const std::string&, const std::string&);
-  void sortSourceLexems(const std::string&);
-  void filterSourceByFreq(const std::string&, const real, const real,
-                          const int32_t);
+  void loadSourceWordLexems(source_build_t&, const std::string&, int32_t = 20);
+  void loadSourceLexemsInfo(source_build_t&, const std::string&);
+  void loadSourceNgrams(source_build_t&);
+  bool hashNgrams() const;
+  void computeNgramBuckets(const std::string&, std::vector<int32_t>&) const;
+  void sortSourceLexems(source_build_t&, size_t, size_t) const;
+  void computeFreqThresholds(source_build_t&, const real, const real) const;
+  void filterSourceByFreq(source_build_t&, size_t, size_t,
+                          const int32_t) const;
+  void mergeSource(source_build_t&);
   void shrinkLexemsDict();
+  void freezeLexems();
   void shrinkContexts(const real = 0.1);
 
   real getContextScore(const int32_t, const int32_t) const;
@@ -131,6 +217,8 @@ class Dictionary {
   int32_t getLexemIndex(const std::string&) const;
 
  public:
+  static const int32_t MAX_LINE_SIZE = 1024;
+
   void addLexemToIndex(const std::string&);
   static const std::string EOS;
   static const std::string BOW;
@@ -147,30 +235,40 @@ class Dictionary {
 
   int32_t getWordIndex(const std::string&) const;
   std::string getWord(int32_t) const;
+  int64_t getWordFreq(int32_t) const;
   bool isWordInVocab(const std::string&) const;
   bool isWordInVocab(const int32_t) const;
   bool isLexemInSource(const int32_t id) const;
 
   bool isWordsCorrelated(const int32_t, const int32_t) const;
   bool isSynonyms(const int32_t, const int32_t) const;
-  const std::vector<std::vector<int32_t>>& getWordLexems(int32_t) const;
+  word_lexems_t getWordLexems(int32_t) const;
+  // lexems of an out-of-vocabulary word: its hashed char n-gram rows
+  void getNgramLexems(const std::string&, std::vector<int32_t>&) const;
+  int64_t getMaxWordLexems() const;
 
   void getLexemsStrings(const std::vector<int32_t>&,
                         std::vector<std::string>&) const;
+  // row of a lexem as getLexemsStrings names it, or -1
+  int32_t getRowIndex(const std::string&) const;
   real getWordWeight(const int32_t) const;
   real getLexemWeight(const int32_t) const;
 
   uint32_t hash(const std::string&) const;
 
-  bool readWord(std::istream&, std::string&) const;
+  static bool readWord(std::istream&, std::string&);
   void readFromFile(std::istream&);
   int32_t getLine(std::istream&, std::vector<int32_t>&,
                   std::minstd_rand&) const;
+  int32_t getLine(std::istream&, std::vector<int32_t>&, std::string&,
+                  std::minstd_rand&) const;
+  int32_t getLine(const int32_t*, int64_t, int64_t&, std::vector<int32_t>&,
+                  std::minstd_rand&) const;
 
   const std::vector<lexem_ns_record>& getNSCounts() const;
   bool tryDiscard(int32_t, real) const;
-  //    void save(std::ostream&) const; //?
-  //    void load(std::istream&); //?
+  void save(std::ostream&) const;
+  void load(std::istream&);
 };
 
 }  // namespace fasttext
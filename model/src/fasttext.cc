@@ -13,68 +13,179 @@
 
 #include <assert.h>
 #include <math.h>
+#include <stdio.h>
+#include <string.h>
 
 #include <algorithm>
+#include <chrono>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <thread>
+#include <unordered_set>
 #include <vector>
 
+#include "kernels.h"
+
 namespace fasttext {
 
+const char FastText::MODEL_MAGIC[8] = {'F', 'T', 'M', 'O', 'D', 'E', 'L', '2'};
+const int32_t FastText::MODEL_VERSION;
+const char FastText::QUANT_MAGIC[8] = {'F', 'T', 'Q', 'U', 'A', 'N', 'T', '1'};
+const int32_t FastText::QUANT_VERSION;
+const char FastText::WORDS_MAGIC[8] = {'F', 'T', 'W', 'O', 'R', 'D', 'S', '1'};
+const int32_t FastText::WORDS_VERSION;
+const int32_t FastText::STREAM_BATCHES_PER_THREAD;
+
+// Out-of-vocabulary words are composed from their hashed char n-grams when
+// the dictionary has them.
 void FastText::getVector(Vector& vec, const std::string& word) {
   int32_t id = dict_->getWordIndex(word);
   vec.zero();
-  if (id > 0) {
-    const auto& lexems = dict_->getWordLexems(id);
-    int32_t cnt_lexems = 0;
-    for (size_t i = 0; i < lexems.size(); ++i) {
-      for (size_t j = 0; j < lexems[i].size(); ++j) {
-        vec.addRow(*input_, lexems[i][j]);
-        cnt_lexems++;
-      }
-    }
-
-    if (cnt_lexems > 0) vec.mul(1.0 / cnt_lexems);
+  if (id >= 0) {
+    composeVector(vec, dict_->getWordLexems(id).all(), qinput_ != nullptr);
+    return;
+  }
+  std::vector<int32_t> lexems;
+  dict_->getNgramLexems(word, lexems);
+  if (!lexems.empty()) {
+    composeVector(vec, lexems, qinput_ != nullptr);
   } else {
     std::cerr << "word '" << word << "' not found" << std::endl;
   }
 }
 
-void FastText::saveVectors() {
-  std::ofstream ofs(args_->output + ".vec");
+// The mean of the lexem rows, from the quantized codes or from the full
+// matrix.
+void FastText::composeVector(Vector& vec, lexem_span_t lexems,
+                             bool quantized) {
+  vec.zero();
+  for (size_t i = 0; i < lexems.size(); ++i) {
+    if (quantized) {
+      vec.addRow(*qinput_, lexems[i]);
+    } else {
+      vec.addRow(*input_, lexems[i]);
+    }
+  }
+  if (lexems.size() > 0) vec.mul(1.0 / lexems.size());
+}
+
+// Exact unit length: l2_normalize's epsilon would swamp small norms. Zero
+// vectors stay zero.
+static void unitNormalize(Vector& v) {
+  real norm = sqrt(kernels::dot(v.data_, v.data_, v.size()));
+  if (norm > 0) v.mul(1.0 / norm);
+}
+
+// Composes every word's vector into one nwords x dim matrix, in parallel
+// blocks of rows. Exports, evaluations and index builds then read rows from
+// it instead of looking words up and composing them again.
+void FastText::precomputeWordVectors(bool normalize) {
+  const int64_t n = dict_->nwords;
+  const int64_t dim = args_->dim;
+  const int64_t block = 256;
+  const bool quantized = qinput_ != nullptr;
+  word_vectors_ = std::make_shared<Matrix>(n, dim);
+  utils::parallelFor((n + block - 1) / block, args_->thread, [&](int64_t b) {
+    Vector vec(dim);
+    for (int64_t i = b * block; i < std::min(n, (b + 1) * block); i++) {
+      composeVector(vec, dict_->getWordLexems(i).all(), quantized);
+      if (normalize) unitNormalize(vec);
+      word_vectors_->setRow(i, vec.data_);
+    }
+  });
+  word_vectors_normalized_ = normalize;
+}
+
+// Writes the first nwords rows of a matrix as "nwords dim" and then one
+// "word v1 v2 ... " line per word, or with -binaryVectors as word2vec's
+// binary format: the word, a space, dim raw floats and a newline. Blocks of
+// rows are formatted in parallel, nthreads at a time, and written in order.
+void FastText::writeVectors(const std::string& path, const Matrix& matrix) {
+  std::ofstream ofs(path, std::ofstream::binary);
   if (!ofs.is_open()) {
     std::cerr << "Error opening file for saving vectors." << std::endl;
     exit(EXIT_FAILURE);
   }
-  ofs << dict_->nwords << " " << args_->dim << std::endl;
-  Vector vec(args_->dim);
-  for (int32_t i = 0; i < dict_->nwords; i++) {
-    std::string word = dict_->getWord(i);
-    getVector(vec, word);
-    ofs << word << " " << vec << std::endl;
+  const int64_t n = dict_->nwords;
+  const int64_t dim = args_->dim;
+  const int64_t block = 1024;
+  const int64_t nblocks = (n + block - 1) / block;
+  const int32_t nthreads = std::max(args_->thread, 1);
+  const bool binary = args_->binaryVectors > 0;
+  ofs << n << " " << dim << "\n";
+  std::vector<std::string> chunks(nthreads);
+  for (int64_t first = 0; first < nblocks; first += nthreads) {
+    const int64_t count = std::min(int64_t(nthreads), nblocks - first);
+    utils::parallelFor(count, nthreads, [&](int64_t c) {
+      std::string& chunk = chunks[c];
+      chunk.clear();
+      std::vector<real> row(dim);
+      char buf[utils::FLOAT_CHARS];
+      const int64_t begin = (first + c) * block;
+      for (int64_t i = begin; i < std::min(n, begin + block); i++) {
+        matrix.getRow(i, row.data());
+        chunk += dict_->getWord(i);
+        chunk += ' ';
+        if (binary) {
+          chunk.append((const char*)row.data(), dim * sizeof(real));
+        } else {
+          for (int64_t j = 0; j < dim; j++) {
+            chunk.append(buf, utils::formatFloat(row[j], buf));
+            chunk += ' ';
+          }
+        }
+        chunk += '\n';
+      }
+    });
+    for (int64_t c = 0; c < count; c++) {
+      ofs.write(chunks[c].data(), chunks[c].size());
+    }
   }
   ofs.close();
+  if (!ofs) {
+    std::cerr << "Error writing vectors " << path << std::endl;
+    exit(EXIT_FAILURE);
+  }
 }
 
-void FastText::saveOutput() {
-  std::ofstream ofs(args_->output + ".vectors");
+void FastText::saveVectors() {
+  if (word_vectors_ == nullptr) {
+    precomputeWordVectors(args_->normalize > 0);
+  }
+  writeVectors(args_->output + ".vec", *word_vectors_);
+}
+
+void FastText::saveWordMatrix() {
+  if (word_vectors_ == nullptr) {
+    precomputeWordVectors(args_->normalize > 0);
+  }
+  std::string path = args_->output + ".wvec";
+  std::ofstream ofs(path, std::ofstream::binary);
   if (!ofs.is_open()) {
-    std::cerr << "Error opening file for saving vectors." << std::endl;
+    std::cerr << "Word matrix file " << path << " cannot be opened!"
+              << std::endl;
     exit(EXIT_FAILURE);
   }
-  ofs << dict_->nwords << " " << args_->dim << std::endl;
-  Vector vec(args_->dim);
+  model_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, WORDS_MAGIC, sizeof(WORDS_MAGIC));
+  header.version = WORDS_VERSION;
+  header.nmatrices = 1;
+  ofs.write((char*)&header, sizeof(header));
+  word_vectors_->saveAligned(ofs);
+  utils::writePod(ofs, int32_t(word_vectors_normalized_));
   for (int32_t i = 0; i < dict_->nwords; i++) {
-    std::string word = dict_->getWord(i);
-    vec.zero();
-    vec.addRow(*output_, i);
-    ofs << word << " " << vec << std::endl;
+    utils::writeString(ofs, dict_->getWord(i));
   }
   ofs.close();
 }
 
+void FastText::saveOutput() {
+  writeVectors(args_->output + ".vectors", *output_);
+}
+
 void FastText::saveModel() {
   std::cerr << "\nsaving model...\n";
   std::ofstream ofs(args_->output + ".bin", std::ofstream::binary);
@@ -82,10 +193,31 @@ void FastText::saveModel() {
     std::cerr << "Model file cannot be opened for saving!" << std::endl;
     exit(EXIT_FAILURE);
   }
+  model_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MODEL_MAGIC, sizeof(MODEL_MAGIC));
+  header.version = MODEL_VERSION;
+  header.nmatrices = 2;
+  ofs.write((char*)&header, sizeof(header));
   //  args_->save(ofs);
   //  dict_->save(ofs);
-  input_->save(ofs);
-  output_->save(ofs);
+  input_->saveAligned(ofs);
+  output_->saveAligned(ofs);
+  utils::writePod(ofs, int32_t(args_->minn));
+  utils::writePod(ofs, int32_t(args_->maxn));
+  utils::writePod(ofs, int32_t(args_->bucket));
+  utils::writePod(ofs, int32_t(dict_->nwords));
+  for (int32_t i = 0; i < dict_->nwords; i++) {
+    utils::writeString(ofs, dict_->getWord(i));
+  }
+  std::vector<int32_t> rows(input_->m_);
+  for (int32_t i = 0; i < rows.size(); i++) rows[i] = i;
+  std::vector<std::string> names;
+  dict_->getLexemsStrings(rows, names);
+  utils::writePod(ofs, int32_t(names.size()));
+  for (size_t i = 0; i < names.size(); i++) {
+    utils::writeString(ofs, names[i]);
+  }
   ofs.close();
   std::cerr << "model saved!\n\n";
 }
@@ -110,30 +242,144 @@ void FastText::loadModel(std::istream& in, std::shared_ptr<Args> args) {
   output_ = std::make_shared<Matrix>();
   //  args_->load(in);
   //  dict_->load(in);
-  input_->load(in);
-  output_->load(in);
+  model_header_t header;
+  in.read((char*)&header, sizeof(header));
+  if (in && memcmp(header.magic, QUANT_MAGIC, sizeof(QUANT_MAGIC)) == 0) {
+    std::cerr << "Quantized models only serve vectors, use print-vectors!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  bool tables = false;
+  if (in && memcmp(header.magic, MODEL_MAGIC, sizeof(MODEL_MAGIC)) == 0) {
+    input_->loadAligned(in);
+    output_->loadAligned(in);
+    tables = header.version >= 4;
+    if (!in) {
+      std::cerr << "Model file is truncated or corrupted!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  } else {
+    // headerless model written before the aligned format
+    in.clear();
+    in.seekg(0);
+    input_->load(in);
+    output_->load(in);
+  }
+  if (dict_ == nullptr) {
+    dict_ = std::make_shared<Dictionary>(args_);
+  }
+  checkModelRows(tables ? &in : nullptr, input_->m_);
   main_model_ = std::make_shared<Model>(input_, output_, args_, dict_, 0);
-  //  if (args_->model == model_name::sup) {
-  //  main_model_->setTargetCounts(dict_->getCounts());
-  //  } else {
-  main_model_->setTargetCounts(dict_->getNSCounts());
-  //  }
   std::cerr << "model loaded!\n\n";
 }
 
-void FastText::printInfo(real progress, long_real loss, real lr) {
-  real t = real(clock() - start) / CLOCKS_PER_SEC;
-  real wst = real(tokenCount) / t;
-  int eta = int(t / progress * (1 - progress) / args_->thread);
-  int etah = eta / 3600;
-  int etam = (eta - etah * 3600) / 60;
-  std::cerr << std::fixed;
-  std::cerr << "\rProgress: " << std::setprecision(1) << 100 * progress << "%";
-  std::cerr << "  words/sec/thread: " << std::setprecision(0) << wst;
-  std::cerr << "  lr: " << std::setprecision(6) << lr;
-  std::cerr << "  loss: " << std::setprecision(6) << loss;
-  std::cerr << "  eta: " << etah << "h" << etam << "m ";
-  std::cerr << std::flush;
+// Maps the matrices of an aligned model file instead of reading them: only
+// the rows actually used are paged in, and processes that map the same file
+// share one page-cache copy. The matrices are read-only, so this is meant for
+// inference commands. Quantized models are always mapped. Returns false for
+// headerless models.
+bool FastText::mapModel(const std::string& filename,
+                        std::shared_ptr<Args> args) {
+  auto file = std::make_shared<utils::MappedFile>();
+  if (!file->open(filename)) {
+    std::cerr << "Model file cannot be opened for loading!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  model_header_t header;
+  if (file->size() < sizeof(header)) return false;
+  memcpy(&header, file->data(), sizeof(header));
+  bool quantized = memcmp(header.magic, QUANT_MAGIC, sizeof(QUANT_MAGIC)) == 0;
+  if (!quantized && memcmp(header.magic, MODEL_MAGIC, sizeof(MODEL_MAGIC))) {
+    return false;
+  }
+  args_ = std::make_shared<Args>();
+  if (args != nullptr) args_ = args;
+  int64_t offset;
+  if (quantized) {
+    input_ = nullptr;
+    output_ = nullptr;
+    qinput_ = std::make_shared<QMatrix>();
+    offset = qinput_->map(file, sizeof(header));
+  } else {
+    input_ = std::make_shared<Matrix>();
+    output_ = std::make_shared<Matrix>();
+    offset = input_->map(file, sizeof(header));
+    if (offset >= 0) offset = output_->map(file, offset);
+  }
+  if (offset < 0) {
+    std::cerr << "Model file " << filename << " is truncated!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  args_->dim = quantized ? qinput_->n_ : input_->n_;
+  if (dict_ == nullptr) {
+    dict_ = std::make_shared<Dictionary>(args_);
+  }
+  if (quantized || header.version < 4) {
+    checkModelRows(nullptr, quantized ? qinput_->m_ : input_->m_);
+  } else {
+    std::ifstream in(filename, std::ifstream::binary);
+    in.seekg(offset);
+    checkModelRows(&in, input_->m_);
+  }
+  return true;
+}
+
+// Inference rebuilds the dictionary from the command line, so it has to
+// give the rows of the model: as many of them and, where the file has the
+// string tables, the same char n-gram hashing and the same lexem on every
+// row. Otherwise row ids could run past the matrix or silently land on the
+// rows of other lexems.
+void FastText::checkModelRows(std::istream* tables, int64_t nrows) {
+  if (dict_->nlexems != nrows) {
+    std::cerr << "Model has " << nrows << " rows but the dictionary has "
+              << dict_->nlexems << " lexems: pass the -source options the "
+              << "model was trained with!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (tables == nullptr) return;
+  std::istream& in = *tables;
+  int32_t minn = 0, maxn = 0, bucket = 0, nwords = 0, n = 0;
+  std::string name;
+  utils::readPod(in, minn);
+  utils::readPod(in, maxn);
+  utils::readPod(in, bucket);
+  utils::readPod(in, nwords);
+  for (int32_t i = 0; i < nwords && in; i++) utils::readString(in, name);
+  utils::readPod(in, n);
+  if (!in || n != nrows) {
+    std::cerr << "Model file is truncated or corrupted!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::vector<int32_t> rows(nrows);
+  for (int32_t i = 0; i < nrows; i++) rows[i] = i;
+  std::vector<std::string> names;
+  dict_->getLexemsStrings(rows, names);
+  const std::string suffix = "_ngram";
+  bool hashed = false;
+  for (int32_t i = 0; i < nrows && in; i++) {
+    utils::readString(in, name);
+    if (in && name != names[i]) {
+      std::cerr << "Row " << i << " of the model is '" << name
+                << "' but '" << names[i] << "' in the dictionary: pass the "
+                << "-source options the model was trained with!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    hashed = hashed || (name.size() > suffix.size() &&
+                        name.compare(name.size() - suffix.size(),
+                                     suffix.size(), suffix) == 0);
+  }
+  if (!in) {
+    std::cerr << "Model file is truncated or corrupted!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (hashed && (minn != args_->minn || maxn != args_->maxn ||
+                 bucket != args_->bucket)) {
+    std::cerr << "Model hashes char ngrams with -minn " << minn << " -maxn "
+              << maxn << " -bucket " << bucket << ", not with -minn "
+              << args_->minn << " -maxn " << args_->maxn << " -bucket "
+              << args_->bucket << "!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
 }
 
 void FastText::supervised(Model& model, real lr,
@@ -165,22 +411,42 @@ void FastText::cbow(Model& model, real lr, const std::vector<int32_t>& line) {
    */
 }
 
-void FastText::skipgram(Model& model, real lr,
+train_scratch_t::train_scratch_t(const Args& args, const Dictionary& dict)
+    : uniform(1, args.ws),
+      exp_random(0, 3),
+      one_out_rand(0, dict.cnt_sources - 1),
+      dropout_rand(0, 1) {
+  line.reserve(Dictionary::MAX_LINE_SIZE + 1);
+  token.reserve(1024);
+  // the largest strategies copy about all of a word's lexems once per source
+  lexems.reserve(dict.cnt_sources *
+                 (dict.getMaxWordLexems() + dict.cnt_sources));
+  ends.reserve(dict.cnt_sources);
+  inputs.reserve(dict.cnt_sources);
+  ind.reserve(dict.cnt_sources);
+  targets.reserve(2 * args.ws);
+}
+
+void FastText::skipgram(Model& model, train_scratch_t& scratch, real lr,
                         const std::vector<int32_t>& line) {
-  std::uniform_int_distribution<> uniform(1, args_->ws);
-  std::uniform_int_distribution<> uniform_lexems(0, 3);
-  std::uniform_int_distribution<> one_out_rand(0, dict_->cnt_sources - 1);
-  std::uniform_int_distribution<> dropout_rand(0, 1);
+  std::uniform_int_distribution<>& uniform = scratch.uniform;
+  std::uniform_int_distribution<>& exp_random = scratch.exp_random;
+  std::uniform_int_distribution<>& one_out_rand = scratch.one_out_rand;
+  std::uniform_int_distribution<>& dropout_rand = scratch.dropout_rand;
+
+  std::vector<int32_t>& lexems = scratch.lexems;
+  std::vector<size_t>& ends = scratch.ends;
+  std::vector<lexem_span_t>& inputs = scratch.inputs;
+  std::vector<size_t>& ind = scratch.ind;
 
   for (int32_t w = 0; w < line.size(); w++) {
-    const std::vector<std::vector<int32_t>>& all_lexems =
-        dict_->getWordLexems(line[w]);
-    std::vector<int32_t> lexems;
-    std::vector<int32_t> lexems_2;
-    std::vector<size_t> ind(all_lexems.size());
+    const word_lexems_t all_lexems = dict_->getWordLexems(line[w]);
+    lexems.clear();
+    ends.clear();
+    inputs.clear();
+    ind.resize(all_lexems.size());
     for (size_t i = 0; i < all_lexems.size(); ++i) ind[i] = i;
 
-    std::uniform_int_distribution<> exp_random(0, 3);
     int EXP_N = -1;  /// exp_random(model.rng);
     // 0 - full
     // 2 - dropout
@@ -196,117 +462,110 @@ void FastText::skipgram(Model& model, real lr,
       shuffle(ind.begin(), ind.end(), model.rng);
     }
 
+    // The input lexem sets of the strategy, built once per word: lexems
+    // holds the copied ones back to back, up to ends, and every set is
+    // trained against each context target or against the whole window.
+    auto append = [&](size_t src_i) {
+      const lexem_span_t src = all_lexems[ind[src_i]];
+      lexems.insert(lexems.end(), src.begin(), src.end());
+    };
+
     // 1 - out
     if (EXP_N == 5) {
       int32_t dropped = one_out_rand(model.rng);
       for (size_t src_i = 0; src_i < dict_->cnt_sources; ++src_i) {
-        if (src_i == dropped) continue;
-        for (size_t k = 0; k < all_lexems[ind[src_i]].size(); ++k)
-          lexems.push_back(all_lexems[ind[src_i]][k]);
+        if (src_i != dropped) append(src_i);
       }
+      ends.push_back(lexems.size());
     }
 
-    // full
-    if (EXP_N == 0) {
+    // dropout
+    if (EXP_N == 2) {
       for (size_t src_i = 0; src_i < dict_->cnt_sources; ++src_i) {
-        for (size_t k = 0; k < all_lexems[ind[src_i]].size(); ++k)
-          lexems.push_back(all_lexems[ind[src_i]][k]);
+        if (dropout_rand(model.rng) == 1) append(src_i);
       }
+      ends.push_back(lexems.size());
     }
 
-    // exclusion
-    if (EXP_N == 1) {
-      for (size_t src_i = 0; src_i < dict_->cnt_sources; ++src_i) {
-        for (size_t k = 0; k < all_lexems[ind[src_i]].size(); ++k)
-          lexems.push_back(all_lexems[ind[src_i]][k]);
+    for (size_t src_i = 0; src_i < dict_->cnt_sources; ++src_i) {
+      // semi-RNN
+      if (EXP_N == 6) {
+        append(src_i);
+        for (size_t src_j = 1; src_j < dict_->cnt_sources; ++src_j) {
+          if (src_j == src_i || all_lexems[ind[src_j]].size() == 0) continue;
+          lexems.push_back(all_lexems[ind[src_j]][0]);
+        }
+        ends.push_back(lexems.size());
+      }
+
+      // gradboost: the sources up to src_i
+      if (EXP_N == 3) {
+        append(src_i);
+        ends.push_back(lexems.size());
+      }
+
+      // exclusion: all sources but src_i
+      if (EXP_N == 1) {
+        for (size_t src_j = 0; src_j < dict_->cnt_sources; ++src_j) {
+          if (src_j != src_i) append(src_j);
+        }
+        ends.push_back(lexems.size());
       }
     }
 
-    // dropout
-    if (EXP_N == 2) {
+    if (EXP_N == 0) {
+      // full: the word's lexems are contiguous in the dictionary, no copy
+      inputs.push_back(all_lexems.all());
+    } else if (EXP_N == 4 || EXP_N == 7) {
+      // exclusion-boost and its synchronous variant: one source at a time
       for (size_t src_i = 0; src_i < dict_->cnt_sources; ++src_i) {
-        if (dropout_rand(model.rng) == 1) {
-          for (size_t k = 0; k < all_lexems[ind[src_i]].size(); ++k) {
-            lexems.push_back(all_lexems[ind[src_i]][k]);
-          }
-        } else {
-          continue;
-          for (size_t k = 0; k < all_lexems[ind[src_i]].size(); ++k) {
-            lexems_2.push_back(all_lexems[ind[src_i]][k]);
-          }
-        }
+        inputs.push_back(all_lexems[ind[src_i]]);
+      }
+    } else if (EXP_N == 3) {
+      // the gradboost sets are growing prefixes of one another
+      for (size_t i = 0; i < ends.size(); ++i) {
+        inputs.push_back(lexem_span_t(lexems.data(), ends[i]));
+      }
+    } else {
+      for (size_t i = 0; i < ends.size(); ++i) {
+        const size_t begin = i > 0 ? ends[i - 1] : 0;
+        inputs.push_back(lexem_span_t(lexems.data() + begin, ends[i] - begin));
       }
     }
-    //
+    const real input_lr = EXP_N == 2 ? lr * 0.5 : lr;
+    const bool sync = EXP_N == 7;
 
     //  int32_t boundary = args_->ws;
     int32_t boundary = uniform(model.rng);
+
+    // shared negatives: the whole window is scored in one pass per input
+    // set, the synchronous strategy keeps the classic per-target path
+    if (args_->sharedNeg > 0 && !sync) {
+      std::vector<int32_t>& targets = scratch.targets;
+      targets.clear();
+      for (int32_t c = -boundary; c <= boundary; c++) {
+        if (c != 0 && w + c >= 0 && w + c < line.size()) {
+          targets.push_back(line[w + c]);
+        }
+      }
+      if (targets.empty()) continue;
+      model.drawSharedNegatives(targets);
+      for (size_t i = 0; i < inputs.size(); ++i) {
+        model.updateWindow(inputs[i], targets, input_lr);
+      }
+      continue;
+    }
+
     for (int32_t c = -boundary; c <= boundary; c++) {
       if (c != 0 && w + c >= 0 && w + c < line.size()
           //		&& dict_->isWordsCorrelated(line[w], line[w+c])
       ) {
-        if (EXP_N == 0 || EXP_N == 5) {
-          model.update(lexems, line[w + c], lr);
-        }
-        if (EXP_N == 2) {
-          model.update(lexems, line[w + c], lr * 0.5);
+        for (size_t i = 0; i < inputs.size(); ++i) {
+          model.update(inputs[i], line[w + c], input_lr, sync);
         }
-
-        if (EXP_N == 3 || EXP_N == 1 || EXP_N == 4 || EXP_N == 6 ||
-            EXP_N == 7) {
-          for (size_t src_i = 0; src_i < dict_->cnt_sources; ++src_i) {
-            // semi-RNN
-            if (EXP_N == 6) {
-              for (size_t k = 0; k < all_lexems[ind[src_i]].size(); ++k)
-                lexems.push_back(all_lexems[ind[src_i]][k]);
-              for (size_t src_j = 1; src_j < dict_->cnt_sources; ++src_j) {
-                if (src_j == src_i || all_lexems[ind[src_j]].size() == 0)
-                  continue;
-                lexems.push_back(all_lexems[ind[src_j]][0]);
-              }
-              model.update(lexems, line[w + c], lr);
-              lexems.clear();
-            }
-
-            // gradboost
-            if (EXP_N == 3) {
-              for (size_t k = 0; k < all_lexems[ind[src_i]].size(); ++k)
-                lexems.push_back(all_lexems[ind[src_i]][k]);
-              model.update(lexems, line[w + c], lr);
-            }
-
-            // exclusion
-            if (EXP_N == 1) {
-              if (all_lexems[ind[src_i]].size() > 0) {
-                auto it = std::find(lexems.begin(), lexems.end(),
-                                    all_lexems[ind[src_i]][0]);
-                lexems.erase(it, it + all_lexems[ind[src_i]].size());
-              }
-              model.update(lexems, line[w + c], lr);
-              for (size_t k = 0; k < all_lexems[ind[src_i]].size(); ++k)
-                lexems.push_back(all_lexems[ind[src_i]][k]);
-            }
-
-            // exclusion-boost
-            if (EXP_N == 4) {
-              //		   for (size_t k = 0; k <
-              // all_lexems[src_i].size(); ++k)
-              //		     lexems.push_back(all_lexems[src_i][k] +
-              // shift[src_i]);
-
-              model.update(all_lexems[ind[src_i]], line[w + c], lr);
-              lexems.clear();
-            }
-
-            // sync exclusion-boost
-            if (EXP_N == 7) {
-              model.update(all_lexems[ind[src_i]], line[w + c], lr, true);
-            }
-          }
-          if (EXP_N == 7) {
-            // model.doGradientStep();
-            model.doGradientStepMean();
-          }
+        if (sync) {
+          // model.doGradientStep();
+          model.doGradientStepMean();
         }
         //	    continue;
         /*
@@ -457,67 +716,152 @@ void FastText::printVectors() {
 
 void FastText::trainThread(int32_t threadId) {
   cnt_active_threads++;
-  std::ifstream ifs(args_->input);
-  std::ofstream log_stream_lr;
-  std::ofstream log_stream_ls;
-  if (args_->log_path != "") {
-    log_stream_lr.open(args_->log_path + "_lr_" + std::to_string(threadId));
-    log_stream_ls.open(args_->log_path + "_ls_" + std::to_string(threadId));
-  }
-
-  utils::seek(ifs, threadId * utils::size(ifs) / args_->thread);
+  thread_counters_t& counters = telemetry_->counters(threadId);
 
   Model model(input_, output_, args_, dict_, threadId);
-  model.setTargetCounts(dict_->getNSCounts());
+  model.setNegatives(negatives_);
 
-  const int64_t ntokens = dict_->ntokens;
-  const int64_t local_ntokens = ntokens / args_->thread + 1;
+  ChunkReader reader(*chunks_);
+  std::istream text(&reader);
   int64_t localTokenCount = 0;
   int64_t localTokenBuffer = 0;
+  // a resumed worker first finishes the item it was in
+  worker_state_t state;
+  if (!resume_.empty()) {
+    state = resume_[threadId];
+    std::istringstream model_state(state.model);
+    model.loadState(model_state);
+    localTokenCount = state.tokens;
+    counters.publish(localTokenCount, model.getUpdates(), model.getLossSum(),
+                     model.getLossSamples());
+  }
+  auto record = [&](int64_t at, int64_t offset) {
+    state.item = at;
+    state.offset = offset;
+    state.tokens = localTokenCount + localTokenBuffer;
+    std::ostringstream model_state;
+    model.saveState(model_state);
+    state.model = model_state.str();
+  };
 
-  std::vector<int32_t> line;
-  real min_loss = 1e10;
-  real c = 1.0;
-  const real EPS = 1e-8;
-  int32_t steps = 0;
-  while (localTokenCount < args_->epoch * local_ntokens) {
-    real progress = real(localTokenCount) / (args_->epoch * local_ntokens);
-    real lr = args_->lr * (1.0 - progress);  //* c;
-                                             //	if (lr < EPS)
-    //		tokenCount += args_->epoch * local_ntokens - localTokenCount;
-    //		break;
-    //	}
-
-    localTokenBuffer += dict_->getLine(ifs, line, model.rng);
-
-    skipgram(model, lr, line);
+  train_scratch_t scratch(*args_, *dict_);
+  std::vector<int32_t>& line = scratch.line;
+  int64_t allocs = 0;
+  real progress = 0.0;
+  real lr = args_->lr;
+  // trains on a line just read with ntokens tokens; lr follows the global
+  // token count before it, so every thread sees the same schedule however
+  // the input is spread
+  auto learn = [&](int32_t ntokens) {
+    progress = telemetry_->progress(localTokenCount + localTokenBuffer);
+    lr = args_->lr * (1.0 - progress);
+    localTokenBuffer += ntokens;
+    skipgram(model, scratch, lr, line);
     if (localTokenBuffer > args_->lrUpdateRate) {
-      long_real loss = model.getLoss();
-      steps++;
-
-      tokenCount += localTokenBuffer;
       localTokenCount += localTokenBuffer;
       localTokenBuffer = 0;
+      counters.publish(localTokenCount, model.getUpdates(), model.getLossSum(),
+                       model.getLossSamples());
+    }
+  };
 
-      if (threadId == logging_thread && args_->verbose > 1) {
-        printInfo(progress, loss, lr);
+  // time spent waiting for the stream or the readers
+  double idle = 0.0;
+  auto wait = [&](std::chrono::steady_clock::time_point start) {
+    idle += std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                          start)
+                .count();
+    counters.publishIdle(idle);
+  };
+
+  if (stream_ != nullptr) {
+    auto start = std::chrono::steady_clock::now();
+    for (token_batch_t* batch = stream_->pop(); batch != nullptr;
+         batch = stream_->pop()) {
+      wait(start);
+      const int64_t size = batch->ids.size();
+      for (int64_t pos = 0; pos < size;) {
+        const int64_t allocs_before = utils::allocCount();
+        learn(dict_->getLine(batch->ids.data(), size, pos, line, model.rng));
+        allocs += utils::allocCount() - allocs_before;
       }
-      if (args_->log_path != "") {
-        log_stream_ls << std::setprecision(6) << loss << ' ';
-        log_stream_lr << std::setprecision(6) << lr << ' ';
+      stream_->release(batch);
+      start = std::chrono::steady_clock::now();
+    }
+  } else if (readers_ != nullptr) {
+    // the lines come read and subsampled, only the updates are left
+    auto start = std::chrono::steady_clock::now();
+    for (line_batch_t* batch = readers_->pop(threadId); batch != nullptr;
+         batch = readers_->pop(threadId)) {
+      wait(start);
+      const int32_t* ids = batch->ids.data();
+      for (size_t i = 0; i < batch->ntokens.size(); i++) {
+        const int64_t allocs_before = utils::allocCount();
+        line.clear();
+        for (; *ids != TokenizedCorpus::EOL; ids++) line.push_back(*ids);
+        ids++;
+        learn(batch->ntokens[i]);
+        allocs += utils::allocCount() - allocs_before;
       }
+      readers_->release(threadId, batch);
+      start = std::chrono::steady_clock::now();
     }
   }
-  if (threadId == logging_thread && args_->verbose > 0) {
-    printInfo(1.0, model.getLoss(), 0.0);
-    std::cerr << std::endl;
+
+  int64_t item = state.item;
+  // with readers the scheduler hands out items to them instead
+  while (readers_ == nullptr &&
+         (item >= 0 || scheduler_->next(threadId, item))) {
+    const chunk_t& chunk = chunks_->chunk(item % chunks_->size());
+    int64_t pos = chunk.begin;
+    if (!chunks_->tokenized()) {
+      reader.load(chunk);
+      text.clear();
+    }
+    if (item == state.item) {
+      if (chunks_->tokenized()) {
+        pos = state.offset;
+      } else {
+        reader.seek(state.offset);
+      }
+      state.item = -1;
+    }
+
+    while (chunks_->tokenized() ? pos < chunk.end : !reader.done()) {
+      if (checkpointer_ != nullptr && checkpointer_->requested()) {
+        record(item, chunks_->tokenized() ? pos : reader.offset());
+        checkpointer_->pause(threadId, state);
+        state.item = -1;
+      }
+      const int64_t allocs_before = utils::allocCount();
+      if (chunks_->tokenized()) {
+        const TokenizedCorpus& corpus = chunks_->corpus(chunk.file);
+        learn(dict_->getLine(corpus.ids(), chunk.end, pos, line, model.rng));
+      } else {
+        learn(dict_->getLine(text, line, scratch.token, model.rng));
+      }
+      allocs += utils::allocCount() - allocs_before;
+    }
+    item = -1;
   }
-  if (args_->log_path != "") {
-    log_stream_ls.close();
-    log_stream_lr.close();
+  localTokenCount += localTokenBuffer;
+  localTokenBuffer = 0;
+  counters.publish(localTokenCount, model.getUpdates(), model.getLossSum(),
+                   model.getLossSamples());
+  if (checkpointer_ != nullptr) {
+    record(-1, 0);
+    checkpointer_->leave(threadId, state);
   }
+  if (stream_ != nullptr) {
+    // the epochs on the spill file carry on from here
+    record(-1, 0);
+    stream_states_[threadId] = state;
+  }
+#ifdef FASTTEXT_COUNT_ALLOCS
+  std::cerr << "thread " << threadId << ": " << allocs
+            << " heap allocations in the training loop" << std::endl;
+#endif
 
-  ifs.close();
   cnt_active_threads--;
 }
 
@@ -559,40 +903,234 @@ void FastText::loadVectors(std::string filename) {
       input_->data_[ind * dim + j] = mat->data_[i * dim + j];
     }
   }
+  input_->setStorage(args_->storage);
+}
+
+// Overlays the rows of a previous model on the freshly initialized input_
+// and output_. Rows are matched by their lexem strings: rows of lexems the
+// dictionary no longer has are dropped, and new lexems keep their fresh
+// rows. The hashed "_ngram" rows only match under the same minn, maxn and
+// bucket. Models written before the string tables can only be taken by
+// position, so their shape has to match.
+void FastText::warmStart(const std::string& path) {
+  std::ifstream in(path, std::ifstream::binary);
+  if (!in.is_open()) {
+    std::cerr << "Pretrained model cannot be opened!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  model_header_t header;
+  in.read((char*)&header, sizeof(header));
+  if (in && memcmp(header.magic, QUANT_MAGIC, sizeof(QUANT_MAGIC)) == 0) {
+    std::cerr << "Quantized models cannot be trained further!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  Matrix input, output;
+  bool tables = false;
+  if (in && memcmp(header.magic, MODEL_MAGIC, sizeof(MODEL_MAGIC)) == 0) {
+    input.loadAligned(in);
+    output.loadAligned(in);
+    tables = header.version >= 4;
+  } else {
+    // headerless model written before the aligned format
+    in.clear();
+    in.seekg(0);
+    input.load(in);
+    output.load(in);
+  }
+  int32_t minn = 0, maxn = 0, bucket = 0, nwords = 0, nrows = 0;
+  std::unordered_set<std::string> words;
+  std::vector<std::string> names;
+  if (tables) {
+    utils::readPod(in, minn);
+    utils::readPod(in, maxn);
+    utils::readPod(in, bucket);
+    utils::readPod(in, nwords);
+    std::string word;
+    for (int32_t i = 0; i < nwords && in; i++) {
+      utils::readString(in, word);
+      words.insert(word);
+    }
+    utils::readPod(in, nrows);
+    names.resize(
+        in && utils::checkLength(in, nrows, sizeof(int32_t)) ? nrows : 0);
+    for (int32_t i = 0; i < nrows && in; i++) utils::readString(in, names[i]);
+    if (in && nrows != input.m_) in.setstate(std::ios::failbit);
+  }
+  if (!in || input.m_ != output.m_ || input.n_ != output.n_) {
+    std::cerr << "Pretrained model is truncated or corrupted!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (input.n_ != args_->dim) {
+    std::cerr << "Dimension of pretrained model does not match -dim option"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (!tables && input.m_ != input_->m_) {
+    std::cerr << "Pretrained model has no string tables and "
+              << input.m_ << " rows instead of " << input_->m_
+              << ": its rows cannot be matched" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  const bool same_hashing =
+      minn == args_->minn && maxn == args_->maxn && bucket == args_->bucket;
+  const std::string suffix = "_ngram";
+  std::vector<int32_t> remap(input.m_, -1);
+  int64_t kept = 0;
+  for (int64_t i = 0; i < input.m_; i++) {
+    if (!tables) {
+      remap[i] = i;
+    } else if (same_hashing || names[i].size() <= suffix.size() ||
+               names[i].compare(names[i].size() - suffix.size(),
+                                suffix.size(), suffix) != 0) {
+      remap[i] = dict_->getRowIndex(names[i]);
+    }
+    kept += remap[i] >= 0;
+  }
+  utils::parallelFor(input.m_, args_->thread, [&](int64_t i) {
+    if (remap[i] < 0) return;
+    std::vector<real> row(input.n_);
+    input.getRow(i, row.data());
+    input_->setRow(remap[i], row.data());
+    output.getRow(i, row.data());
+    output_->setRow(remap[i], row.data());
+  });
+
+  std::cerr << "pretrained model: " << kept << " rows kept, "
+            << input.m_ - kept << " dropped, " << input_->m_ - kept << " new";
+  if (tables) {
+    int32_t new_words = 0;
+    for (int32_t i = 0; i < dict_->nwords; i++) {
+      new_words += words.count(dict_->getWord(i)) == 0;
+    }
+    std::cerr << " (" << new_words << " new words)";
+  } else {
+    std::cerr << ", taken by position";
+  }
+  std::cerr << std::endl;
+}
+
+// Runs the workers over the scheduled items, behind reader threads if
+// -readers asks for them, and waits for them to finish.
+void FastText::runWorkers() {
+  if (stream_ == nullptr && nreaders_ > 0) {
+    readers_ = std::make_shared<LineReaders>(*dict_, chunks_, scheduler_,
+                                             nreaders_, args_->thread);
+    readers_->start();
+  }
+  telemetry_->setReaders(stream_ != nullptr ? 1 : nreaders_);
+  std::vector<std::thread> threads;
+  for (int32_t i = 0; i < args_->thread; i++) {
+    threads.push_back(std::thread([=]() { trainThread(i); }));
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+  if (readers_ != nullptr) {
+    readers_->join();
+    readers_ = nullptr;
+  }
+}
+
+void FastText::trainStream() {
+  const std::string spill_path =
+      args_->epoch > 1 ? args_->output + ".stream.tok" : "";
+  stream_ = std::make_shared<TokenStream>(
+      *dict_, std::cin, STREAM_BATCHES_PER_THREAD * args_->thread, spill_path);
+  stream_states_.assign(args_->thread, worker_state_t());
+  stream_->start();
+  runWorkers();
+  stream_->join();
+  std::cerr << "\nstreamed: " << stream_->ntokens() << " tokens, "
+            << stream_->nlines() << " lines" << std::endl;
+  stream_ = nullptr;
+  if (spill_path.empty()) return;
+
+  // the spill file is an ordinary tokenized corpus; the workers resume
+  // from where the stream left them, so counts and lr carry on
+  chunks_ = std::make_shared<ChunkIndex>();
+  if (!chunks_->build(spill_path, *dict_, args_->thread)) {
+    exit(EXIT_FAILURE);
+  }
+  scheduler_ = std::make_shared<ChunkScheduler>(
+      chunks_->size() * (args_->epoch - 1),
+      nreaders_ > 0 ? nreaders_ : args_->thread);
+  resume_ = stream_states_;
+  runWorkers();
+  resume_.clear();
+  // unmapped before the file goes
+  chunks_ = nullptr;
+  remove(spill_path.c_str());
 }
 
 void FastText::train(std::shared_ptr<Args> args) {
   args_ = args;
   dict_ = std::make_shared<Dictionary>(args_);
-  if (args_->input == "-") {
-    // manage expectations
-    std::cerr << "Cannot use stdin for training!" << std::endl;
+  // workers waiting on a reader hold no position of their own to save
+  nreaders_ = std::max(0, std::min(args_->readers, args_->thread));
+  if (nreaders_ > 0 && (args_->checkpointTokens > 0 ||
+                        args_->checkpointMinutes > 0 || args_->resume > 0)) {
+    std::cerr << "Checkpoints need -readers 0!" << std::endl;
     exit(EXIT_FAILURE);
   }
-  std::ifstream ifs(args_->input);
-  if (!ifs.is_open()) {
-    std::cerr << "Input file cannot be opened!" << std::endl;
+  // stdin is trained on as it is read: one pass as it streams in, the
+  // other epochs on the ids spilled to a tokenized corpus on the way
+  const bool streaming = args_->input == "-";
+  chunks_ = std::make_shared<ChunkIndex>();
+  if (streaming) {
+    if (args_->checkpointTokens > 0 || args_->checkpointMinutes > 0 ||
+        args_->resume > 0) {
+      std::cerr << "Checkpoints need an -input file, not stdin!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    std::cerr << "training on stdin" << std::endl;
+  } else if (!chunks_->build(args_->input, *dict_, args_->thread)) {
     exit(EXIT_FAILURE);
   }
-  ifs.close();
+  // a tokenized corpus knows its length, for text the vocabulary counts
+  // stand in for it as before
+  int64_t ntokens = !streaming && chunks_->ntokens() >= 0 ? chunks_->ntokens()
+                                                         : dict_->ntokens;
+  if (!streaming) {
+    std::cerr << "training on " << chunks_->nfiles() << " file(s), "
+              << chunks_->size() << " chunks";
+    if (chunks_->tokenized()) {
+      std::cerr << ", " << chunks_->ntokens() << " tokens";
+    }
+    std::cerr << std::endl;
+  }
+  const int64_t nitems = chunks_->size() * args_->epoch;
+  const checkpoint_header_t shape = Checkpointer::header(
+      *args_, dict_->nlexems, nitems, ntokens * args_->epoch);
+  checkpoint_t checkpoint;
+  resume_.clear();
   //  if (args_->inputMatrix != "" ) {
   //	loadInputMatrix();
   //  }
-  if (args_->pretrainedModel != "") {
-    loadModel(args_->pretrainedModel, args_);
+  if (args_->resume > 0 &&
+      Checkpointer::load(args_->output + ".ckpt", shape, checkpoint)) {
+    // the matrices are taken as they were, weighting included
+    input_ = checkpoint.input;
+    output_ = checkpoint.output;
+    resume_ = checkpoint.workers;
   } else {
-    input_ = std::make_shared<Matrix>(dict_->nlexems, args_->dim);
+    input_ =
+        std::make_shared<Matrix>(dict_->nlexems, args_->dim, args_->storage);
     input_->uniform(1.0 / args_->dim);
-    output_ = std::make_shared<Matrix>(dict_->nlexems, args_->dim);
+    output_ =
+        std::make_shared<Matrix>(dict_->nlexems, args_->dim, args_->storage);
     output_->zero();
-  }
 
-  // experiment - set input weighted by frequencies
+    // experiment - set input weighted by frequencies
 
-  for (int32_t i = 0; i < dict_->nwords; ++i)
-    input_->mulRow(i, dict_->getWordWeight(i));
-  for (int32_t i = 0; i < dict_->nlexems - dict_->nwords; ++i)
-    input_->mulRow(dict_->nwords + i, dict_->getLexemWeight(i));
+    for (int32_t i = 0; i < dict_->nwords; ++i)
+      input_->mulRow(i, dict_->getWordWeight(i));
+    for (int32_t i = 0; i < dict_->nlexems - dict_->nwords; ++i)
+      input_->mulRow(dict_->nwords + i, dict_->getLexemWeight(i));
+
+    // rows carried over keep their trained values, unweighted
+    if (args_->pretrainedModel != "") warmStart(args_->pretrainedModel);
+  }
 
   //  inputs_.push_back(input_);
   //  outputs_.push_back(output_);
@@ -600,20 +1138,44 @@ void FastText::train(std::shared_ptr<Args> args) {
   //  inputs_.push_back(std::make_shared<Matrix>(*input_));
   //  outputs_.push_back(input_);
 
-  start = clock();
-  tokenCount = 0;
-  std::vector<std::thread> threads;
+  if (args_->loss == loss_name::ns) {
+    std::minstd_rand rng(0);
+    negatives_ = std::make_shared<NegativeTable>(dict_->getNSCounts(), rng);
+  }
+
+  if (args_->verbose > 0) {
+    std::cerr << "row kernels: " << kernels::name() << std::endl;
+  }
+  telemetry_ =
+      std::make_shared<Telemetry>(args_, args_->thread, ntokens * args_->epoch);
+  // the stream is read by its own producer, readers only come in on the
+  // spill file
+  scheduler_ = std::make_shared<ChunkScheduler>(
+      nitems, nreaders_ > 0 && !streaming ? nreaders_ : args_->thread);
+  if (!resume_.empty()) scheduler_->restore(checkpoint.ranges);
+  checkpointer_ = nullptr;
+  if (args_->checkpointTokens > 0 || args_->checkpointMinutes > 0) {
+    checkpointer_ = std::make_shared<Checkpointer>(
+        args_, shape, input_, output_, scheduler_, telemetry_);
+    checkpointer_->start(resume_);
+  }
   cnt_active_threads = 0;
   cnt_threads = 0;
   commonSteps = 0;
   maxSteps = 10000;
-  for (int32_t i = 0; i < args_->thread; i++) {
-    threads.push_back(std::thread([=]() { trainThread(i); }));
+  // the lr of a resumed run goes on from the tokens of all workers, not
+  // only from each worker's own until the first poll
+  for (size_t i = 0; i < resume_.size(); i++) {
+    telemetry_->counters(i).publish(resume_[i].tokens, 0, 0.0, 0);
   }
-  for (size_t i = 0; i < threads.size(); ++i) {
-    logging_thread = i;
-    threads[i].join();
+  telemetry_->start();
+  if (streaming) {
+    trainStream();
+  } else {
+    runWorkers();
   }
+  telemetry_->stop();
+  if (checkpointer_ != nullptr) checkpointer_->stop();
   std::cerr << "all threads joined\n";
 
   main_model_ = std::make_shared<Model>(input_, output_, args_, dict_, 0);
@@ -622,10 +1184,245 @@ void FastText::train(std::shared_ptr<Args> args) {
   main_model_->normalizeModel();
 
   saveModel();
+  precomputeWordVectors(args_->normalize > 0);
   saveVectors();
+  if (args_->saveWordMatrix > 0) {
+    saveWordMatrix();
+  }
   if (args_->saveOutput > 0) {
     saveOutput();
   }
 }
 
+void FastText::quantize(std::shared_ptr<Args> args) {
+  if (!mapModel(args->input, args)) {
+    loadModel(args->input, args);
+  }
+  if (qinput_ != nullptr) {
+    std::cerr << "Model " << args->input << " is already quantized!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  auto start = std::chrono::steady_clock::now();
+  qinput_ = std::make_shared<QMatrix>();
+  qinput_->quantize(*input_, args_->quant, args_->dsub, args_->thread);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  int64_t before = input_->m_ * input_->n_ * input_->elementSize();
+  std::cerr << std::fixed << std::setprecision(1) << "quantized "
+            << input_->m_ << " x " << input_->n_ << " rows in "
+            << elapsed.count() << "s: " << before << " -> " << qinput_->size()
+            << " bytes (" << double(before) / qinput_->size() << "x)"
+            << std::endl;
+  reportQuantization();
+
+  std::string path = args_->output + ".ftz";
+  std::ofstream ofs(path, std::ofstream::binary);
+  if (!ofs.is_open()) {
+    std::cerr << "Model file " << path << " cannot be opened for saving!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  model_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, QUANT_MAGIC, sizeof(QUANT_MAGIC));
+  header.version = QUANT_VERSION;
+  header.nmatrices = 1;
+  ofs.write((char*)&header, sizeof(header));
+  qinput_->save(ofs);
+  ofs.close();
+  std::cerr << "quantized model saved to " << path << std::endl;
+}
+
+// Compares the word vectors composed from the codes with the exact ones on
+// evenly spaced words: their mean cosine, and how many of a query's exact
+// 10 nearest neighbours among those words the quantized vectors still find.
+void FastText::reportQuantization() {
+  const int64_t k = 10;
+  const int64_t dim = args_->dim;
+  const int64_t nsample = std::min(int64_t(dict_->nwords), int64_t(10000));
+  const int64_t nqueries = std::min(nsample, int64_t(200));
+  if (nsample <= k) return;
+
+  std::vector<real> exact(nsample * dim), approx(nsample * dim);
+  std::vector<real> cosine(nsample);
+  utils::parallelFor(nsample, args_->thread, [&](int64_t i) {
+    int32_t id = i * dict_->nwords / nsample;
+    Vector e(dim), a(dim);
+    const lexem_span_t lexems = dict_->getWordLexems(id).all();
+    composeVector(e, lexems, false);
+    composeVector(a, lexems, true);
+    unitNormalize(e);
+    unitNormalize(a);
+    memcpy(exact.data() + i * dim, e.data_, dim * sizeof(real));
+    memcpy(approx.data() + i * dim, a.data_, dim * sizeof(real));
+    cosine[i] = kernels::dot(e.data_, a.data_, dim);
+  });
+
+  std::vector<real> recall(nqueries);
+  utils::parallelFor(nqueries, args_->thread, [&](int64_t q) {
+    const int64_t qi = q * nsample / nqueries;
+    std::vector<std::pair<real, int64_t>> e(nsample), a(nsample);
+    for (int64_t j = 0; j < nsample; j++) {
+      real se = kernels::dot(exact.data() + qi * dim, exact.data() + j * dim,
+                             dim);
+      real sa = kernels::dot(approx.data() + qi * dim,
+                             approx.data() + j * dim, dim);
+      // the query itself never counts as its own neighbour
+      e[j] = std::make_pair(j == qi ? 2 : -se, j);
+      a[j] = std::make_pair(j == qi ? 2 : -sa, j);
+    }
+    std::partial_sort(e.begin(), e.begin() + k, e.end());
+    std::partial_sort(a.begin(), a.begin() + k, a.end());
+    int64_t found = 0;
+    for (int64_t x = 0; x < k; x++) {
+      for (int64_t y = 0; y < k; y++) {
+        if (e[x].second == a[y].second) found++;
+      }
+    }
+    recall[q] = real(found) / k;
+  });
+
+  double mean_cosine = 0.0, mean_recall = 0.0;
+  for (real c : cosine) mean_cosine += c;
+  for (real r : recall) mean_recall += r;
+  std::cerr << std::setprecision(4) << "mean cosine to exact vectors: "
+            << mean_cosine / nsample << " over " << nsample
+            << " words, recall@" << k << ": " << mean_recall / nqueries
+            << " over " << nqueries << " queries" << std::endl;
+}
+
+void FastText::buildIndex(std::shared_ptr<Args> args) {
+  if (!mapModel(args->input, args)) {
+    loadModel(args->input, args);
+  }
+  const int32_t dim = args_->dim;
+  const int32_t n = dict_->nwords;
+  precomputeWordVectors(true);
+  std::vector<real> vectors(word_vectors_->data_,
+                            word_vectors_->data_ + int64_t(n) * dim);
+  word_vectors_ = nullptr;
+  std::vector<std::string> words(n);
+  for (int32_t i = 0; i < n; i++) {
+    words[i] = dict_->getWord(i);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  HnswIndex index;
+  index.build(vectors, words, dim, args_->hnswM, args_->efConstruction,
+              args_->thread);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cerr << std::fixed << std::setprecision(1) << "indexed " << n
+            << " words in " << elapsed.count() << "s" << std::endl;
+
+  // recall of the graph search against a scan of every word
+  const int32_t k = 10;
+  const int32_t nqueries = std::min(n, 100);
+  std::vector<real> recall(nqueries);
+  utils::parallelFor(nqueries, args_->thread, [&](int64_t q) {
+    const int32_t id = q * n / nqueries;
+    std::vector<HnswIndex::scored_t> exact(n), found;
+    for (int32_t j = 0; j < n; j++) {
+      exact[j] = HnswIndex::scored_t(
+          kernels::dot(index.vector(id), index.vector(j), dim), j);
+    }
+    int32_t kq = std::min(k, n);
+    std::partial_sort(exact.begin(), exact.begin() + kq, exact.end(),
+                      std::greater<HnswIndex::scored_t>());
+    index.search(index.vector(id), kq, args_->ef, found);
+    int32_t hits = 0;
+    for (int32_t x = 0; x < kq; x++) {
+      for (const HnswIndex::scored_t& f : found) {
+        if (f.second == exact[x].second) hits++;
+      }
+    }
+    recall[q] = real(hits) / kq;
+  });
+  if (nqueries > 0) {
+    double mean = 0.0;
+    for (real r : recall) mean += r;
+    std::cerr << std::setprecision(4) << "recall@" << k << " at ef "
+              << args_->ef << ": " << mean / nqueries << " over " << nqueries
+              << " queries" << std::endl;
+  }
+
+  std::string path = args_->output + ".hnsw";
+  std::ofstream ofs(path, std::ofstream::binary);
+  if (!ofs.is_open()) {
+    std::cerr << "Index file " << path << " cannot be opened for saving!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  index.save(ofs);
+  ofs.close();
+  std::cerr << "index saved to " << path << std::endl;
+}
+
+// Answers one query word per token of stdin with a line "word neighbour
+// score ..." of its k nearest neighbours.
+void FastText::nnQuery(const std::string& path, int32_t k,
+                       std::shared_ptr<Args> args) {
+  auto file = std::make_shared<utils::MappedFile>();
+  if (!file->open(path)) {
+    std::cerr << "Index file " << path << " cannot be opened!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  HnswIndex index;
+  if (!index.map(file)) {
+    std::cerr << "Index file " << path << " is not a valid index!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::string word;
+  std::vector<HnswIndex::scored_t> found;
+  int64_t nqueries = 0;
+  std::chrono::duration<double> elapsed(0);
+  while (std::cin >> word) {
+    int32_t id = index.find(word);
+    if (id < 0) {
+      std::cerr << "word '" << word << "' not in index" << std::endl;
+      continue;
+    }
+    auto start = std::chrono::steady_clock::now();
+    index.search(index.vector(id), k + 1, args->ef, found);
+    elapsed += std::chrono::steady_clock::now() - start;
+    nqueries++;
+
+    std::cout << word;
+    int32_t printed = 0;
+    for (size_t i = 0; i < found.size() && printed < k; i++) {
+      if (found[i].second == id) continue;
+      std::cout << ' ' << index.word(found[i].second) << ' '
+                << found[i].first;
+      printed++;
+    }
+    std::cout << '\n';
+  }
+  std::cout << std::flush;
+  if (nqueries > 0) {
+    std::cerr << nqueries << " queries, " << std::fixed
+              << std::setprecision(1) << 1e6 * elapsed.count() / nqueries
+              << " us per query" << std::endl;
+  }
+}
+
+void FastText::tokenize(std::shared_ptr<Args> args) {
+  args_ = args;
+  dict_ = std::make_shared<Dictionary>(args_);
+  std::string path = args_->output + ".tok";
+  if (args_->input == "-") {
+    TokenizedCorpus::build(*dict_, std::cin, path);
+  } else {
+    std::ifstream ifs(args_->input);
+    if (!ifs.is_open()) {
+      std::cerr << "Input file cannot be opened!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    TokenizedCorpus::build(*dict_, ifs, path);
+    ifs.close();
+  }
+}
+
 }  // namespace fasttext
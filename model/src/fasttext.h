@@ -20,31 +20,85 @@
 #include <thread>
 
 #include "args.h"
+#include "checkpoint.h"
+#include "chunks.h"
+#include "corpus.h"
 #include "dictionary.h"
+#include "hnsw.h"
 #include "matrix.h"
 #include "model.h"
+#include "qmatrix.h"
 #include "real.h"
+#include "stream.h"
+#include "telemetry.h"
 #include "utils.h"
 #include "vector.h"
 
 namespace fasttext {
 
+// Model files start with this header; the matrices follow in the aligned
+// layout of Matrix::saveAligned, so they can be mapped in place. Version 3
+// added the per-matrix storage field, which older files leave zero (fp32).
+// Version 4 appends the string tables after the matrices: the char n-gram
+// hashing (minn, maxn, bucket as int32), the words, and the lexem string of
+// every row, as Dictionary::getLexemsStrings names it.
+struct model_header_t {
+  char magic[8];
+  int32_t version;
+  int32_t nmatrices;
+  char reserved[48];
+};
+
+// Per-thread buffers of the training loop. They are sized once when the
+// worker starts, so the steady-state loop does not touch the heap.
+struct train_scratch_t {
+  std::vector<int32_t> line;
+  std::string token;
+  std::vector<int32_t> lexems;
+  std::vector<size_t> ends;
+  std::vector<lexem_span_t> inputs;
+  std::vector<size_t> ind;
+  std::vector<int32_t> targets;
+
+  std::uniform_int_distribution<> uniform;
+  std::uniform_int_distribution<> exp_random;
+  std::uniform_int_distribution<> one_out_rand;
+  std::uniform_int_distribution<> dropout_rand;
+
+  train_scratch_t(const Args&, const Dictionary&);
+};
+
 class FastText {
  private:
   std::shared_ptr<Args> args_;
   std::shared_ptr<Dictionary> dict_;
+  std::shared_ptr<ChunkIndex> chunks_;
+  std::shared_ptr<ChunkScheduler> scheduler_;
 
   std::shared_ptr<Matrix> input_;
   std::shared_ptr<Matrix> output_;
+  // set instead of input_ when a quantized model is loaded
+  std::shared_ptr<QMatrix> qinput_;
+  // nwords x dim composed word vectors, see precomputeWordVectors
+  std::shared_ptr<Matrix> word_vectors_;
+  bool word_vectors_normalized_;
   std::shared_ptr<Model> main_model_;
+  std::shared_ptr<const NegativeTable> negatives_;
 
   std::vector<std::shared_ptr<Matrix>> inputs_;
   std::vector<std::shared_ptr<Matrix>> outputs_;
   std::vector<std::shared_ptr<Model>> models_;
-  std::atomic<int64_t> tokenCount;
-  clock_t start;
+  std::shared_ptr<Telemetry> telemetry_;
+  std::shared_ptr<Checkpointer> checkpointer_;
+  // where each worker starts, from -resume, or empty
+  std::vector<worker_state_t> resume_;
+  // set while training on stdin, and where each worker ended its pass
+  std::shared_ptr<TokenStream> stream_;
+  std::vector<worker_state_t> stream_states_;
+  // -readers, at most one per worker, and the running readers if any
+  int32_t nreaders_;
+  std::shared_ptr<LineReaders> readers_;
 
-  std::atomic<int32_t> logging_thread;
   std::atomic<int32_t> cnt_threads;
   std::atomic<int32_t> cnt_active_threads;
   std::atomic<int32_t> commonSteps;
@@ -52,20 +106,40 @@ class FastText {
 
   std::mutex normalizer_mutex;
 
+  static const char MODEL_MAGIC[8];
+  static const int32_t MODEL_VERSION = 4;
+  // batches in flight per worker when training on stdin
+  static const int32_t STREAM_BATCHES_PER_THREAD = 4;
+  // quantized models: the same header, then the QMatrix of the input rows
+  static const char QUANT_MAGIC[8];
+  static const int32_t QUANT_VERSION = 1;
+  // composed word vectors: the header, the matrix, the normalized flag and
+  // the words
+  static const char WORDS_MAGIC[8];
+  static const int32_t WORDS_VERSION = 1;
+
+  void composeVector(Vector&, lexem_span_t, bool);
+  void writeVectors(const std::string&, const Matrix&);
+  void warmStart(const std::string&);
+  void checkModelRows(std::istream*, int64_t);
+  void reportQuantization();
+
  public:
   void getVector(Vector&, const std::string&);
 
+  void precomputeWordVectors(bool);
   void saveVectors();
+  void saveWordMatrix();
   void saveOutput();
   void saveModel();
   void loadModel(const std::string&, std::shared_ptr<Args> args = nullptr);
   void loadModel(std::istream&, std::shared_ptr<Args> args = nullptr);
-  void printInfo(real, long_real, real);
+  bool mapModel(const std::string&, std::shared_ptr<Args> args = nullptr);
 
   void supervised(Model&, real, const std::vector<int32_t>&,
                   const std::vector<int32_t>&);
   void cbow(Model&, real, const std::vector<int32_t>&);
-  void skipgram(Model&, real, const std::vector<int32_t>&);
+  void skipgram(Model&, train_scratch_t&, real, const std::vector<int32_t>&);
   void test(std::istream&, int32_t);
   void predict(std::istream&, int32_t, bool);
   void predict(std::istream&, int32_t,
@@ -75,7 +149,13 @@ class FastText {
   void textVectors();
   void printVectors();
   void trainThread(int32_t);
+  void runWorkers();
+  void trainStream();
   void train(std::shared_ptr<Args>);
+  void tokenize(std::shared_ptr<Args>);
+  void quantize(std::shared_ptr<Args>);
+  void buildIndex(std::shared_ptr<Args>);
+  void nnQuery(const std::string&, int32_t, std::shared_ptr<Args>);
 
   void loadVectors(std::string);
 };
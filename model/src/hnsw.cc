@@ -0,0 +1,380 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#include "hnsw.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <queue>
+#include <random>
+
+#include "kernels.h"
+#include "matrix.h"
+
+namespace fasttext {
+
+const char HnswIndex::MAGIC[8] = {'F', 'T', 'H', 'N', 'S', 'W', '0', '1'};
+const int32_t HnswIndex::VERSION;
+
+// levels are capped so a pathological draw cannot blow up the link arrays
+static const int32_t MAX_LEVEL = 16;
+
+HnswIndex::HnswIndex()
+    : n_(0),
+      dim_(0),
+      m_(0),
+      m0_(0),
+      max_level_(-1),
+      entry_(-1),
+      levels_(nullptr),
+      offsets_(nullptr),
+      links0_(nullptr),
+      links_(nullptr),
+      vectors_(nullptr),
+      word_offsets_(nullptr),
+      words_(nullptr) {}
+
+real HnswIndex::score(const real* x, int32_t i) const {
+  return kernels::dot(x, vector(i), dim_);
+}
+
+// Copies a link list out, under the node's lock while the graph is built.
+static void readLinks(const int32_t* list, std::mutex* lock,
+                      std::vector<int32_t>& out) {
+  if (lock != nullptr) lock->lock();
+  out.assign(list + 1, list + 1 + list[0]);
+  if (lock != nullptr) lock->unlock();
+}
+
+// Walks to the best neighbour on one layer until none improves.
+int32_t HnswIndex::greedy(const real* x, int32_t ep, int32_t level,
+                          bool locked) const {
+  std::vector<int32_t> neighbors;
+  real best = score(x, ep);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    readLinks(links(ep, level), locked ? &locks_[ep] : nullptr, neighbors);
+    for (int32_t nb : neighbors) {
+      real s = score(x, nb);
+      if (s > best) {
+        best = s;
+        ep = nb;
+        changed = true;
+      }
+    }
+  }
+  return ep;
+}
+
+// Best-first search of one layer from ep keeping the ef best nodes seen;
+// out receives them best first.
+void HnswIndex::searchLayer(const real* x, int32_t ep, int32_t ef,
+                            int32_t level, visited_t& visited,
+                            std::vector<scored_t>& out, bool locked) const {
+  if (visited.marks.size() < n_) {
+    visited.marks.assign(n_, 0);
+    visited.generation = 0;
+  }
+  if (++visited.generation == 0) {
+    std::fill(visited.marks.begin(), visited.marks.end(), 0);
+    visited.generation = 1;
+  }
+  const uint32_t gen = visited.generation;
+
+  std::priority_queue<scored_t> candidates;
+  std::priority_queue<scored_t, std::vector<scored_t>, std::greater<scored_t>>
+      results;
+  scored_t start(score(x, ep), ep);
+  candidates.push(start);
+  results.push(start);
+  visited.marks[ep] = gen;
+
+  std::vector<int32_t> neighbors;
+  while (!candidates.empty()) {
+    scored_t c = candidates.top();
+    if (c.first < results.top().first && results.size() >= ef) break;
+    candidates.pop();
+    readLinks(links(c.second, level), locked ? &locks_[c.second] : nullptr,
+              neighbors);
+    for (int32_t nb : neighbors) {
+      if (visited.marks[nb] == gen) continue;
+      visited.marks[nb] = gen;
+      real s = score(x, nb);
+      if (results.size() < ef || s > results.top().first) {
+        candidates.push(scored_t(s, nb));
+        results.push(scored_t(s, nb));
+        if (results.size() > ef) results.pop();
+      }
+    }
+  }
+  out.resize(results.size());
+  for (int64_t i = out.size() - 1; i >= 0; i--) {
+    out[i] = results.top();
+    results.pop();
+  }
+}
+
+// Keeps at most m of the candidates (sorted best first), skipping any that
+// is closer to an already kept one than to the target; this keeps links
+// spread over directions instead of piling into one cluster.
+void HnswIndex::selectNeighbors(std::vector<scored_t>& candidates,
+                                int32_t m) const {
+  if (candidates.size() <= m) return;
+  std::vector<scored_t> kept;
+  for (const scored_t& c : candidates) {
+    if (kept.size() >= m) break;
+    bool good = true;
+    for (const scored_t& k : kept) {
+      if (score(vector(c.second), k.second) > c.first) {
+        good = false;
+        break;
+      }
+    }
+    if (good) kept.push_back(c);
+  }
+  candidates.swap(kept);
+}
+
+// Adds the link node -> q on a layer, pruning the list when it is full.
+void HnswIndex::connect(int32_t node, int32_t q, int32_t level) {
+  const int32_t cap = level == 0 ? m0_ : m_;
+  std::lock_guard<std::mutex> lock(locks_[node]);
+  int32_t* list = links(node, level);
+  if (list[0] < cap) {
+    list[1 + list[0]++] = q;
+    return;
+  }
+  const real* x = vector(node);
+  std::vector<scored_t> candidates;
+  candidates.push_back(scored_t(score(x, q), q));
+  for (int32_t i = 0; i < list[0]; i++) {
+    candidates.push_back(scored_t(score(x, list[1 + i]), list[1 + i]));
+  }
+  std::sort(candidates.begin(), candidates.end(), std::greater<scored_t>());
+  selectNeighbors(candidates, cap);
+  list[0] = candidates.size();
+  for (size_t i = 0; i < candidates.size(); i++) {
+    list[1 + i] = candidates[i].second;
+  }
+}
+
+void HnswIndex::insert(int32_t q, int32_t ef, visited_t& visited) {
+  const real* x = vector(q);
+  const int32_t level = levels_[q];
+  // a node that raises the top level keeps the entry lock until it is the
+  // new entry point; everyone else reads the entry and lets go
+  std::unique_lock<std::mutex> entry_lock(entry_lock_);
+  const int32_t max_level = max_level_;
+  int32_t ep = entry_;
+  if (ep < 0) {
+    entry_ = q;
+    max_level_ = level;
+    return;
+  }
+  if (level <= max_level) entry_lock.unlock();
+
+  for (int32_t l = max_level; l > level; l--) {
+    ep = greedy(x, ep, l, true);
+  }
+  std::vector<scored_t> candidates;
+  for (int32_t l = std::min(level, max_level); l >= 0; l--) {
+    searchLayer(x, ep, ef, l, visited, candidates, true);
+    ep = candidates[0].second;
+    selectNeighbors(candidates, m_);
+    {
+      std::lock_guard<std::mutex> lock(locks_[q]);
+      int32_t* list = links(q, l);
+      list[0] = candidates.size();
+      for (size_t i = 0; i < candidates.size(); i++) {
+        list[1 + i] = candidates[i].second;
+      }
+    }
+    for (const scored_t& c : candidates) {
+      connect(c.second, q, l);
+    }
+  }
+  if (level > max_level) {
+    entry_ = q;
+    max_level_ = level;
+  }
+}
+
+void HnswIndex::build(std::vector<real>& vectors,
+                      const std::vector<std::string>& words, int32_t dim,
+                      int32_t m, int32_t ef, int32_t nthreads) {
+  mapping_.reset();
+  n_ = words.size();
+  dim_ = dim;
+  m_ = std::max(m, 2);
+  m0_ = 2 * m_;
+  max_level_ = -1;
+  entry_ = -1;
+  owned_vectors_.swap(vectors);
+  vectors_ = owned_vectors_.data();
+
+  owned_word_offsets_.assign(1, 0);
+  owned_words_.clear();
+  for (const std::string& w : words) {
+    owned_words_.insert(owned_words_.end(), w.begin(), w.end());
+    owned_word_offsets_.push_back(owned_words_.size());
+  }
+  word_offsets_ = owned_word_offsets_.data();
+  words_ = owned_words_.data();
+  indexWords();
+
+  // levels are geometric with ratio 1 / m, as in the HNSW paper
+  std::minstd_rand rng(1);
+  std::uniform_real_distribution<> uniform(0.0, 1.0);
+  const double mult = 1.0 / log(double(m_));
+  owned_levels_.resize(n_);
+  owned_offsets_.resize(n_);
+  int64_t total = 0;
+  for (int32_t i = 0; i < n_; i++) {
+    int32_t level = int32_t(-log(std::max(uniform(rng), 1e-12)) * mult);
+    owned_levels_[i] = std::min(level, MAX_LEVEL);
+    owned_offsets_[i] = total;
+    total += int64_t(owned_levels_[i]) * (m_ + 1);
+  }
+  owned_links0_.assign(int64_t(n_) * (m0_ + 1), 0);
+  owned_links_.assign(total, 0);
+  levels_ = owned_levels_.data();
+  offsets_ = owned_offsets_.data();
+  links0_ = owned_links0_.data();
+  links_ = owned_links_.data();
+  locks_.reset(new std::mutex[n_]);
+
+  if (n_ == 0) return;
+  visited_t visited;
+  insert(0, ef, visited);
+  std::atomic<int32_t> next(1);
+  utils::parallelFor(nthreads, nthreads, [&](int64_t) {
+    visited_t visited;
+    int32_t i;
+    while ((i = next++) < n_) {
+      insert(i, ef, visited);
+    }
+  });
+}
+
+void HnswIndex::indexWords() {
+  word2id_.clear();
+  word2id_.reserve(n_);
+  for (int32_t i = 0; i < n_; i++) {
+    word2id_.emplace(word(i), i);
+  }
+}
+
+std::string HnswIndex::word(int32_t i) const {
+  return std::string(words_ + word_offsets_[i],
+                     word_offsets_[i + 1] - word_offsets_[i]);
+}
+
+int32_t HnswIndex::find(const std::string& w) const {
+  auto it = word2id_.find(w);
+  return it == word2id_.end() ? -1 : it->second;
+}
+
+void HnswIndex::search(const real* x, int32_t k, int32_t ef,
+                       std::vector<scored_t>& out) const {
+  out.clear();
+  if (n_ == 0) return;
+  static thread_local visited_t visited;
+  int32_t ep = entry_;
+  for (int32_t l = max_level_; l > 0; l--) {
+    ep = greedy(x, ep, l, false);
+  }
+  searchLayer(x, ep, std::max(ef, k), 0, visited, out, false);
+  if (out.size() > k) out.resize(k);
+}
+
+// layout: magic, version, n, dim, m, m0, max level, entry, then aligned
+// sections: levels, link offsets, level 0 links, upper links, vectors, word
+// offsets, word bytes
+void HnswIndex::save(std::ostream& out) {
+  int32_t fields[8] = {VERSION, n_, dim_, m_, m0_, max_level_, entry_, 0};
+  out.write(MAGIC, sizeof(MAGIC));
+  Matrix::writeAligned(out, fields, sizeof(fields));
+  int64_t total =
+      n_ > 0 ? offsets_[n_ - 1] + int64_t(levels_[n_ - 1]) * (m_ + 1) : 0;
+  Matrix::writeAligned(out, levels_, n_ * sizeof(int32_t));
+  Matrix::writeAligned(out, offsets_, n_ * sizeof(int64_t));
+  Matrix::writeAligned(out, links0_,
+                       int64_t(n_) * (m0_ + 1) * sizeof(int32_t));
+  Matrix::writeAligned(out, links_, total * sizeof(int32_t));
+  Matrix::writeAligned(out, vectors_, int64_t(n_) * dim_ * sizeof(real));
+  Matrix::writeAligned(out, word_offsets_, (n_ + 1) * sizeof(int64_t));
+  Matrix::writeAligned(out, words_, word_offsets_[n_]);
+}
+
+// Points data at a section of size bytes at offset and moves offset past
+// it; false if the section does not fit in the file.
+static bool mapSection(const utils::MappedFile& file, int64_t& offset,
+                       int64_t size, const char*& data) {
+  if (size < 0 || offset + size > file.size()) return false;
+  data = file.data() + offset;
+  offset += size;
+  offset += Matrix::alignedPadding(offset);
+  return true;
+}
+
+bool HnswIndex::map(std::shared_ptr<utils::MappedFile> file) {
+  int32_t fields[8];
+  if (file->size() < sizeof(MAGIC) + sizeof(fields)) return false;
+  if (memcmp(file->data(), MAGIC, sizeof(MAGIC)) != 0) return false;
+  memcpy(fields, file->data() + sizeof(MAGIC), sizeof(fields));
+  if (fields[0] != VERSION || fields[1] < 0 || fields[2] <= 0) return false;
+  n_ = fields[1];
+  dim_ = fields[2];
+  m_ = fields[3];
+  m0_ = fields[4];
+  max_level_ = fields[5];
+  entry_ = fields[6];
+
+  int64_t offset = sizeof(MAGIC) + sizeof(fields);
+  offset += Matrix::alignedPadding(offset);
+  const char *levels, *offsets, *links0, *links, *vectors, *word_offsets,
+      *words;
+  if (!mapSection(*file, offset, n_ * sizeof(int32_t), levels) ||
+      !mapSection(*file, offset, n_ * sizeof(int64_t), offsets)) {
+    return false;
+  }
+  levels_ = (const int32_t*)levels;
+  offsets_ = (const int64_t*)offsets;
+  int64_t total =
+      n_ > 0 ? offsets_[n_ - 1] + int64_t(levels_[n_ - 1]) * (m_ + 1) : 0;
+  if (!mapSection(*file, offset, int64_t(n_) * (m0_ + 1) * sizeof(int32_t),
+                  links0) ||
+      !mapSection(*file, offset, total * sizeof(int32_t), links) ||
+      !mapSection(*file, offset, int64_t(n_) * dim_ * sizeof(real),
+                  vectors) ||
+      !mapSection(*file, offset, (n_ + 1) * sizeof(int64_t), word_offsets)) {
+    return false;
+  }
+  word_offsets_ = (const int64_t*)word_offsets;
+  if (!mapSection(*file, offset, word_offsets_[n_], words)) return false;
+
+  // the mapping is read-only; searches never write links
+  links0_ = (int32_t*)links0;
+  links_ = (int32_t*)links;
+  vectors_ = (const real*)vectors;
+  words_ = words;
+  mapping_ = file;
+  locks_.reset();
+  indexWords();
+  return true;
+}
+
+}  // namespace fasttext
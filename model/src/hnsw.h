@@ -0,0 +1,114 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#ifndef FASTTEXT_HNSW_H
+#define FASTTEXT_HNSW_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "real.h"
+#include "utils.h"
+
+namespace fasttext {
+
+// Hierarchical navigable small world graph over unit word vectors, scored
+// by inner product (cosine). Every layer stores fixed-size link lists
+// (count, then ids), level 0 with 2 * M slots and the upper ones with M.
+// Node levels are drawn before any insertion, so all links live in two flat
+// arrays that are written and mapped as they are.
+class HnswIndex {
+ public:
+  typedef std::pair<real, int32_t> scored_t;
+
+ private:
+  // per-thread search state: visit marks tagged with a generation number
+  struct visited_t {
+    std::vector<uint32_t> marks;
+    uint32_t generation;
+  };
+
+  std::shared_ptr<utils::MappedFile> mapping_;
+  std::vector<int32_t> owned_levels_;
+  std::vector<int64_t> owned_offsets_;
+  std::vector<int32_t> owned_links0_;
+  std::vector<int32_t> owned_links_;
+  std::vector<real> owned_vectors_;
+  std::vector<int64_t> owned_word_offsets_;
+  std::vector<char> owned_words_;
+
+  int32_t n_;
+  int32_t dim_;
+  int32_t m_;
+  int32_t m0_;
+  int32_t max_level_;
+  int32_t entry_;
+
+  const int32_t* levels_;
+  // start of each node's upper link lists in links_, in int32 units
+  const int64_t* offsets_;
+  int32_t* links0_;
+  int32_t* links_;
+  const real* vectors_;
+  const int64_t* word_offsets_;
+  const char* words_;
+  std::unordered_map<std::string, int32_t> word2id_;
+
+  std::unique_ptr<std::mutex[]> locks_;
+  std::mutex entry_lock_;
+
+  HnswIndex(const HnswIndex&);
+  HnswIndex& operator=(const HnswIndex&);
+
+  int32_t* links(int32_t node, int32_t level) const {
+    return level == 0 ? links0_ + int64_t(node) * (m0_ + 1)
+                      : links_ + offsets_[node] + (level - 1) * (m_ + 1);
+  }
+  real score(const real*, int32_t) const;
+  int32_t greedy(const real*, int32_t, int32_t, bool) const;
+  void searchLayer(const real*, int32_t, int32_t, int32_t, visited_t&,
+                   std::vector<scored_t>&, bool) const;
+  void selectNeighbors(std::vector<scored_t>&, int32_t) const;
+  void connect(int32_t, int32_t, int32_t);
+  void insert(int32_t, int32_t, visited_t&);
+  void indexWords();
+
+ public:
+  static const char MAGIC[8];
+  static const int32_t VERSION = 1;
+
+  HnswIndex();
+
+  // takes the rows of vectors (n x dim, unit length) and their words
+  void build(std::vector<real>&, const std::vector<std::string>&, int32_t,
+             int32_t, int32_t, int32_t);
+  void save(std::ostream&);
+  bool map(std::shared_ptr<utils::MappedFile>);
+
+  int32_t size() const { return n_; }
+  int32_t dim() const { return dim_; }
+  std::string word(int32_t) const;
+  // id of a word in the index, or -1
+  int32_t find(const std::string&) const;
+  const real* vector(int32_t i) const { return vectors_ + int64_t(i) * dim_; }
+  // the k best nodes for a unit query vector, best first
+  void search(const real*, int32_t, int32_t, std::vector<scored_t>&) const;
+};
+
+}  // namespace fasttext
+
+#endif
@@ -0,0 +1,640 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#include "kernels.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FASTTEXT_X86_KERNELS
+#endif
+
+namespace fasttext {
+
+namespace kernels {
+
+namespace {
+
+real dotScalar(const real* x, const real* y, int64_t n) {
+  real d = 0.0;
+  for (int64_t j = 0; j < n; j++) {
+    d += x[j] * y[j];
+  }
+  return d;
+}
+
+void axpyScalar(real a, const real* x, real* y, int64_t n) {
+  for (int64_t j = 0; j < n; j++) {
+    y[j] += a * x[j];
+  }
+}
+
+void addScalar(const real* x, real* y, int64_t n) {
+  for (int64_t j = 0; j < n; j++) {
+    y[j] += x[j];
+  }
+}
+
+void dotRowsScalar(const real* A, int64_t n, const int32_t* rows, int64_t k,
+                   const real* x, real* out) {
+  int64_t i = 0;
+  for (; i + 4 <= k; i += 4) {
+    const real* r0 = A + rows[i] * n;
+    const real* r1 = A + rows[i + 1] * n;
+    const real* r2 = A + rows[i + 2] * n;
+    const real* r3 = A + rows[i + 3] * n;
+    real d0 = 0.0, d1 = 0.0, d2 = 0.0, d3 = 0.0;
+    for (int64_t j = 0; j < n; j++) {
+      d0 += r0[j] * x[j];
+      d1 += r1[j] * x[j];
+      d2 += r2[j] * x[j];
+      d3 += r3[j] * x[j];
+    }
+    out[i] = d0;
+    out[i + 1] = d1;
+    out[i + 2] = d2;
+    out[i + 3] = d3;
+  }
+  for (; i < k; i++) {
+    out[i] = dotScalar(A + rows[i] * n, x, n);
+  }
+}
+
+inline uint32_t floatBits(real f) {
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+  return u;
+}
+
+inline real bitsFloat(uint32_t u) {
+  real f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+// bf16 is the upper half of an fp32; rounding to nearest even keeps NaNs
+// quiet NaNs
+struct bf16_codec {
+  static real get(uint16_t h) { return bitsFloat(uint32_t(h) << 16); }
+  static uint16_t put(real f) {
+    uint32_t u = floatBits(f);
+    if ((u & 0x7FFFFFFF) > 0x7F800000) return (u >> 16) | 0x40;
+    return (u + 0x7FFF + ((u >> 16) & 1)) >> 16;
+  }
+#ifdef FASTTEXT_X86_KERNELS
+  __attribute__((target("avx2"))) static __m256 load(const uint16_t* p) {
+    __m256i h = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(h, 16));
+  }
+  __attribute__((target("avx2"))) static void store(uint16_t* p, __m256 v) {
+    const __m256i bits = _mm256_castps_si256(v);
+    __m256i odd = _mm256_and_si256(_mm256_srli_epi32(bits, 16),
+                                   _mm256_set1_epi32(1));
+    __m256i u = _mm256_add_epi32(
+        bits, _mm256_add_epi32(odd, _mm256_set1_epi32(0x7FFF)));
+    u = _mm256_srli_epi32(u, 16);
+    // NaN lanes are truncated and kept quiet, as in put, not rounded into
+    // infinities or zeros
+    __m256i nan = _mm256_or_si256(_mm256_srli_epi32(bits, 16),
+                                  _mm256_set1_epi32(0x40));
+    u = _mm256_blendv_epi8(
+        u, nan, _mm256_castps_si256(_mm256_cmp_ps(v, v, _CMP_UNORD_Q)));
+    // packus interleaves the 128-bit lanes, the permute restores the order
+    u = _mm256_permute4x64_epi64(_mm256_packus_epi32(u, u), 0xD8);
+    _mm_storeu_si128((__m128i*)p, _mm256_castsi256_si128(u));
+  }
+#endif
+};
+
+// IEEE binary16, converted in software here and with F16C when available
+struct fp16_codec {
+  static real get(uint16_t h) {
+    uint32_t sign = uint32_t(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1F;
+    uint32_t mant = h & 0x3FF;
+    if (exp == 0) {
+      // zero or subnormal: mant * 2^-24
+      real f = mant * (1.0f / 16777216.0f);
+      return sign ? -f : f;
+    }
+    if (exp == 0x1F) return bitsFloat(sign | 0x7F800000 | (mant << 13));
+    return bitsFloat(sign | ((exp + 112) << 23) | (mant << 13));
+  }
+  static uint16_t put(real f) {
+    uint32_t u = floatBits(f);
+    uint16_t sign = (u >> 16) & 0x8000;
+    u &= 0x7FFFFFFF;
+    if (u >= 0x47800000) {
+      // too large for a half: infinity, or a quiet NaN
+      return sign | (u > 0x7F800000 ? 0x7E00 : 0x7C00);
+    }
+    if (u < 0x38800000) {
+      // subnormal result: adding 0.5 makes the FPU round at 2^-24
+      return sign | (floatBits(bitsFloat(u) + 0.5f) - 0x3F000000);
+    }
+    // rebias the exponent and round the 13 dropped bits to nearest even
+    u += 0xC8000FFF + ((u >> 13) & 1);
+    return sign | (u >> 13);
+  }
+#ifdef FASTTEXT_X86_KERNELS
+  __attribute__((target("avx2,f16c"))) static __m256 load(const uint16_t* p) {
+    return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)p));
+  }
+  __attribute__((target("avx2,f16c"))) static void store(uint16_t* p,
+                                                         __m256 v) {
+    _mm_storeu_si128((__m128i*)p,
+                     _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+  }
+#endif
+};
+
+template <class H>
+real dotHalfScalar(const uint16_t* x, const real* y, int64_t n) {
+  real d = 0.0;
+  for (int64_t j = 0; j < n; j++) {
+    d += H::get(x[j]) * y[j];
+  }
+  return d;
+}
+
+template <class H>
+void axpyHalfScalar(real a, const real* x, uint16_t* y, int64_t n) {
+  for (int64_t j = 0; j < n; j++) {
+    y[j] = H::put(H::get(y[j]) + a * x[j]);
+  }
+}
+
+template <class H>
+void axpyFromHalfScalar(real a, const uint16_t* x, real* y, int64_t n) {
+  for (int64_t j = 0; j < n; j++) {
+    y[j] += a * H::get(x[j]);
+  }
+}
+
+template <class H>
+void dotRowsHalfScalar(const uint16_t* A, int64_t n, const int32_t* rows,
+                       int64_t k, const real* x, real* out) {
+  for (int64_t i = 0; i < k; i++) {
+    out[i] = dotHalfScalar<H>(A + rows[i] * n, x, n);
+  }
+}
+
+template <class H>
+void toHalfScalar(const real* x, uint16_t* y, int64_t n) {
+  for (int64_t j = 0; j < n; j++) {
+    y[j] = H::put(x[j]);
+  }
+}
+
+template <class H>
+void fromHalfScalar(const uint16_t* x, real* y, int64_t n) {
+  for (int64_t j = 0; j < n; j++) {
+    y[j] = H::get(x[j]);
+  }
+}
+
+#ifdef FASTTEXT_X86_KERNELS
+
+__attribute__((target("avx2"))) inline real hsumAvx2(__m256 s) {
+  __m128 h = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+  h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+  h = _mm_add_ss(h, _mm_movehdup_ps(h));
+  return _mm_cvtss_f32(h);
+}
+
+__attribute__((target("avx2,fma"))) real dotAvx2(const real* x, const real* y,
+                                                 int64_t n) {
+  __m256 s0 = _mm256_setzero_ps();
+  __m256 s1 = _mm256_setzero_ps();
+  __m256 s2 = _mm256_setzero_ps();
+  __m256 s3 = _mm256_setzero_ps();
+  int64_t j = 0;
+  for (; j + 32 <= n; j += 32) {
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + j), _mm256_loadu_ps(y + j), s0);
+    s1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + j + 8), _mm256_loadu_ps(y + j + 8),
+                         s1);
+    s2 = _mm256_fmadd_ps(_mm256_loadu_ps(x + j + 16),
+                         _mm256_loadu_ps(y + j + 16), s2);
+    s3 = _mm256_fmadd_ps(_mm256_loadu_ps(x + j + 24),
+                         _mm256_loadu_ps(y + j + 24), s3);
+  }
+  for (; j + 8 <= n; j += 8) {
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + j), _mm256_loadu_ps(y + j), s0);
+  }
+  real d = hsumAvx2(_mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3)));
+  for (; j < n; j++) {
+    d += x[j] * y[j];
+  }
+  return d;
+}
+
+__attribute__((target("avx2,fma"))) void axpyAvx2(real a, const real* x,
+                                                  real* y, int64_t n) {
+  const __m256 va = _mm256_set1_ps(a);
+  int64_t j = 0;
+  for (; j + 16 <= n; j += 16) {
+    _mm256_storeu_ps(y + j, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + j),
+                                            _mm256_loadu_ps(y + j)));
+    _mm256_storeu_ps(y + j + 8, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + j + 8),
+                                                _mm256_loadu_ps(y + j + 8)));
+  }
+  for (; j + 8 <= n; j += 8) {
+    _mm256_storeu_ps(y + j, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + j),
+                                            _mm256_loadu_ps(y + j)));
+  }
+  for (; j < n; j++) {
+    y[j] += a * x[j];
+  }
+}
+
+__attribute__((target("avx2"))) void addAvx2(const real* x, real* y,
+                                             int64_t n) {
+  int64_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    _mm256_storeu_ps(y + j,
+                     _mm256_add_ps(_mm256_loadu_ps(x + j), _mm256_loadu_ps(y + j)));
+  }
+  for (; j < n; j++) {
+    y[j] += x[j];
+  }
+}
+
+// four rows per pass share every load of x
+__attribute__((target("avx2,fma"))) void dotRowsAvx2(const real* A, int64_t n,
+                                                     const int32_t* rows,
+                                                     int64_t k, const real* x,
+                                                     real* out) {
+  int64_t i = 0;
+  for (; i + 4 <= k; i += 4) {
+    const real* r0 = A + rows[i] * n;
+    const real* r1 = A + rows[i + 1] * n;
+    const real* r2 = A + rows[i + 2] * n;
+    const real* r3 = A + rows[i + 3] * n;
+    __m256 s0 = _mm256_setzero_ps();
+    __m256 s1 = _mm256_setzero_ps();
+    __m256 s2 = _mm256_setzero_ps();
+    __m256 s3 = _mm256_setzero_ps();
+    int64_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+      const __m256 vx = _mm256_loadu_ps(x + j);
+      s0 = _mm256_fmadd_ps(_mm256_loadu_ps(r0 + j), vx, s0);
+      s1 = _mm256_fmadd_ps(_mm256_loadu_ps(r1 + j), vx, s1);
+      s2 = _mm256_fmadd_ps(_mm256_loadu_ps(r2 + j), vx, s2);
+      s3 = _mm256_fmadd_ps(_mm256_loadu_ps(r3 + j), vx, s3);
+    }
+    real d0 = hsumAvx2(s0), d1 = hsumAvx2(s1);
+    real d2 = hsumAvx2(s2), d3 = hsumAvx2(s3);
+    for (; j < n; j++) {
+      d0 += r0[j] * x[j];
+      d1 += r1[j] * x[j];
+      d2 += r2[j] * x[j];
+      d3 += r3[j] * x[j];
+    }
+    out[i] = d0;
+    out[i + 1] = d1;
+    out[i + 2] = d2;
+    out[i + 3] = d3;
+  }
+  for (; i < k; i++) {
+    out[i] = dotAvx2(A + rows[i] * n, x, n);
+  }
+}
+
+__attribute__((target("avx512f"))) real dotAvx512(const real* x,
+                                                  const real* y, int64_t n) {
+  __m512 s0 = _mm512_setzero_ps();
+  __m512 s1 = _mm512_setzero_ps();
+  int64_t j = 0;
+  for (; j + 32 <= n; j += 32) {
+    s0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + j), _mm512_loadu_ps(y + j), s0);
+    s1 = _mm512_fmadd_ps(_mm512_loadu_ps(x + j + 16),
+                         _mm512_loadu_ps(y + j + 16), s1);
+  }
+  for (; j + 16 <= n; j += 16) {
+    s0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + j), _mm512_loadu_ps(y + j), s0);
+  }
+  if (j < n) {
+    const __mmask16 m = (__mmask16)((1u << (n - j)) - 1);
+    s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, x + j),
+                         _mm512_maskz_loadu_ps(m, y + j), s1);
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+}
+
+__attribute__((target("avx512f"))) void axpyAvx512(real a, const real* x,
+                                                   real* y, int64_t n) {
+  const __m512 va = _mm512_set1_ps(a);
+  int64_t j = 0;
+  for (; j + 16 <= n; j += 16) {
+    _mm512_storeu_ps(y + j, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + j),
+                                            _mm512_loadu_ps(y + j)));
+  }
+  if (j < n) {
+    const __mmask16 m = (__mmask16)((1u << (n - j)) - 1);
+    _mm512_mask_storeu_ps(
+        y + j, m,
+        _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, x + j),
+                        _mm512_maskz_loadu_ps(m, y + j)));
+  }
+}
+
+__attribute__((target("avx512f"))) void addAvx512(const real* x, real* y,
+                                                  int64_t n) {
+  int64_t j = 0;
+  for (; j + 16 <= n; j += 16) {
+    _mm512_storeu_ps(y + j,
+                     _mm512_add_ps(_mm512_loadu_ps(x + j), _mm512_loadu_ps(y + j)));
+  }
+  if (j < n) {
+    const __mmask16 m = (__mmask16)((1u << (n - j)) - 1);
+    _mm512_mask_storeu_ps(y + j, m,
+                          _mm512_add_ps(_mm512_maskz_loadu_ps(m, x + j),
+                                        _mm512_maskz_loadu_ps(m, y + j)));
+  }
+}
+
+__attribute__((target("avx512f"))) void dotRowsAvx512(
+    const real* A, int64_t n, const int32_t* rows, int64_t k, const real* x,
+    real* out) {
+  int64_t i = 0;
+  for (; i + 4 <= k; i += 4) {
+    const real* r0 = A + rows[i] * n;
+    const real* r1 = A + rows[i + 1] * n;
+    const real* r2 = A + rows[i + 2] * n;
+    const real* r3 = A + rows[i + 3] * n;
+    __m512 s0 = _mm512_setzero_ps();
+    __m512 s1 = _mm512_setzero_ps();
+    __m512 s2 = _mm512_setzero_ps();
+    __m512 s3 = _mm512_setzero_ps();
+    for (int64_t j = 0; j < n; j += 16) {
+      const __mmask16 m =
+          n - j >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - j)) - 1);
+      const __m512 vx = _mm512_maskz_loadu_ps(m, x + j);
+      s0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, r0 + j), vx, s0);
+      s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, r1 + j), vx, s1);
+      s2 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, r2 + j), vx, s2);
+      s3 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, r3 + j), vx, s3);
+    }
+    out[i] = _mm512_reduce_add_ps(s0);
+    out[i + 1] = _mm512_reduce_add_ps(s1);
+    out[i + 2] = _mm512_reduce_add_ps(s2);
+    out[i + 3] = _mm512_reduce_add_ps(s3);
+  }
+  for (; i < k; i++) {
+    out[i] = dotAvx512(A + rows[i] * n, x, n);
+  }
+}
+
+// Half rows for AVX2 and AVX-512 hosts alike: eight values per step, which
+// is one 128-bit load of halves
+template <class H>
+__attribute__((target("avx2,fma,f16c"))) real dotHalfAvx2(const uint16_t* x,
+                                                          const real* y,
+                                                          int64_t n) {
+  __m256 s0 = _mm256_setzero_ps();
+  __m256 s1 = _mm256_setzero_ps();
+  int64_t j = 0;
+  for (; j + 16 <= n; j += 16) {
+    s0 = _mm256_fmadd_ps(H::load(x + j), _mm256_loadu_ps(y + j), s0);
+    s1 = _mm256_fmadd_ps(H::load(x + j + 8), _mm256_loadu_ps(y + j + 8), s1);
+  }
+  for (; j + 8 <= n; j += 8) {
+    s0 = _mm256_fmadd_ps(H::load(x + j), _mm256_loadu_ps(y + j), s0);
+  }
+  real d = hsumAvx2(_mm256_add_ps(s0, s1));
+  for (; j < n; j++) {
+    d += H::get(x[j]) * y[j];
+  }
+  return d;
+}
+
+template <class H>
+__attribute__((target("avx2,fma,f16c"))) void axpyHalfAvx2(real a,
+                                                           const real* x,
+                                                           uint16_t* y,
+                                                           int64_t n) {
+  const __m256 va = _mm256_set1_ps(a);
+  int64_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    H::store(y + j, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + j), H::load(y + j)));
+  }
+  for (; j < n; j++) {
+    y[j] = H::put(H::get(y[j]) + a * x[j]);
+  }
+}
+
+template <class H>
+__attribute__((target("avx2,fma,f16c"))) void axpyFromHalfAvx2(
+    real a, const uint16_t* x, real* y, int64_t n) {
+  const __m256 va = _mm256_set1_ps(a);
+  int64_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    _mm256_storeu_ps(y + j,
+                     _mm256_fmadd_ps(va, H::load(x + j), _mm256_loadu_ps(y + j)));
+  }
+  for (; j < n; j++) {
+    y[j] += a * H::get(x[j]);
+  }
+}
+
+template <class H>
+__attribute__((target("avx2,fma,f16c"))) void dotRowsHalfAvx2(
+    const uint16_t* A, int64_t n, const int32_t* rows, int64_t k,
+    const real* x, real* out) {
+  int64_t i = 0;
+  for (; i + 4 <= k; i += 4) {
+    const uint16_t* r0 = A + rows[i] * n;
+    const uint16_t* r1 = A + rows[i + 1] * n;
+    const uint16_t* r2 = A + rows[i + 2] * n;
+    const uint16_t* r3 = A + rows[i + 3] * n;
+    __m256 s0 = _mm256_setzero_ps();
+    __m256 s1 = _mm256_setzero_ps();
+    __m256 s2 = _mm256_setzero_ps();
+    __m256 s3 = _mm256_setzero_ps();
+    int64_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+      const __m256 vx = _mm256_loadu_ps(x + j);
+      s0 = _mm256_fmadd_ps(H::load(r0 + j), vx, s0);
+      s1 = _mm256_fmadd_ps(H::load(r1 + j), vx, s1);
+      s2 = _mm256_fmadd_ps(H::load(r2 + j), vx, s2);
+      s3 = _mm256_fmadd_ps(H::load(r3 + j), vx, s3);
+    }
+    real d0 = hsumAvx2(s0), d1 = hsumAvx2(s1);
+    real d2 = hsumAvx2(s2), d3 = hsumAvx2(s3);
+    for (; j < n; j++) {
+      d0 += H::get(r0[j]) * x[j];
+      d1 += H::get(r1[j]) * x[j];
+      d2 += H::get(r2[j]) * x[j];
+      d3 += H::get(r3[j]) * x[j];
+    }
+    out[i] = d0;
+    out[i + 1] = d1;
+    out[i + 2] = d2;
+    out[i + 3] = d3;
+  }
+  for (; i < k; i++) {
+    out[i] = dotHalfAvx2<H>(A + rows[i] * n, x, n);
+  }
+}
+
+template <class H>
+__attribute__((target("avx2,f16c"))) void toHalfAvx2(const real* x,
+                                                     uint16_t* y, int64_t n) {
+  int64_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    H::store(y + j, _mm256_loadu_ps(x + j));
+  }
+  for (; j < n; j++) {
+    y[j] = H::put(x[j]);
+  }
+}
+
+template <class H>
+__attribute__((target("avx2,f16c"))) void fromHalfAvx2(const uint16_t* x,
+                                                       real* y, int64_t n) {
+  int64_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    _mm256_storeu_ps(y + j, H::load(x + j));
+  }
+  for (; j < n; j++) {
+    y[j] = H::get(x[j]);
+  }
+}
+
+#endif
+
+struct half_kernel_table_t {
+  real (*dot)(const uint16_t*, const real*, int64_t);
+  void (*axpy)(real, const real*, uint16_t*, int64_t);
+  void (*axpyFrom)(real, const uint16_t*, real*, int64_t);
+  void (*dotRows)(const uint16_t*, int64_t, const int32_t*, int64_t,
+                  const real*, real*);
+  void (*toHalf)(const real*, uint16_t*, int64_t);
+  void (*fromHalf)(const uint16_t*, real*, int64_t);
+};
+
+template <class H>
+half_kernel_table_t halfScalar() {
+  half_kernel_table_t t = {dotHalfScalar<H>,     axpyHalfScalar<H>,
+                           axpyFromHalfScalar<H>, dotRowsHalfScalar<H>,
+                           toHalfScalar<H>,      fromHalfScalar<H>};
+  return t;
+}
+
+#ifdef FASTTEXT_X86_KERNELS
+template <class H>
+half_kernel_table_t halfAvx2() {
+  half_kernel_table_t t = {dotHalfAvx2<H>,     axpyHalfAvx2<H>,
+                           axpyFromHalfAvx2<H>, dotRowsHalfAvx2<H>,
+                           toHalfAvx2<H>,      fromHalfAvx2<H>};
+  return t;
+}
+#endif
+
+struct kernel_table_t {
+  const char* name;
+  real (*dot)(const real*, const real*, int64_t);
+  void (*axpy)(real, const real*, real*, int64_t);
+  void (*add)(const real*, real*, int64_t);
+  void (*dotRows)(const real*, int64_t, const int32_t*, int64_t, const real*,
+                  real*);
+  half_kernel_table_t bf16;
+  half_kernel_table_t fp16;
+};
+
+kernel_table_t selectKernels() {
+  kernel_table_t scalar = {"scalar",      dotScalar,
+                           axpyScalar,    addScalar,
+                           dotRowsScalar, halfScalar<bf16_codec>(),
+                           halfScalar<fp16_codec>()};
+#ifdef FASTTEXT_X86_KERNELS
+  // every AVX2 part also has F16C, which the half-precision kernels need
+  __builtin_cpu_init();
+  bool has_avx2 = __builtin_cpu_supports("avx2") &&
+                  __builtin_cpu_supports("fma") &&
+                  __builtin_cpu_supports("f16c");
+  bool has_avx512 = has_avx2 && __builtin_cpu_supports("avx512f");
+
+  kernel_table_t avx2 = {"avx2",        dotAvx2,
+                         axpyAvx2,      addAvx2,
+                         dotRowsAvx2,   halfAvx2<bf16_codec>(),
+                         halfAvx2<fp16_codec>()};
+  kernel_table_t avx512 = {"avx512",      dotAvx512,
+                           axpyAvx512,    addAvx512,
+                           dotRowsAvx512, halfAvx2<bf16_codec>(),
+                           halfAvx2<fp16_codec>()};
+
+  const char* forced = getenv("FASTTEXT_KERNELS");
+  if (forced != nullptr) {
+    if (strcmp(forced, "scalar") == 0) return scalar;
+    if (strcmp(forced, "avx2") == 0 && has_avx2) return avx2;
+    if (strcmp(forced, "avx512") == 0 && has_avx512) return avx512;
+  }
+  if (has_avx512) return avx512;
+  if (has_avx2) return avx2;
+#endif
+  return scalar;
+}
+
+const kernel_table_t table = selectKernels();
+
+}  // namespace
+
+real dot(const real* x, const real* y, int64_t n) { return table.dot(x, y, n); }
+
+void axpy(real a, const real* x, real* y, int64_t n) { table.axpy(a, x, y, n); }
+
+void add(const real* x, real* y, int64_t n) { table.add(x, y, n); }
+
+void dotRows(const real* A, int64_t n, const int32_t* rows, int64_t k,
+             const real* x, real* out) {
+  table.dotRows(A, n, rows, k, x, out);
+}
+
+static const half_kernel_table_t& half(storage_name storage) {
+  return storage == storage_name::fp16 ? table.fp16 : table.bf16;
+}
+
+real dotHalf(storage_name storage, const uint16_t* x, const real* y,
+             int64_t n) {
+  return half(storage).dot(x, y, n);
+}
+
+void axpyHalf(storage_name storage, real a, const real* x, uint16_t* y,
+              int64_t n) {
+  half(storage).axpy(a, x, y, n);
+}
+
+void axpyFromHalf(storage_name storage, real a, const uint16_t* x, real* y,
+                  int64_t n) {
+  half(storage).axpyFrom(a, x, y, n);
+}
+
+void dotRowsHalf(storage_name storage, const uint16_t* A, int64_t n,
+                 const int32_t* rows, int64_t k, const real* x, real* out) {
+  half(storage).dotRows(A, n, rows, k, x, out);
+}
+
+void toHalf(storage_name storage, const real* x, uint16_t* y, int64_t n) {
+  half(storage).toHalf(x, y, n);
+}
+
+void fromHalf(storage_name storage, const uint16_t* x, real* y, int64_t n) {
+  half(storage).fromHalf(x, y, n);
+}
+
+const char* name() { return table.name; }
+
+}  // namespace kernels
+
+}  // namespace fasttext
@@ -0,0 +1,60 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#ifndef FASTTEXT_KERNELS_H
+#define FASTTEXT_KERNELS_H
+
+#include <cstdint>
+
+#include "real.h"
+
+namespace fasttext {
+
+namespace kernels {
+
+// Row kernels used by Matrix and Vector. The implementation (AVX-512,
+// AVX2/FMA or scalar) is picked once at startup from CPUID, so a single
+// binary runs at full speed on every host. FASTTEXT_KERNELS=scalar|avx2|avx512
+// in the environment forces a particular one.
+
+// returns sum_j x[j] * y[j]
+real dot(const real*, const real*, int64_t);
+// y += a * x
+void axpy(real, const real*, real*, int64_t);
+// y += x
+void add(const real*, real*, int64_t);
+// out[i] = dot(A + rows[i] * n, x) for i < k: a small blocked product of
+// the selected rows of a row-major matrix with one vector
+void dotRows(const real*, int64_t, const int32_t*, int64_t, const real*, real*);
+
+// The same kernels over half-precision rows (storage_name::bf16 or fp16).
+// Rows are widened to real on load and rounded to nearest even on store;
+// products and sums are always accumulated in real.
+
+// returns sum_j x[j] * y[j] for a half row x
+real dotHalf(storage_name, const uint16_t*, const real*, int64_t);
+// half row y += a * x
+void axpyHalf(storage_name, real, const real*, uint16_t*, int64_t);
+// y += a * x for a half row x
+void axpyFromHalf(storage_name, real, const uint16_t*, real*, int64_t);
+// dotRows over a row-major half matrix
+void dotRowsHalf(storage_name, const uint16_t*, int64_t, const int32_t*,
+                 int64_t, const real*, real*);
+void toHalf(storage_name, const real*, uint16_t*, int64_t);
+void fromHalf(storage_name, const uint16_t*, real*, int64_t);
+
+const char* name();
+
+}  // namespace kernels
+
+}  // namespace fasttext
+
+#endif
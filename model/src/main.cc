@@ -12,7 +12,9 @@
 #include <iostream>
 
 #include "args.h"
+#include "cooc.h"
 #include "fasttext.h"
+#include "vocab.h"
 
 using namespace fasttext;
 
@@ -27,6 +29,12 @@ void printUsage() {
       << "  skipgram            train a skipgram model\n"
       << "  cbow                train a cbow model\n"
       << "  print-vectors       print vectors given a trained model\n"
+      << "  build-vocab         count the word frequencies of a corpus\n"
+      << "  build-cooc          count windowed word co-occurrences\n"
+      << "  tokenize            convert a corpus to word ids for training\n"
+      << "  quantize            compress a model's input rows for serving\n"
+      << "  build-index         build a nearest-neighbour index of words\n"
+      << "  nn-query            query nearest neighbours of words on stdin\n"
       << std::endl;
 }
 
@@ -59,6 +67,61 @@ void printPrintLexemsUsage() {
             << std::endl;
 }
 
+void printTokenizeUsage() {
+  std::cout << "usage: fasttext tokenize -input <corpus> -output <prefix> "
+               "<dictionary args>\n\n"
+            << "  <corpus>     text corpus (if -, read from stdin)\n"
+            << "  <prefix>     writes <prefix>.tok, pass it as -input to train\n"
+            << std::endl;
+}
+
+void printBuildVocabUsage() {
+  std::cout << "usage: fasttext build-vocab -input <corpus> -output <prefix> "
+               "[-maxVocab <n>] [-minLength <n>] [-skipLatin 0|1] "
+               "[-vocabMemory <MB>] [-thread <n>]\n\n"
+            << "  <corpus>     text corpus or .manifest (if -, read from "
+               "stdin)\n"
+            << "  <prefix>     writes <prefix>.vocab, pass it as "
+               "-dict_vocab_freq_path\n"
+            << std::endl;
+}
+
+void printBuildCoocUsage() {
+  std::cout << "usage: fasttext build-cooc -input <corpus> -output <prefix> "
+               "[-ws <n>] [-minCount <n>] [-vocabMemory <MB>] [-thread <n>] "
+               "<dictionary args>\n\n"
+            << "  <corpus>     text corpus or .manifest (if -, read from "
+               "stdin)\n"
+            << "  <prefix>     writes <prefix>.cooc, pass it as "
+               "-context_cooccurences_path\n"
+            << "  get_context_scores.pl counted words with -minCount 21\n"
+            << std::endl;
+}
+
+void printQuantizeUsage() {
+  std::cout << "usage: fasttext quantize -input <model> -output <prefix> "
+               "[-quant pq|int8] [-dsub <n>] <dictionary args>\n\n"
+            << "  <model>      trained model filename\n"
+            << "  <prefix>     writes <prefix>.ftz, which print-vectors reads\n"
+            << std::endl;
+}
+
+void printBuildIndexUsage() {
+  std::cout << "usage: fasttext build-index -input <model> -output <prefix> "
+               "[-hnswM <m>] [-efConstruction <ef>] <dictionary args>\n\n"
+            << "  <model>      trained or quantized model filename\n"
+            << "  <prefix>     writes <prefix>.hnsw, which nn-query reads\n"
+            << std::endl;
+}
+
+void printNNQueryUsage() {
+  std::cout << "usage: fasttext nn-query <index> [<k>] [-ef <ef>]\n\n"
+            << "  <index>      index filename written by build-index\n"
+            << "  <k>          (optional; 10 by default) neighbours per word\n"
+            << "  reads query words from stdin\n"
+            << std::endl;
+}
+
 void test(int argc, char** argv) {
   int32_t k;
   if (argc == 4) {
@@ -125,7 +188,9 @@ void printVectors(int argc, char** argv) {
   std::shared_ptr<Args> a = std::make_shared<Args>();
   a->parseArgs(argc, argv);
   FastText fasttext;
-  fasttext.loadModel(std::string(argv[2]), a);
+  if (!fasttext.mapModel(std::string(argv[2]), a)) {
+    fasttext.loadModel(std::string(argv[2]), a);
+  }
   fasttext.printVectors();
   exit(0);
 }
@@ -141,6 +206,81 @@ void printLexems(int argc, char** argv) {
   exit(0);
 }
 
+void tokenize(int argc, char** argv) {
+  std::shared_ptr<Args> a = std::make_shared<Args>();
+  a->parseArgs(argc, argv);
+  if (a->input.empty() || a->output.empty()) {
+    printTokenizeUsage();
+    exit(EXIT_FAILURE);
+  }
+  FastText fasttext;
+  fasttext.tokenize(a);
+  exit(0);
+}
+
+void buildVocab(int argc, char** argv) {
+  std::shared_ptr<Args> a = std::make_shared<Args>();
+  a->parseArgs(argc, argv);
+  if (a->input.empty() || a->output.empty()) {
+    printBuildVocabUsage();
+    exit(EXIT_FAILURE);
+  }
+  VocabCounter::build(*a);
+  exit(0);
+}
+
+void buildCooc(int argc, char** argv) {
+  std::shared_ptr<Args> a = std::make_shared<Args>();
+  a->parseArgs(argc, argv);
+  if (a->input.empty() || a->output.empty()) {
+    printBuildCoocUsage();
+    exit(EXIT_FAILURE);
+  }
+  Dictionary dict(a);
+  CoocCounter::build(*a, dict);
+  exit(0);
+}
+
+void quantize(int argc, char** argv) {
+  std::shared_ptr<Args> a = std::make_shared<Args>();
+  a->parseArgs(argc, argv);
+  if (a->input.empty() || a->output.empty()) {
+    printQuantizeUsage();
+    exit(EXIT_FAILURE);
+  }
+  FastText fasttext;
+  fasttext.quantize(a);
+  exit(0);
+}
+
+void buildIndex(int argc, char** argv) {
+  std::shared_ptr<Args> a = std::make_shared<Args>();
+  a->parseArgs(argc, argv);
+  if (a->input.empty() || a->output.empty()) {
+    printBuildIndexUsage();
+    exit(EXIT_FAILURE);
+  }
+  FastText fasttext;
+  fasttext.buildIndex(a);
+  exit(0);
+}
+
+void nnQuery(int argc, char** argv) {
+  if (argc < 3) {
+    printNNQueryUsage();
+    exit(EXIT_FAILURE);
+  }
+  int32_t k = 10;
+  if (argc > 3 && argv[3][0] != '-') {
+    k = atoi(argv[3]);
+  }
+  std::shared_ptr<Args> a = std::make_shared<Args>();
+  a->parseArgs(argc, argv);
+  FastText fasttext;
+  fasttext.nnQuery(std::string(argv[2]), k, a);
+  exit(0);
+}
+
 void train(int argc, char** argv) {
   std::shared_ptr<Args> a = std::make_shared<Args>();
   a->parseArgs(argc, argv);
@@ -160,6 +300,18 @@ int main(int argc, char** argv) {
     test(argc, argv);
   } else if (command == "print-vectors") {
     printVectors(argc, argv);
+  } else if (command == "build-vocab") {
+    buildVocab(argc, argv);
+  } else if (command == "build-cooc") {
+    buildCooc(argc, argv);
+  } else if (command == "tokenize") {
+    tokenize(argc, argv);
+  } else if (command == "quantize") {
+    quantize(argc, argv);
+  } else if (command == "build-index") {
+    buildIndex(argc, argv);
+  } else if (command == "nn-query") {
+    nnQuery(argc, argv);
   } else if (command == "print-lexems") {
     printLexems(argc, argv);
   } else if (command == "predict" || command == "predict-prob") {
@@ -13,44 +13,128 @@
 
 #include <assert.h>
 #include <random>
+#include <string.h>
+#include <vector>
 
+#include "kernels.h"
 #include "utils.h"
 #include "vector.h"
 
 namespace fasttext {
 
+const int64_t Matrix::ALIGNMENT;
+
 Matrix::Matrix() {
   m_ = 0;
   n_ = 0;
   data_ = nullptr;
+  half_ = nullptr;
+  storage_ = storage_name::fp32;
 }
 
-Matrix::Matrix(int64_t m, int64_t n) {
+Matrix::Matrix(int64_t m, int64_t n, storage_name storage) {
   m_ = m;
   n_ = n;
-  data_ = new real[m * n];
+  data_ = nullptr;
+  half_ = nullptr;
+  storage_ = storage;
+  if (storage == storage_name::fp32) {
+    data_ = new real[m * n];
+  } else {
+    half_ = new uint16_t[m * n];
+  }
 }
 
-Matrix::Matrix(const Matrix& other) {
-  m_ = other.m_;
-  n_ = other.n_;
-  data_ = new real[m_ * n_];
-  for (int64_t i = 0; i < (m_ * n_); i++) {
-    data_[i] = other.data_[i];
+Matrix::Matrix(const Matrix& other) : Matrix(other.m_, other.n_, other.storage_) {
+  if (isHalf()) {
+    memcpy(half_, other.half_, m_ * n_ * sizeof(uint16_t));
+  } else {
+    for (int64_t i = 0; i < (m_ * n_); i++) {
+      data_[i] = other.data_[i];
+    }
   }
 }
 
 Matrix& Matrix::operator=(const Matrix& other) {
   Matrix temp(other);
-  m_ = temp.m_;
-  n_ = temp.n_;
-  std::swap(data_, temp.data_);
+  swap(temp);
   return *this;
 }
 
-Matrix::~Matrix() { delete[] data_; }
+void Matrix::swap(Matrix& other) {
+  std::swap(m_, other.m_);
+  std::swap(n_, other.n_);
+  std::swap(data_, other.data_);
+  std::swap(half_, other.half_);
+  std::swap(storage_, other.storage_);
+  std::swap(mapping_, other.mapping_);
+}
+
+Matrix::~Matrix() { release(); }
+
+void Matrix::release() {
+  if (!mapping_) {
+    delete[] data_;
+    delete[] half_;
+  }
+  mapping_.reset();
+  data_ = nullptr;
+  half_ = nullptr;
+}
+
+int64_t Matrix::elementSize() const {
+  return isHalf() ? sizeof(uint16_t) : sizeof(real);
+}
+
+void Matrix::getRow(int64_t i, real* out) const {
+  assert(i >= 0);
+  assert(i < m_);
+  if (isHalf()) {
+    kernels::fromHalf(storage_, half_ + i * n_, out, n_);
+  } else {
+    memcpy(out, data_ + i * n_, n_ * sizeof(real));
+  }
+}
+
+void Matrix::setRow(int64_t i, const real* in) {
+  assert(i >= 0);
+  assert(i < m_);
+  if (isHalf()) {
+    kernels::toHalf(storage_, in, half_ + i * n_, n_);
+  } else {
+    memcpy(data_ + i * n_, in, n_ * sizeof(real));
+  }
+}
+
+void Matrix::copyRows(const Matrix& from, int64_t begin, int64_t end) {
+  assert(from.m_ == m_ && from.n_ == n_ && from.storage_ == storage_);
+  assert(0 <= begin && begin <= end && end <= m_);
+  if (isHalf()) {
+    memcpy(half_ + begin * n_, from.half_ + begin * n_,
+           (end - begin) * n_ * sizeof(uint16_t));
+  } else {
+    memcpy(data_ + begin * n_, from.data_ + begin * n_,
+           (end - begin) * n_ * sizeof(real));
+  }
+}
+
+void Matrix::setStorage(storage_name storage) {
+  if (storage == storage_) return;
+  Matrix converted(m_, n_, storage);
+  std::vector<real> row(n_);
+  for (int64_t i = 0; i < m_; i++) {
+    getRow(i, row.data());
+    converted.setRow(i, row.data());
+  }
+  swap(converted);
+}
 
 void Matrix::zero() {
+  if (isHalf()) {
+    // +0.0 is all zero bits in both half formats
+    memset(half_, 0, m_ * n_ * sizeof(uint16_t));
+    return;
+  }
   for (int64_t i = 0; i < (m_ * n_); i++) {
     data_[i] = 0.0;
   }
@@ -59,6 +143,16 @@ void Matrix::zero() {
 void Matrix::uniform(real a) {
   std::minstd_rand rng(1);
   std::uniform_real_distribution<> uniform(-a, a);
+  if (isHalf()) {
+    std::vector<real> row(n_);
+    for (int64_t i = 0; i < m_; i++) {
+      for (int64_t j = 0; j < n_; j++) {
+        row[j] = uniform(rng);
+      }
+      setRow(i, row.data());
+    }
+    return;
+  }
   for (int64_t i = 0; i < (m_ * n_); i++) {
     data_[i] = uniform(rng);
   }
@@ -69,12 +163,27 @@ void Matrix::uniform(real a) {
 void Matrix::mulRow(int64_t i, real a) {
   assert(i >= 0);
   assert(i < m_);
+  if (isHalf()) {
+    std::vector<real> row(n_);
+    getRow(i, row.data());
+    for (int64_t j = 0; j < n_; j++) {
+      row[j] *= a;
+    }
+    setRow(i, row.data());
+    return;
+  }
   for (int64_t j = 0; j < n_; j++) {
     data_[i * n_ + j] *= a;
   }
 }
 
 void Matrix::mulMatrix(const real a) {
+  if (isHalf()) {
+    for (int64_t i = 0; i < m_; i++) {
+      mulRow(i, a);
+    }
+    return;
+  }
   for (int64_t i = 0; i < (m_ * n_); ++i) {
     data_[i] *= a;
   }
@@ -82,6 +191,16 @@ void Matrix::mulMatrix(const real a) {
 
 real Matrix::max() const {
   real a = 0;
+  if (isHalf()) {
+    std::vector<real> row(n_);
+    for (int64_t i = 0; i < m_; i++) {
+      getRow(i, row.data());
+      for (int64_t j = 0; j < n_; j++) {
+        if (row[j] > a) a = row[j];
+      }
+    }
+    return a;
+  }
   for (int64_t i = 0; i < (m_ * n_); ++i) {
     if (data_[i] > a) a = data_[i];
   }
@@ -92,6 +211,10 @@ void Matrix::normalizeRow(int64_t i) {
   assert(i >= 0);
   assert(i < m_);
   real norm = rowNorm(i);
+  if (isHalf()) {
+    mulRow(i, 1.0 / norm);
+    return;
+  }
   for (int64_t j = 0; j < n_; j++) data_[i * n_ + j] /= norm;
 }
 
@@ -99,6 +222,12 @@ real Matrix::rowNorm(int64_t i) const {
   assert(i >= 0);
   assert(i < m_);
   real norm = 1e-10;
+  if (isHalf()) {
+    std::vector<real> row(n_);
+    getRow(i, row.data());
+    norm += kernels::dot(row.data(), row.data(), n_);
+    return pow(norm, 0.5);
+  }
   for (int64_t j = 0; j < n_; j++)
     norm += data_[i * n_ + j] * data_[i * n_ + j];
   return pow(norm, 0.5);
@@ -108,8 +237,16 @@ void Matrix::addRow(const Vector& vec, int64_t i, real a) {
   assert(i >= 0);
   assert(i < m_);
   assert(vec.m_ == n_);
-  for (int64_t j = 0; j < n_; j++) {
-    data_[i * n_ + j] += a * vec.data_[j];
+  addRow(vec.data_, i, a);
+}
+
+void Matrix::addRow(const real* vec, int64_t i, real a) {
+  assert(i >= 0);
+  assert(i < m_);
+  if (isHalf()) {
+    kernels::axpyHalf(storage_, a, vec, half_ + i * n_, n_);
+  } else {
+    kernels::axpy(a, vec, data_ + i * n_, n_);
   }
 }
 
@@ -117,27 +254,126 @@ real Matrix::dotRow(const Vector& vec, int64_t i) {
   assert(i >= 0);
   assert(i < m_);
   assert(vec.m_ == n_);
-  real d = 0.0;
-  real div = 1.0;  //(rowNorm(i) * vec.norm());
-  for (int64_t j = 0; j < n_; j++) {
-    d += (data_[i * n_ + j] * vec.data_[j] / div);
-    //	if (d > 1e6) d /= div;
+  if (isHalf()) {
+    return kernels::dotHalf(storage_, half_ + i * n_, vec.data_, n_);
   }
-  return d;
+  return kernels::dot(data_ + i * n_, vec.data_, n_);
 }
 
+void Matrix::dotRows(const int32_t* rows, int64_t k, const Vector& vec,
+                     real* out) const {
+  assert(vec.m_ == n_);
+  if (isHalf()) {
+    kernels::dotRowsHalf(storage_, half_, n_, rows, k, vec.data_, out);
+  } else {
+    kernels::dotRows(data_, n_, rows, k, vec.data_, out);
+  }
+}
+
+// The headerless layout predates half storage and is always fp32.
 void Matrix::save(std::ostream& out) {
   out.write((char*)&m_, sizeof(int64_t));
   out.write((char*)&n_, sizeof(int64_t));
+  if (isHalf()) {
+    std::vector<real> row(n_);
+    for (int64_t i = 0; i < m_; i++) {
+      getRow(i, row.data());
+      out.write((char*)row.data(), n_ * sizeof(real));
+    }
+    return;
+  }
   out.write((char*)data_, m_ * n_ * sizeof(real));
 }
 
 void Matrix::load(std::istream& in) {
   in.read((char*)&m_, sizeof(int64_t));
   in.read((char*)&n_, sizeof(int64_t));
-  delete[] data_;
+  release();
+  storage_ = storage_name::fp32;
   data_ = new real[m_ * n_];
   in.read((char*)data_, m_ * n_ * sizeof(real));
 }
 
+int64_t Matrix::alignedPadding(int64_t pos) {
+  return (Matrix::ALIGNMENT - pos % Matrix::ALIGNMENT) % Matrix::ALIGNMENT;
+}
+
+static bool validStorage(int32_t storage) {
+  return storage >= int32_t(storage_name::fp32) &&
+         storage <= int32_t(storage_name::fp16);
+}
+
+void Matrix::writeAligned(std::ostream& out, const void* data, int64_t size) {
+  char zeros[ALIGNMENT];
+  memset(zeros, 0, sizeof(zeros));
+  out.write((const char*)data, size);
+  out.write(zeros, alignedPadding(out.tellp()));
+}
+
+void Matrix::saveAligned(std::ostream& out) {
+  char zeros[ALIGNMENT];
+  memset(zeros, 0, sizeof(zeros));
+  int32_t storage = int32_t(storage_);
+  out.write((char*)&m_, sizeof(int64_t));
+  out.write((char*)&n_, sizeof(int64_t));
+  out.write((char*)&storage, sizeof(int32_t));
+  out.write(zeros, alignedPadding(out.tellp()));
+  if (isHalf()) {
+    writeAligned(out, half_, m_ * n_ * sizeof(uint16_t));
+  } else {
+    writeAligned(out, data_, m_ * n_ * sizeof(real));
+  }
+}
+
+void Matrix::loadAligned(std::istream& in) {
+  char skip[ALIGNMENT];
+  int64_t m, n;
+  int32_t storage;
+  in.read((char*)&m, sizeof(int64_t));
+  in.read((char*)&n, sizeof(int64_t));
+  in.read((char*)&storage, sizeof(int32_t));
+  if (!in || m < 0 || n < 0 || !validStorage(storage)) {
+    in.setstate(std::ios::failbit);
+    return;
+  }
+  in.read(skip, alignedPadding(in.tellg()));
+  Matrix loaded(m, n, storage_name(storage));
+  in.read((char*)(loaded.isHalf() ? (void*)loaded.half_ : (void*)loaded.data_),
+          m * n * loaded.elementSize());
+  in.read(skip, alignedPadding(in.tellg()));
+  swap(loaded);
+}
+
+// Points the matrix at the aligned section starting at offset inside the
+// mapping, nothing is copied. Returns the offset of the next section, or -1
+// if the section does not fit in the file.
+int64_t Matrix::map(std::shared_ptr<utils::MappedFile> file, int64_t offset) {
+  const int64_t fields = 2 * sizeof(int64_t) + sizeof(int32_t);
+  if (offset < 0 || offset + fields > file->size()) return -1;
+  int64_t m, n;
+  int32_t storage;
+  memcpy(&m, file->data() + offset, sizeof(int64_t));
+  memcpy(&n, file->data() + offset + sizeof(int64_t), sizeof(int64_t));
+  memcpy(&storage, file->data() + offset + 2 * sizeof(int64_t),
+         sizeof(int32_t));
+  if (!validStorage(storage)) return -1;
+  offset += fields;
+  offset += alignedPadding(offset);
+  int64_t size = storage_name(storage) == storage_name::fp32 ? sizeof(real)
+                                                              : sizeof(uint16_t);
+  int64_t end = offset + m * n * size;
+  if (m < 0 || n < 0 || end > file->size()) return -1;
+  release();
+  mapping_ = file;
+  m_ = m;
+  n_ = n;
+  storage_ = storage_name(storage);
+  if (storage_ == storage_name::fp32) {
+    data_ = (real*)(file->data() + offset);
+  } else {
+    half_ = (uint16_t*)(file->data() + offset);
+  }
+  return end + alignedPadding(end);
+}
+
 }  // namespace fasttext
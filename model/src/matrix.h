@@ -14,22 +14,35 @@
 
 #include <cstdint>
 #include <istream>
+#include <memory>
 #include <ostream>
 
 #include "real.h"
+#include "utils.h"
 
 namespace fasttext {
 
 class Vector;
 
 class Matrix {
+ private:
+  std::shared_ptr<utils::MappedFile> mapping_;
+
+  void release();
+  void swap(Matrix&);
+
  public:
+  static const int64_t ALIGNMENT = 64;
+
+  // fp32 rows live in data_, bf16/fp16 rows in half_; the other one is null
   real* data_;
+  uint16_t* half_;
+  storage_name storage_;
   int64_t m_;
   int64_t n_;
 
   Matrix();
-  Matrix(int64_t, int64_t);
+  Matrix(int64_t, int64_t, storage_name = storage_name::fp32);
   Matrix(const Matrix&);
   Matrix& operator=(const Matrix&);
   ~Matrix();
@@ -40,12 +53,35 @@ class Matrix {
   void normalizeRow(int64_t);
   real rowNorm(int64_t i) const;
   real dotRow(const Vector&, int64_t);
+  void dotRows(const int32_t*, int64_t, const Vector&, real*) const;
   real max() const;
   void addRow(const Vector&, int64_t, real);
+  void addRow(const real*, int64_t, real);
   void mulMatrix(const real);
 
+  bool isHalf() const { return half_ != nullptr; }
+  int64_t elementSize() const;
+  // copies row i out as real, or overwrites it, whatever the storage
+  void getRow(int64_t, real*) const;
+  void setRow(int64_t, const real*);
+  // copies rows [begin, end) as stored from a matrix of the same shape and
+  // storage
+  void copyRows(const Matrix&, int64_t, int64_t);
+  // converts the rows in place to another storage
+  void setStorage(storage_name);
+
   void save(std::ostream&);
   void load(std::istream&);
+
+  // aligned layout: m, n, storage (int32), padding up to ALIGNMENT, data,
+  // padding. Files older than the storage field have zeros there: fp32.
+  static int64_t alignedPadding(int64_t);
+  // writes size bytes of data and zeros up to the next ALIGNMENT boundary
+  static void writeAligned(std::ostream&, const void*, int64_t);
+  void saveAligned(std::ostream&);
+  void loadAligned(std::istream&);
+  int64_t map(std::shared_ptr<utils::MappedFile>, int64_t);
+  bool isMapped() const { return mapping_ != nullptr; }
 };
 
 }  // namespace fasttext
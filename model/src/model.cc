@@ -13,14 +13,19 @@
 
 #include <assert.h>
 #include <algorithm>
+#include <sstream>
+
+#include "kernels.h"
+#include "utils.h"
 
 namespace fasttext {
 
 Model::Model(std::shared_ptr<Matrix> wi, std::shared_ptr<Matrix> wo,
              std::shared_ptr<Args> args, std::shared_ptr<Dictionary> dict,
              int32_t seed)
-    : hidden_(args->dim),
-      output_(wo->m_),
+    : wi_grad_(args->dim),
+      wo_grad_(args->dim),
+      hidden_(args->dim),
       grad_(args->dim),
       dict_(dict),
       rng(seed) {
@@ -32,16 +37,16 @@ Model::Model(std::shared_ptr<Matrix> wi, std::shared_ptr<Matrix> wo,
   hsz_ = args->dim;
   negpos = 0;
   loss_ = 0.0;
-  prev_loss_ = 0.0;
-  nexamples_ = 1;
-  nexamples_batch = 0;
-  initSigmoid();
-  initLog();
-}
-
-Model::~Model() {
-  delete[] t_sigmoid;
-  delete[] t_log;
+  loss_samples_ = 0;
+  loss_countdown_ = 1;
+  nexamples_ = 0;
+  was_.reserve(args->neg + 1);
+  shared_negatives_.reserve(args->neg);
+  window_rows_.reserve(2 * args->ws + args->neg);
+  window_pos_.reserve(2 * args->ws + args->neg);
+  window_scores_.reserve(2 * args->ws + args->neg);
+  t_sigmoid = initSigmoid();
+  t_log = initLog();
 }
 
 void Model::normalizeModel() {
@@ -57,13 +62,13 @@ void Model::normalizeModel() {
 }
 
 void Model::doGradientStep() {
-  state_buffer_.applyWO(*wo_);
-  state_buffer_.applyWI(*wi_);
+  wo_grad_.apply(*wo_, false);
+  wi_grad_.apply(*wi_, false);
 }
 
 void Model::doGradientStepMean() {
-  state_buffer_.applyMeanWO(*wo_);
-  state_buffer_.applyMeanWI(*wi_);
+  wo_grad_.apply(*wo_, true);
+  wi_grad_.apply(*wi_, true);
 }
 
 real Model::binaryLogistic(const int32_t target, bool label, const real lr,
@@ -77,8 +82,7 @@ real Model::binaryLogistic(const int32_t target, bool label, const real lr,
   if (!use_buffer) {
     wo_->addRow(hidden_, target, alpha);
   } else {
-    state_buffer_.addWO(hidden_, target, alpha);
-    //  state_buffer_.applyWO(*wo_);
+    wo_grad_.add(target, hidden_, alpha);
   }
 
   if (label) {
@@ -91,17 +95,17 @@ real Model::binaryLogistic(const int32_t target, bool label, const real lr,
 real Model::negativeSampling(const int32_t target, const real lr,
                              bool use_buff) {
   real loss = 0.0;
-  std::vector<int32_t> was;
+  was_.clear();
   for (int32_t n = 0; n <= args_->neg;) {
     if (n == 0) {
       loss += binaryLogistic(target, true, lr, use_buff);
-      was.push_back(target);
+      was_.push_back(target);
       n++;
     } else {
       int32_t negative = getNegative(target);
-      if (std::find(was.begin(), was.end(), negative) == was.end()) {
+      if (std::find(was_.begin(), was_.end(), negative) == was_.end()) {
         loss += binaryLogistic(getNegative(target), false, lr, use_buff);
-        was.push_back(negative);
+        was_.push_back(negative);
         n++;
       }
     }
@@ -109,11 +113,10 @@ real Model::negativeSampling(const int32_t target, const real lr,
   return loss;
 }
 
-void Model::computeHidden(const std::vector<int32_t>& input,
-                          Vector& hidden) const {
+void Model::computeHidden(const lexem_span_t& input, Vector& hidden) const {
   assert(hidden.size() == hsz_);
   hidden.zero();
-  for (auto it = input.cbegin(); it != input.cend(); ++it) {
+  for (auto it = input.begin(); it != input.end(); ++it) {
     hidden.addRow(*wi_, *it);
   }
   hidden.mul(1.0 / input.size());
@@ -124,53 +127,195 @@ bool Model::comparePairs(const std::pair<real, int32_t>& l,
   return l.first > r.first;
 }
 
-void Model::update(const std::vector<int32_t>& input, const int32_t target,
+void Model::update(const lexem_span_t& input, const int32_t target,
                    const real lr, const bool use_buff) {
   assert(target >= 0);
   assert(target < osz_);
   if (input.size() == 0) return;
   computeHidden(input, hidden_);
   grad_.zero();
-  loss_ += negativeSampling(target, lr, use_buff);
+  sampleLoss(negativeSampling(target, lr, use_buff), 1);
   nexamples_ += 1;
-  nexamples_batch += 1;
 
-  for (auto it = input.cbegin(); it != input.cend(); ++it) {
+  for (auto it = input.begin(); it != input.end(); ++it) {
     if (!use_buff) {
       wi_->addRow(grad_, *it, 1.0);
     } else {
-      state_buffer_.addWI(grad_, *it, 1.0);
-      //	state_buffer_.applyWI(*wi_);
+      wi_grad_.add(*it, grad_, 1.0);
+    }
+  }
+}
+
+void Model::drawSharedNegatives(const std::vector<int32_t>& targets) {
+  shared_negatives_.clear();
+  int64_t attempts = 0;
+  while (shared_negatives_.size() < args_->neg &&
+         attempts++ < 100 * (args_->neg + 1)) {
+    int32_t negative = (*negatives)[negpos];
+    negpos = (negpos + 1) % negatives->size();
+    if (std::find(targets.begin(), targets.end(), negative) == targets.end() &&
+        std::find(shared_negatives_.begin(), shared_negatives_.end(),
+                  negative) == shared_negatives_.end()) {
+      shared_negatives_.push_back(negative);
     }
   }
 }
 
-void Model::setTargetCounts(const std::vector<lexem_ns_record>& counts) {
-  if (args_->loss == loss_name::ns) {
-    initTableNegatives(counts);
+// Scores every target of the window and the shared negatives against one
+// hidden vector with a single blocked product. Each negative row gets the
+// negative-label gradient once per target, as if it had been drawn for each.
+void Model::updateWindow(const lexem_span_t& input,
+                         const std::vector<int32_t>& targets, const real lr) {
+  if (input.size() == 0 || targets.size() == 0) return;
+  computeHidden(input, hidden_);
+  grad_.zero();
+
+  window_rows_.clear();
+  window_pos_.clear();
+  for (size_t i = 0; i < targets.size(); ++i) {
+    assert(targets[i] >= 0);
+    assert(targets[i] < osz_);
+    auto it = std::find(window_rows_.begin(), window_rows_.end(), targets[i]);
+    if (it == window_rows_.end()) {
+      window_rows_.push_back(targets[i]);
+      window_pos_.push_back(1);
+    } else {
+      window_pos_[it - window_rows_.begin()]++;
+    }
+  }
+  for (size_t i = 0; i < shared_negatives_.size(); ++i) {
+    window_rows_.push_back(shared_negatives_[i]);
+    window_pos_.push_back(0);
+  }
+  window_scores_.resize(window_rows_.size());
+  wo_->dotRows(window_rows_.data(), window_rows_.size(), hidden_,
+               window_scores_.data());
+
+  const int32_t ntargets = targets.size();
+  real loss = 0.0;
+  for (size_t i = 0; i < window_rows_.size(); ++i) {
+    real score = sigmoid(window_scores_[i]);
+    int32_t npos = window_pos_[i];
+    int32_t nneg = npos > 0 ? 0 : ntargets;
+    real alpha = lr * (npos * (1.0 - score) - nneg * score);
+    grad_.addRow(*wo_, window_rows_[i], alpha);
+    wo_->addRow(hidden_, window_rows_[i], alpha);
+    loss -= npos * log(score) + nneg * log(1.0 - score);
+  }
+  sampleLoss(loss, ntargets);
+  nexamples_ += ntargets;
+
+  for (auto it = input.begin(); it != input.end(); ++it) {
+    wi_->addRow(grad_, *it, 1.0);
+  }
+}
+
+SparseGradient::SparseGradient(int64_t dim) : dim_(dim) {
+  table_.assign(64, -1);
+}
+
+// slot of row, created (zeroed) on first use
+int32_t SparseGradient::slot(int32_t row) {
+  if (2 * (rows_.size() + 1) > table_.size()) grow();
+  const size_t mask = table_.size() - 1;
+  size_t pos = (uint32_t(row) * 2654435761u) & mask;
+  while (table_[pos] >= 0) {
+    if (rows_[table_[pos]] == row) return table_[pos];
+    pos = (pos + 1) & mask;
   }
+  const int32_t s = rows_.size();
+  table_[pos] = s;
+  rows_.push_back(row);
+  positions_.push_back(pos);
+  counts_.push_back(0);
+  data_.resize((s + 1) * dim_);
+  std::fill(data_.begin() + s * dim_, data_.end(), 0.0);
+  return s;
 }
 
-void Model::initTableNegatives(const std::vector<lexem_ns_record>& counts) {
+void SparseGradient::grow() {
+  table_.assign(2 * table_.size(), -1);
+  const size_t mask = table_.size() - 1;
+  for (size_t s = 0; s < rows_.size(); s++) {
+    size_t pos = (uint32_t(rows_[s]) * 2654435761u) & mask;
+    while (table_[pos] >= 0) pos = (pos + 1) & mask;
+    table_[pos] = s;
+    positions_[s] = pos;
+  }
+}
+
+void SparseGradient::add(int32_t row, const Vector& vec, real alpha) {
+  assert(vec.size() == dim_);
+  const int32_t s = slot(row);
+  counts_[s]++;
+  kernels::axpy(alpha, vec.data_, data_.data() + s * dim_, dim_);
+}
+
+void SparseGradient::apply(Matrix& m, bool mean) {
+  for (size_t s = 0; s < rows_.size(); s++) {
+    real scale = mean ? 1.0 / counts_[s] : 1.0;
+    m.addRow(data_.data() + s * dim_, rows_[s], scale);
+    table_[positions_[s]] = -1;
+  }
+  rows_.clear();
+  positions_.clear();
+  counts_.clear();
+}
+
+NegativeTable::NegativeTable(const std::vector<lexem_ns_record>& counts,
+                             std::minstd_rand& rng) {
   real z = 0.0;
   for (size_t i = 0; i < counts.size(); ++i) {
     z += pow(counts[i].cnt, POW_DISCARD);
   }
+  table_.reserve(TABLE_SIZE);
   for (size_t i = 0; i < counts.size(); ++i) {
     real c = pow(counts[i].cnt, POW_DISCARD);
-    int64_t cnt = (c / z) * NEGATIVE_TABLE_SIZE;
+    int64_t cnt = (c / z) * TABLE_SIZE;
     for (size_t j = 0; j < cnt; ++j) {
-      negatives.push_back(counts[i].h);
+      table_.push_back(counts[i].h);
     }
   }
-  std::shuffle(negatives.begin(), negatives.end(), rng);
+  std::shuffle(table_.begin(), table_.end(), rng);
+}
+
+void Model::setNegatives(std::shared_ptr<const NegativeTable> table) {
+  negatives = table;
+  if (negatives && negatives->size() > 0) {
+    std::uniform_int_distribution<size_t> offset(0, negatives->size() - 1);
+    negpos = offset(rng);
+  }
+}
+
+void Model::saveState(std::ostream& out) const {
+  std::ostringstream rng_state;
+  rng_state << rng;
+  utils::writeString(out, rng_state.str());
+  utils::writePod(out, int64_t(negpos));
+  utils::writePod(out, loss_);
+  utils::writePod(out, loss_samples_);
+  utils::writePod(out, loss_countdown_);
+  utils::writePod(out, nexamples_);
+}
+
+void Model::loadState(std::istream& in) {
+  std::string rng_state;
+  utils::readString(in, rng_state);
+  std::istringstream(rng_state) >> rng;
+  int64_t pos = 0;
+  utils::readPod(in, pos);
+  negpos = pos;
+  utils::readPod(in, loss_);
+  utils::readPod(in, loss_samples_);
+  utils::readPod(in, loss_countdown_);
+  utils::readPod(in, nexamples_);
 }
 
 int32_t Model::getNegative(const int32_t target) {
   int32_t negative;
   do {
-    negative = negatives[negpos];
-    negpos = (negpos + 1) % negatives.size();
+    negative = (*negatives)[negpos];
+    negpos = (negpos + 1) % negatives->size();
   } while (target == negative);
   //  } while (target == negative || dict_->isWordsCorrelated(target,
   //  negative));
@@ -179,32 +324,39 @@ int32_t Model::getNegative(const int32_t target) {
   return negative;
 }
 
-long_real Model::getLoss() {
-  if (nexamples_batch > 0) {
-    prev_loss_ = ((long_real)(nexamples_ - nexamples_batch) / (nexamples_)) *
-                     prev_loss_ +
-                 loss_ / nexamples_;
-    nexamples_batch = 0;
-    loss_ = 0.0;
-  }
-  return prev_loss_;
-  return loss_ / nexamples_;
+void Model::sampleLoss(real loss, int32_t n) {
+  if (--loss_countdown_ > 0) return;
+  loss_countdown_ = LOSS_SAMPLE_RATE;
+  loss_ += loss;
+  loss_samples_ += n;
 }
 
-void Model::initSigmoid() {
-  t_sigmoid = new real[SIGMOID_TABLE_SIZE + 1];
-  for (int i = 0; i < SIGMOID_TABLE_SIZE + 1; i++) {
-    real x = real(i * 2 * MAX_SIGMOID) / SIGMOID_TABLE_SIZE - MAX_SIGMOID;
-    t_sigmoid[i] = 1.0 / (1.0 + std::exp(-x));
-  }
+real Model::getLoss() const {
+  return loss_samples_ > 0 ? loss_ / loss_samples_ : 0.0;
 }
 
-void Model::initLog() {
-  t_log = new real[LOG_TABLE_SIZE + 1];
-  for (int i = 0; i < LOG_TABLE_SIZE + 1; i++) {
-    real x = (real(i) + 1e-5) / LOG_TABLE_SIZE;
-    t_log[i] = std::log(x);
-  }
+const real* Model::initSigmoid() {
+  static const std::vector<real> table = [] {
+    std::vector<real> t(SIGMOID_TABLE_SIZE + 1);
+    for (int i = 0; i < SIGMOID_TABLE_SIZE + 1; i++) {
+      real x = real(i * 2 * MAX_SIGMOID) / SIGMOID_TABLE_SIZE - MAX_SIGMOID;
+      t[i] = 1.0 / (1.0 + std::exp(-x));
+    }
+    return t;
+  }();
+  return table.data();
+}
+
+const real* Model::initLog() {
+  static const std::vector<real> table = [] {
+    std::vector<real> t(LOG_TABLE_SIZE + 1);
+    for (int i = 0; i < LOG_TABLE_SIZE + 1; i++) {
+      real x = (real(i) + 1e-5) / LOG_TABLE_SIZE;
+      t[i] = std::log(x);
+    }
+    return t;
+  }();
+  return table.data();
 }
 
 real Model::log(real x) const {
@@ -41,55 +41,44 @@ struct Node {
 
 const real POW_DISCARD = 0.75;
 
-struct matrix_buffer_t {
-  Vector vector;
-  int32_t row;
-  real alpha;
-  matrix_buffer_t(const Vector& v, int32_t r, real a)
-      : vector(v), row(r), alpha(a) {}
-};
-
-struct StateBuffer {
-  std::vector<matrix_buffer_t> bufferWI, bufferWO;
-
-  void addWO(const Vector& vector, int32_t row, real alpha) {
-    bufferWO.push_back(matrix_buffer_t(vector, row, alpha));
-  }
-
-  void addWI(const Vector& vector, int32_t row, real alpha) {
-    bufferWI.push_back(matrix_buffer_t(vector, row, alpha));
-  }
+// Sparse gradient of one matrix for the synchronous update mode. Every
+// touched row gets a dense slot holding its summed update, found through a
+// small open-addressing table; apply() adds the sums (or their means) to the
+// matrix in one pass over the touched rows and resets the accumulator.
+class SparseGradient {
+ private:
+  int64_t dim_;
+  std::vector<int32_t> table_;
+  std::vector<int32_t> rows_;
+  std::vector<int32_t> positions_;
+  std::vector<int32_t> counts_;
+  std::vector<real> data_;
 
-  void applyBuffer(Matrix& m, std::vector<matrix_buffer_t>& buf) {
-    for (size_t i = 0; i < buf.size(); ++i) {
-      m.addRow(buf[i].vector, buf[i].row, buf[i].alpha);
-    }
-    buf.clear();
-  }
+  int32_t slot(int32_t);
+  void grow();
 
-  void applyMeanBuffer(Matrix& m, std::vector<matrix_buffer_t>& buf) {
-    std::map<int32_t, int32_t> c;
-    for (size_t i = 0; i < buf.size(); ++i) {
-      if (c.find(buf[i].row) == c.end()) {
-        c.insert(std::make_pair(buf[i].row, 1));
-      } else {
-        c[buf[i].row]++;
-      }
-    }
+ public:
+  explicit SparseGradient(int64_t);
 
-    for (size_t i = 0; i < buf.size(); ++i) {
-      m.addRow(buf[i].vector, buf[i].row, buf[i].alpha / c[buf[i].row]);
-    }
-    buf.clear();
-  }
+  void add(int32_t, const Vector&, real);
+  void apply(Matrix&, bool);
+  size_t size() const { return rows_.size(); }
+};
 
-  void applyWI(Matrix& m) { applyBuffer(m, bufferWI); }
+// Unigram^0.75 table of negative candidates. It is built and shuffled once
+// and shared read-only by every worker; each Model walks it from its own
+// random offset.
+class NegativeTable {
+ private:
+  std::vector<int32_t> table_;
 
-  void applyMeanWI(Matrix& m) { applyMeanBuffer(m, bufferWI); }
+ public:
+  static const int32_t TABLE_SIZE = 10 * 1000 * 1000;
 
-  void applyWO(Matrix& m) { applyBuffer(m, bufferWI); }
+  NegativeTable(const std::vector<lexem_ns_record>&, std::minstd_rand&);
 
-  void applyMeanWO(Matrix& m) { applyMeanBuffer(m, bufferWO); }
+  size_t size() const { return table_.size(); }
+  int32_t operator[](size_t i) const { return table_[i]; }
 };
 
 class Model {
@@ -97,38 +86,46 @@ class Model {
   std::shared_ptr<Matrix> wi_;
   std::shared_ptr<Matrix> wo_;
   std::shared_ptr<Args> args_;
-  StateBuffer state_buffer_;
+  SparseGradient wi_grad_;
+  SparseGradient wo_grad_;
   Vector hidden_;
-  Vector output_;
   Vector grad_;
   int32_t hsz_;
   int32_t isz_;
   int32_t osz_;
-  long_real loss_;
-  long_real prev_loss_;
+  // the loss is only accumulated for one update in LOSS_SAMPLE_RATE
+  double loss_;
+  int64_t loss_samples_;
+  int32_t loss_countdown_;
   int64_t nexamples_;
-  int64_t nexamples_batch;
-  real* t_sigmoid;
-  real* t_log;
+  const real* t_sigmoid;
+  const real* t_log;
   std::shared_ptr<Dictionary> dict_;
 
-  std::vector<int32_t> negatives;
+  std::shared_ptr<const NegativeTable> negatives;
   size_t negpos;
+  std::vector<int32_t> was_;
+
+  // shared negatives: one set per center word, scored with the window
+  std::vector<int32_t> shared_negatives_;
+  std::vector<int32_t> window_rows_;
+  std::vector<int32_t> window_pos_;
+  std::vector<real> window_scores_;
 
   static bool comparePairs(const std::pair<real, int32_t>&,
                            const std::pair<real, int32_t>&);
 
   int32_t getNegative(const int32_t);
+  void sampleLoss(real, int32_t);
 
-  void initSigmoid();
-  void initLog();
+  static const real* initSigmoid();
+  static const real* initLog();
 
-  static const int32_t NEGATIVE_TABLE_SIZE = 10 * 1000 * 1000;
+  static const int32_t LOSS_SAMPLE_RATE = 16;
 
  public:
   Model(std::shared_ptr<Matrix>, std::shared_ptr<Matrix>, std::shared_ptr<Args>,
         std::shared_ptr<Dictionary>, int32_t);
-  ~Model();
 
   real binaryLogistic(const int32_t, bool, const real, bool = false);
   real negativeSampling(const int32_t, const real, bool = false);
@@ -136,13 +133,21 @@ class Model {
   void doGradientStepMean();
 
   void normalizeModel();
-  void update(const std::vector<int32_t>&, const int32_t, const real,
-              bool = false);
-  void computeHidden(const std::vector<int32_t>&, Vector&) const;
-
-  void setTargetCounts(const std::vector<lexem_ns_record>&);
-  void initTableNegatives(const std::vector<lexem_ns_record>&);
-  long_real getLoss();
+  void update(const lexem_span_t&, const int32_t, const real, bool = false);
+  void drawSharedNegatives(const std::vector<int32_t>&);
+  void updateWindow(const lexem_span_t&, const std::vector<int32_t>&,
+                    const real);
+  void computeHidden(const lexem_span_t&, Vector&) const;
+
+  void setNegatives(std::shared_ptr<const NegativeTable>);
+  // the rng, the negative table position and the loss and update counters,
+  // so a resumed worker draws exactly what it would have
+  void saveState(std::ostream&) const;
+  void loadState(std::istream&);
+  real getLoss() const;
+  int64_t getUpdates() const { return nexamples_; }
+  double getLossSum() const { return loss_; }
+  int64_t getLossSamples() const { return loss_samples_; }
   real sigmoid(real) const;
   real log(real) const;
 
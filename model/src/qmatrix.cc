@@ -0,0 +1,282 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#include "qmatrix.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+namespace fasttext {
+
+const int32_t ProductQuantizer::KSUB;
+const int32_t ProductQuantizer::NITER;
+const int32_t ProductQuantizer::MAX_POINTS_PER_CLUSTER;
+
+ProductQuantizer::ProductQuantizer()
+    : dim_(0), dsub_(0), nsubq_(0), lastdsub_(0), centroids_(nullptr) {}
+
+void ProductQuantizer::init(int32_t dim, int32_t dsub) {
+  dim_ = dim;
+  dsub_ = std::min(std::max(dsub, 1), dim);
+  nsubq_ = (dim_ + dsub_ - 1) / dsub_;
+  lastdsub_ = dim_ - (nsubq_ - 1) * dsub_;
+  owned_.assign(centroidsSize(), 0.0);
+  centroids_ = owned_.data();
+}
+
+void ProductQuantizer::setCentroids(const real* centroids) {
+  owned_.clear();
+  owned_.shrink_to_fit();
+  centroids_ = centroids;
+}
+
+int32_t ProductQuantizer::nearest(const real* x, const real* c,
+                                  int32_t d) const {
+  int32_t best = 0;
+  real best_dist = std::numeric_limits<real>::max();
+  for (int32_t k = 0; k < KSUB; k++, c += d) {
+    real dist = 0.0;
+    for (int32_t j = 0; j < d; j++) {
+      dist += (x[j] - c[j]) * (x[j] - c[j]);
+    }
+    if (dist < best_dist) {
+      best_dist = dist;
+      best = k;
+    }
+  }
+  return best;
+}
+
+// Lloyd's iterations over n points of size d. An empty cluster takes over
+// half of the largest one, so every code stays in use.
+void ProductQuantizer::kmeans(const real* x, real* c, int64_t n, int32_t d,
+                              std::minstd_rand& rng) const {
+  std::vector<int64_t> perm(n);
+  std::iota(perm.begin(), perm.end(), 0);
+  std::shuffle(perm.begin(), perm.end(), rng);
+  for (int32_t k = 0; k < KSUB; k++) {
+    memcpy(c + k * d, x + perm[k % n] * d, d * sizeof(real));
+  }
+  std::vector<uint8_t> assigned(n);
+  std::vector<int64_t> count(KSUB);
+  for (int32_t iter = 0; iter < NITER; iter++) {
+    for (int64_t i = 0; i < n; i++) {
+      assigned[i] = nearest(x + i * d, c, d);
+    }
+    std::fill(c, c + KSUB * d, 0.0);
+    std::fill(count.begin(), count.end(), 0);
+    for (int64_t i = 0; i < n; i++) {
+      real* ci = c + assigned[i] * d;
+      for (int32_t j = 0; j < d; j++) ci[j] += x[i * d + j];
+      count[assigned[i]]++;
+    }
+    for (int32_t k = 0; k < KSUB; k++) {
+      if (count[k] == 0) continue;
+      for (int32_t j = 0; j < d; j++) c[k * d + j] /= count[k];
+    }
+    for (int32_t k = 0; k < KSUB; k++) {
+      if (count[k] > 0) continue;
+      int32_t m = std::max_element(count.begin(), count.end()) - count.begin();
+      const real eps = 1.0 / 1024;
+      for (int32_t j = 0; j < d; j++) {
+        c[k * d + j] = c[m * d + j] * (1 + eps);
+        c[m * d + j] *= (1 - eps);
+      }
+      count[k] = count[m] / 2;
+      count[m] -= count[k];
+    }
+  }
+}
+
+void ProductQuantizer::train(const Matrix& matrix, int32_t nthreads) {
+  assert(matrix.n_ == dim_);
+  std::minstd_rand rng(1);
+  const int64_t n = std::min(matrix.m_, int64_t(KSUB) * MAX_POINTS_PER_CLUSTER);
+  std::vector<int64_t> rows(matrix.m_);
+  std::iota(rows.begin(), rows.end(), 0);
+  std::shuffle(rows.begin(), rows.end(), rng);
+  std::vector<real> sample(n * dim_);
+  for (int64_t i = 0; i < n; i++) {
+    matrix.getRow(rows[i], sample.data() + i * dim_);
+  }
+  utils::parallelFor(nsubq_, nthreads, [&](int64_t q) {
+    const int32_t d = subSize(q);
+    std::vector<real> points(n * d);
+    for (int64_t i = 0; i < n; i++) {
+      memcpy(points.data() + i * d, sample.data() + i * dim_ + q * dsub_,
+             d * sizeof(real));
+    }
+    std::minstd_rand qrng(q + 1);
+    kmeans(points.data(), owned_.data() + q * KSUB * dsub_, n, d, qrng);
+  });
+}
+
+void ProductQuantizer::encode(const real* x, uint8_t* codes) const {
+  for (int32_t q = 0; q < nsubq_; q++) {
+    codes[q] = nearest(x + q * dsub_, centroid(q, 0), subSize(q));
+  }
+}
+
+void ProductQuantizer::addCode(const uint8_t* codes, real* y, real a) const {
+  for (int32_t q = 0; q < nsubq_; q++) {
+    const real* c = centroid(q, codes[q]);
+    real* yq = y + q * dsub_;
+    for (int32_t j = 0; j < subSize(q); j++) {
+      yq[j] += a * c[j];
+    }
+  }
+}
+
+QMatrix::QMatrix()
+    : quant_(quant_name::int8),
+      m_(0),
+      n_(0),
+      ncodes_(0),
+      scales_(nullptr),
+      codes_(nullptr) {}
+
+void QMatrix::quantize(const Matrix& matrix, quant_name quant, int32_t dsub,
+                       int32_t nthreads) {
+  mapping_.reset();
+  quant_ = quant;
+  m_ = matrix.m_;
+  n_ = matrix.n_;
+  owned_scales_.clear();
+  if (quant_ == quant_name::pq) {
+    pq_.init(n_, dsub);
+    pq_.train(matrix, nthreads);
+    ncodes_ = pq_.nsubq();
+  } else {
+    ncodes_ = n_;
+    owned_scales_.resize(m_);
+  }
+  owned_codes_.resize(m_ * ncodes_);
+
+  // rows are encoded in blocks, each block with its own row buffer
+  const int64_t block = 1024;
+  utils::parallelFor((m_ + block - 1) / block, nthreads, [&](int64_t b) {
+    std::vector<real> row(n_);
+    for (int64_t i = b * block; i < std::min(m_, (b + 1) * block); i++) {
+      matrix.getRow(i, row.data());
+      uint8_t* codes = owned_codes_.data() + i * ncodes_;
+      if (quant_ == quant_name::pq) {
+        pq_.encode(row.data(), codes);
+        continue;
+      }
+      real amax = 0.0;
+      for (int64_t j = 0; j < n_; j++) amax = std::max(amax, fabsf(row[j]));
+      real scale = amax > 0 ? amax / 127 : 1.0;
+      owned_scales_[i] = scale;
+      for (int64_t j = 0; j < n_; j++) {
+        codes[j] = uint8_t(int8_t(lrintf(row[j] / scale)));
+      }
+    }
+  });
+  scales_ = owned_scales_.data();
+  codes_ = owned_codes_.data();
+}
+
+void QMatrix::addRowTo(int64_t i, real* y, real a) const {
+  assert(i >= 0);
+  assert(i < m_);
+  const uint8_t* codes = codes_ + i * ncodes_;
+  if (quant_ == quant_name::pq) {
+    pq_.addCode(codes, y, a);
+    return;
+  }
+  const int8_t* q = (const int8_t*)codes;
+  const real s = a * scales_[i];
+  for (int64_t j = 0; j < n_; j++) {
+    y[j] += s * q[j];
+  }
+}
+
+int64_t QMatrix::size() const {
+  int64_t bytes = m_ * ncodes_;
+  if (quant_ == quant_name::pq) {
+    bytes += pq_.centroidsSize() * sizeof(real);
+  } else {
+    bytes += m_ * sizeof(real);
+  }
+  return bytes;
+}
+
+void QMatrix::save(std::ostream& out) {
+  int32_t quant = int32_t(quant_);
+  int32_t dsub = quant_ == quant_name::pq ? pq_.dsub() : 0;
+  utils::writePod(out, m_);
+  utils::writePod(out, n_);
+  utils::writePod(out, quant);
+  Matrix::writeAligned(out, &dsub, sizeof(dsub));
+  if (quant_ == quant_name::pq) {
+    Matrix::writeAligned(out, pq_.centroids(),
+                         pq_.centroidsSize() * sizeof(real));
+  } else {
+    Matrix::writeAligned(out, scales_, m_ * sizeof(real));
+  }
+  Matrix::writeAligned(out, codes_, m_ * ncodes_);
+}
+
+// Points the matrix at the sections starting at offset inside the mapping.
+// Returns the offset after them, or -1 if they do not fit in the file.
+int64_t QMatrix::map(std::shared_ptr<utils::MappedFile> file, int64_t offset) {
+  const int64_t fields = 2 * sizeof(int64_t) + 2 * sizeof(int32_t);
+  if (offset < 0 || offset + fields > file->size()) return -1;
+  int64_t m, n;
+  int32_t quant, dsub;
+  const char* p = file->data() + offset;
+  memcpy(&m, p, sizeof(int64_t));
+  memcpy(&n, p + sizeof(int64_t), sizeof(int64_t));
+  memcpy(&quant, p + 2 * sizeof(int64_t), sizeof(int32_t));
+  memcpy(&dsub, p + 2 * sizeof(int64_t) + sizeof(int32_t), sizeof(int32_t));
+  if (m < 0 || n <= 0) return -1;
+  if (quant != int32_t(quant_name::int8) && quant != int32_t(quant_name::pq)) {
+    return -1;
+  }
+  offset += fields;
+  offset += Matrix::alignedPadding(offset);
+
+  m_ = m;
+  n_ = n;
+  quant_ = quant_name(quant);
+  int64_t table;
+  if (quant_ == quant_name::pq) {
+    if (dsub <= 0) return -1;
+    pq_.init(n_, dsub);
+    ncodes_ = pq_.nsubq();
+    table = pq_.centroidsSize() * sizeof(real);
+  } else {
+    ncodes_ = n_;
+    table = m_ * sizeof(real);
+  }
+  int64_t codes = offset + table + Matrix::alignedPadding(offset + table);
+  int64_t end = codes + m_ * ncodes_;
+  if (end > file->size()) return -1;
+
+  owned_scales_.clear();
+  owned_codes_.clear();
+  mapping_ = file;
+  if (quant_ == quant_name::pq) {
+    pq_.setCentroids((const real*)(file->data() + offset));
+    scales_ = nullptr;
+  } else {
+    scales_ = (const real*)(file->data() + offset);
+  }
+  codes_ = (const uint8_t*)(file->data() + codes);
+  return end + Matrix::alignedPadding(end);
+}
+
+}  // namespace fasttext
@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#ifndef FASTTEXT_QMATRIX_H
+#define FASTTEXT_QMATRIX_H
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <random>
+#include <vector>
+
+#include "args.h"
+#include "matrix.h"
+#include "real.h"
+#include "utils.h"
+
+namespace fasttext {
+
+// Product quantizer: a row is cut into sub-vectors of dsub values (the last
+// one may be shorter) and every sub-vector is replaced by the index of the
+// nearest of KSUB centroids, learned by k-means on a sample of rows.
+class ProductQuantizer {
+ private:
+  int32_t dim_;
+  int32_t dsub_;
+  int32_t nsubq_;
+  int32_t lastdsub_;
+  std::vector<real> owned_;
+  const real* centroids_;
+
+  ProductQuantizer(const ProductQuantizer&);
+  ProductQuantizer& operator=(const ProductQuantizer&);
+
+  int32_t nearest(const real*, const real*, int32_t) const;
+  void kmeans(const real*, real*, int64_t, int32_t, std::minstd_rand&) const;
+
+ public:
+  static const int32_t KSUB = 256;
+  static const int32_t NITER = 25;
+  // rows sampled for training, per centroid
+  static const int32_t MAX_POINTS_PER_CLUSTER = 64;
+
+  ProductQuantizer();
+  // sets up zeroed codebooks for rows of dim values cut every dsub
+  void init(int32_t, int32_t);
+
+  int32_t nsubq() const { return nsubq_; }
+  int32_t dsub() const { return dsub_; }
+  int32_t subSize(int32_t q) const {
+    return q == nsubq_ - 1 ? lastdsub_ : dsub_;
+  }
+  const real* centroid(int32_t q, uint8_t c) const {
+    return centroids_ + q * KSUB * dsub_ + c * subSize(q);
+  }
+  int64_t centroidsSize() const { return int64_t(KSUB) * dim_; }
+  const real* centroids() const { return centroids_; }
+
+  void train(const Matrix&, int32_t);
+  void encode(const real*, uint8_t*) const;
+  // y += a * decode(codes)
+  void addCode(const uint8_t*, real*, real) const;
+  void setCentroids(const real*);
+};
+
+// Read-only quantized copy of a matrix, for serving. Rows are either int8
+// with one scale each (4x smaller than fp32) or product-quantized codes
+// (4 * dsub times smaller). Rows are never decompressed as a whole:
+// addRowTo accumulates a row into a real vector straight from its codes.
+class QMatrix {
+ private:
+  std::shared_ptr<utils::MappedFile> mapping_;
+  std::vector<real> owned_scales_;
+  std::vector<uint8_t> owned_codes_;
+
+ public:
+  quant_name quant_;
+  int64_t m_;
+  int64_t n_;
+  // code bytes per row
+  int64_t ncodes_;
+  const real* scales_;
+  const uint8_t* codes_;
+  ProductQuantizer pq_;
+
+  QMatrix();
+
+  void quantize(const Matrix&, quant_name, int32_t, int32_t);
+  // y += a * row i
+  void addRowTo(int64_t, real*, real) const;
+  // bytes of codes, scales and codebooks
+  int64_t size() const;
+
+  // aligned layout: m, n, quant (int32), dsub (int32), padding, then the
+  // scales (int8) or the centroids (pq) and the codes, each section padded
+  // to Matrix::ALIGNMENT
+  void save(std::ostream&);
+  int64_t map(std::shared_ptr<utils::MappedFile>, int64_t);
+};
+
+}  // namespace fasttext
+
+#endif
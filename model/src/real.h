@@ -17,6 +17,10 @@ namespace fasttext {
 typedef float real;
 typedef long double long_real;
 
+// How matrix rows are stored. Half-precision rows are widened to real for
+// every computation, so only storage and memory bandwidth shrink.
+enum class storage_name : int { fp32 = 0, bf16, fp16 };
+
 }  // namespace fasttext
 
 #endif
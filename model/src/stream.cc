@@ -0,0 +1,285 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#include "stream.h"
+
+#include <stdlib.h>
+
+#include <iostream>
+#include <random>
+
+namespace fasttext {
+
+BatchRing::BatchRing(int32_t capacity) : head_(0), tail_(0) {
+  uint64_t size = 1;
+  while (size < uint64_t(capacity)) size <<= 1;
+  cells_.reset(new cell_t[size]);
+  mask_ = size - 1;
+  for (uint64_t i = 0; i < size; i++) {
+    cells_[i].seq.store(i, std::memory_order_relaxed);
+    cells_[i].batch = nullptr;
+  }
+}
+
+bool BatchRing::push(token_batch_t* batch) {
+  uint64_t pos = head_.load(std::memory_order_relaxed);
+  while (true) {
+    cell_t& cell = cells_[pos & mask_];
+    const int64_t diff =
+        int64_t(cell.seq.load(std::memory_order_acquire)) - int64_t(pos);
+    if (diff == 0) {
+      if (head_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        cell.batch = batch;
+        cell.seq.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      // the cell still holds the batch pushed one lap ago
+      return false;
+    } else {
+      pos = head_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+bool BatchRing::pop(token_batch_t*& batch) {
+  uint64_t pos = tail_.load(std::memory_order_relaxed);
+  while (true) {
+    cell_t& cell = cells_[pos & mask_];
+    const int64_t diff =
+        int64_t(cell.seq.load(std::memory_order_acquire)) - int64_t(pos + 1);
+    if (diff == 0) {
+      if (tail_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        batch = cell.batch;
+        cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = tail_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+TokenStream::TokenStream(const Dictionary& dict, std::istream& in,
+                         int32_t nbatches, const std::string& spill_path)
+    : dict_(dict),
+      in_(in),
+      batches_(nbatches),
+      full_(nbatches),
+      free_(nbatches),
+      done_(false),
+      spill_path_(spill_path),
+      ntokens_(0),
+      nlines_(0) {
+  for (int32_t i = 0; i < nbatches; i++) {
+    batches_[i].ids.reserve(BATCH_IDS);
+    free_.push(&batches_[i]);
+  }
+}
+
+TokenStream::~TokenStream() { join(); }
+
+void TokenStream::start() {
+  if (!spill_path_.empty() && !spill_.open(spill_path_, dict_)) {
+    std::cerr << "Spill file " << spill_path_ << " cannot be opened!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  producer_ = std::thread([this]() { produce(); });
+}
+
+void TokenStream::produce() {
+  std::string token;
+  token_batch_t* batch = nullptr;
+  while (true) {
+    while (!free_.pop(batch)) std::this_thread::yield();
+    batch->ids.clear();
+    if (!TokenizedCorpus::readLines(dict_, in_, token, batch->ids,
+                                    BATCH_IDS)) {
+      free_.push(batch);
+      break;
+    }
+    for (size_t i = 0; i < batch->ids.size(); i++) {
+      if (batch->ids[i] == TokenizedCorpus::EOL) {
+        nlines_++;
+      } else {
+        ntokens_++;
+      }
+    }
+    if (!spill_path_.empty()) spill_.write(batch->ids);
+    // every batch fits in the ring, so this only spins on a race
+    while (!full_.push(batch)) std::this_thread::yield();
+  }
+  done_.store(true, std::memory_order_release);
+}
+
+void TokenStream::join() {
+  if (!producer_.joinable()) return;
+  producer_.join();
+  if (!spill_path_.empty() && !spill_.close()) {
+    std::cerr << "Error writing spill file " << spill_path_ << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+token_batch_t* TokenStream::pop() {
+  token_batch_t* batch = nullptr;
+  while (!full_.pop(batch)) {
+    // the last batch is pushed before done_ is set
+    if (done_.load(std::memory_order_acquire)) {
+      return full_.pop(batch) ? batch : nullptr;
+    }
+    std::this_thread::yield();
+  }
+  return batch;
+}
+
+void TokenStream::release(token_batch_t* batch) {
+  while (!free_.push(batch)) std::this_thread::yield();
+}
+
+LineQueue::LineQueue(int32_t capacity) : head_(0), tail_(0) {
+  uint64_t size = 1;
+  while (size < uint64_t(capacity)) size <<= 1;
+  slots_.reset(new line_batch_t*[size]);
+  mask_ = size - 1;
+}
+
+bool LineQueue::push(line_batch_t* batch) {
+  const uint64_t tail = tail_.load(std::memory_order_relaxed);
+  if (tail - head_.load(std::memory_order_acquire) > mask_) return false;
+  slots_[tail & mask_] = batch;
+  tail_.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+bool LineQueue::pop(line_batch_t*& batch) {
+  const uint64_t head = head_.load(std::memory_order_relaxed);
+  if (head == tail_.load(std::memory_order_acquire)) return false;
+  batch = slots_[head & mask_];
+  head_.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+LineReaders::channel_t::channel_t(int32_t nbatches)
+    : batches(nbatches), full(nbatches), free(nbatches), done(false) {
+  for (int32_t i = 0; i < nbatches; i++) {
+    batches[i].ids.reserve(BATCH_IDS + Dictionary::MAX_LINE_SIZE + 2);
+    free.push(&batches[i]);
+  }
+}
+
+LineReaders::LineReaders(const Dictionary& dict,
+                         std::shared_ptr<ChunkIndex> chunks,
+                         std::shared_ptr<ChunkScheduler> scheduler,
+                         int32_t nreaders, int32_t nworkers)
+    : dict_(dict), chunks_(chunks), scheduler_(scheduler), nreaders_(nreaders) {
+  for (int32_t w = 0; w < nworkers; w++) {
+    channels_.push_back(
+        std::unique_ptr<channel_t>(new channel_t(BATCHES_PER_WORKER)));
+  }
+}
+
+LineReaders::~LineReaders() { join(); }
+
+void LineReaders::start() {
+  for (int32_t r = 0; r < nreaders_; r++) {
+    threads_.push_back(std::thread([=]() { read(r); }));
+  }
+}
+
+void LineReaders::join() {
+  for (size_t r = 0; r < threads_.size(); r++) threads_[r].join();
+  threads_.clear();
+}
+
+void LineReaders::read(int32_t r) {
+  const int32_t nworkers = channels_.size();
+  std::minstd_rand rng(r);
+  ChunkReader reader(*chunks_);
+  std::istream text(&reader);
+  std::string token;
+  std::vector<int32_t> line;
+  line_batch_t* batch = nullptr;
+  int32_t target = r;
+  // the batches go round robin to the workers of this reader that have a
+  // free one
+  auto acquire = [&]() {
+    while (true) {
+      for (int32_t k = 0; k < nworkers; k += nreaders_) {
+        target += nreaders_;
+        if (target >= nworkers) target = r;
+        if (channels_[target]->free.pop(batch)) {
+          batch->ids.clear();
+          batch->ntokens.clear();
+          return;
+        }
+      }
+      std::this_thread::yield();
+    }
+  };
+  // the worker's queue holds its whole pool, so this only spins on a race
+  auto flush = [&]() {
+    while (!channels_[target]->full.push(batch)) std::this_thread::yield();
+    batch = nullptr;
+  };
+
+  int64_t item;
+  while (scheduler_->next(r, item)) {
+    const chunk_t& chunk = chunks_->chunk(item % chunks_->size());
+    int64_t pos = chunk.begin;
+    if (!chunks_->tokenized()) {
+      reader.load(chunk);
+      text.clear();
+    }
+    while (chunks_->tokenized() ? pos < chunk.end : !reader.done()) {
+      if (batch == nullptr) acquire();
+      int32_t ntokens;
+      if (chunks_->tokenized()) {
+        const TokenizedCorpus& corpus = chunks_->corpus(chunk.file);
+        ntokens = dict_.getLine(corpus.ids(), chunk.end, pos, line, rng);
+      } else {
+        ntokens = dict_.getLine(text, line, token, rng);
+      }
+      batch->ids.insert(batch->ids.end(), line.begin(), line.end());
+      batch->ids.push_back(TokenizedCorpus::EOL);
+      batch->ntokens.push_back(ntokens);
+      if (batch->ids.size() >= BATCH_IDS) flush();
+    }
+  }
+  if (batch != nullptr) flush();
+  for (int32_t w = r; w < nworkers; w += nreaders_) {
+    channels_[w]->done.store(true, std::memory_order_release);
+  }
+}
+
+line_batch_t* LineReaders::pop(int32_t worker) {
+  channel_t& channel = *channels_[worker];
+  line_batch_t* batch = nullptr;
+  while (!channel.full.pop(batch)) {
+    // the last batch is pushed before done is set
+    if (channel.done.load(std::memory_order_acquire)) {
+      return channel.full.pop(batch) ? batch : nullptr;
+    }
+    std::this_thread::yield();
+  }
+  return batch;
+}
+
+void LineReaders::release(int32_t worker, line_batch_t* batch) {
+  while (!channels_[worker]->free.push(batch)) std::this_thread::yield();
+}
+
+}  // namespace fasttext
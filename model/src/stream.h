@@ -0,0 +1,187 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#ifndef FASTTEXT_STREAM_H
+#define FASTTEXT_STREAM_H
+
+#include <atomic>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chunks.h"
+#include "corpus.h"
+#include "dictionary.h"
+
+namespace fasttext {
+
+// Whole lines in the tokenized corpus layout: word ids, every line ended by
+// TokenizedCorpus::EOL, words out of the vocabulary dropped.
+struct token_batch_t {
+  std::vector<int32_t> ids;
+};
+
+// Bounded lock-free queue of batches for any number of producers and
+// consumers (Vyukov's ring). Every cell carries a sequence number saying
+// whether it is free for the push or full for the pop at a given position,
+// so pushes and pops only contend on their own counter.
+class BatchRing {
+ private:
+  struct cell_t {
+    std::atomic<uint64_t> seq;
+    token_batch_t* batch;
+  };
+  std::unique_ptr<cell_t[]> cells_;
+  uint64_t mask_;
+  char padding0_[64];
+  std::atomic<uint64_t> head_;
+  char padding1_[64];
+  std::atomic<uint64_t> tail_;
+  char padding2_[64];
+
+  BatchRing(const BatchRing&);
+  BatchRing& operator=(const BatchRing&);
+
+ public:
+  // room for at least capacity batches
+  explicit BatchRing(int32_t);
+  // false if the ring is full or empty
+  bool push(token_batch_t*);
+  bool pop(token_batch_t*&);
+};
+
+// Training input from a stream that can be read only once, like stdin. A
+// producer thread tokenizes it into batches that the workers pop from one
+// ring and hand back through another, so a fixed pool of batches is reused
+// and the reader never runs more than the pool ahead of training. With a
+// spill path the ids also go to that file as a tokenized corpus, which the
+// epochs after the first are trained on.
+class TokenStream {
+ private:
+  const Dictionary& dict_;
+  std::istream& in_;
+  std::vector<token_batch_t> batches_;
+  BatchRing full_;
+  BatchRing free_;
+  std::atomic<bool> done_;
+  std::thread producer_;
+  std::string spill_path_;
+  TokenizedWriter spill_;
+  int64_t ntokens_;
+  int64_t nlines_;
+
+  TokenStream(const TokenStream&);
+  TokenStream& operator=(const TokenStream&);
+
+  void produce();
+
+ public:
+  // ids read into a batch before it is handed out, at a line end
+  static const size_t BATCH_IDS = 1 << 16;
+
+  TokenStream(const Dictionary&, std::istream&, int32_t, const std::string&);
+  ~TokenStream();
+
+  void start();
+  // waits until the input is read and the spill file is complete
+  void join();
+  // the next batch, waiting for the producer if needed; nullptr once the
+  // input is exhausted
+  token_batch_t* pop();
+  void release(token_batch_t*);
+
+  int64_t ntokens() const { return ntokens_; }
+  int64_t nlines() const { return nlines_; }
+};
+
+// Lines ready to train on: the words subsampling kept, every line ended by
+// TokenizedCorpus::EOL, and the tokens each line was read with, which the
+// lr schedule counts.
+struct line_batch_t {
+  std::vector<int32_t> ids;
+  std::vector<int32_t> ntokens;
+};
+
+// Lock-free queue of batches between exactly one producer and one consumer:
+// each side only writes its own index.
+class LineQueue {
+ private:
+  std::unique_ptr<line_batch_t*[]> slots_;
+  uint64_t mask_;
+  char padding0_[64];
+  std::atomic<uint64_t> head_;
+  char padding1_[64];
+  std::atomic<uint64_t> tail_;
+  char padding2_[64];
+
+  LineQueue(const LineQueue&);
+  LineQueue& operator=(const LineQueue&);
+
+ public:
+  // room for at least capacity batches
+  explicit LineQueue(int32_t);
+  // false if the queue is full or empty
+  bool push(line_batch_t*);
+  bool pop(line_batch_t*&);
+};
+
+// Reader threads in front of the workers, so that these only run SGD. Each
+// reader takes work items from the scheduler, reads their lines, looks them
+// up and subsamples them with its own rng. Worker w is fed by reader
+// w % nreaders through its own queue, and hands the emptied batches back
+// through a second one.
+class LineReaders {
+ private:
+  struct channel_t {
+    std::vector<line_batch_t> batches;
+    LineQueue full;
+    LineQueue free;
+    std::atomic<bool> done;
+
+    explicit channel_t(int32_t);
+  };
+
+  const Dictionary& dict_;
+  std::shared_ptr<ChunkIndex> chunks_;
+  std::shared_ptr<ChunkScheduler> scheduler_;
+  int32_t nreaders_;
+  std::vector<std::unique_ptr<channel_t>> channels_;
+  std::vector<std::thread> threads_;
+
+  LineReaders(const LineReaders&);
+  LineReaders& operator=(const LineReaders&);
+
+  void read(int32_t);
+
+ public:
+  static const int32_t BATCHES_PER_WORKER = 4;
+  // ids read into a batch before it is handed out, at a line end
+  static const size_t BATCH_IDS = 1 << 14;
+
+  // the scheduler hands out items to nreaders readers
+  LineReaders(const Dictionary&, std::shared_ptr<ChunkIndex>,
+              std::shared_ptr<ChunkScheduler>, int32_t, int32_t);
+  ~LineReaders();
+
+  void start();
+  void join();
+  // the worker's next batch, waiting for its reader if needed; nullptr once
+  // the reader has run out of items
+  line_batch_t* pop(int32_t);
+  void release(int32_t, line_batch_t*);
+};
+
+}  // namespace fasttext
+
+#endif
@@ -0,0 +1,225 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#include "telemetry.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <new>
+
+namespace fasttext {
+
+const int32_t Telemetry::POLL_MS;
+
+thread_counters_t::thread_counters_t()
+    : tokens(0), updates(0), loss_sum(0.0), loss_samples(0), idle(0.0) {}
+
+void thread_counters_t::publish(int64_t t, int64_t u, double ls, int64_t ln) {
+  tokens.store(t, std::memory_order_relaxed);
+  updates.store(u, std::memory_order_relaxed);
+  loss_sum.store(ls, std::memory_order_relaxed);
+  loss_samples.store(ln, std::memory_order_relaxed);
+}
+
+void thread_counters_t::publishIdle(double seconds) {
+  idle.store(seconds, std::memory_order_relaxed);
+}
+
+Telemetry::Telemetry(std::shared_ptr<Args> args, int32_t nthreads,
+                     int64_t total_tokens)
+    : args_(args),
+      nthreads_(nthreads),
+      total_tokens_(std::max(int64_t(1), total_tokens)),
+      counters_(nullptr),
+      global_tokens_(0),
+      readers_(0),
+      last_loss_(0.0),
+      last_print_loss_(0.0),
+      stopped_(false) {
+  void* p = nullptr;
+  if (posix_memalign(&p, 64, nthreads * sizeof(thread_counters_t)) != 0) {
+    throw std::bad_alloc();
+  }
+  counters_ = static_cast<thread_counters_t*>(p);
+  for (int32_t i = 0; i < nthreads; i++) {
+    new (counters_ + i) thread_counters_t();
+  }
+  if (args_->log_path != "") {
+    log_.open(args_->log_path);
+    if (!log_.is_open()) {
+      std::cerr << "Log file " << args_->log_path << " cannot be opened!"
+                << std::endl;
+    }
+  }
+}
+
+Telemetry::~Telemetry() {
+  stop();
+  for (int32_t i = 0; i < nthreads_; i++) {
+    counters_[i].~thread_counters_t();
+  }
+  free(counters_);
+}
+
+real Telemetry::progress() const {
+  real p = real(global_tokens_.load(std::memory_order_relaxed));
+  p /= total_tokens_;
+  return std::min(p, real(1.0));
+}
+
+real Telemetry::progress(int64_t tokens) const {
+  int64_t global = global_tokens_.load(std::memory_order_relaxed);
+  real p = real(std::max(global, tokens)) / total_tokens_;
+  return std::min(p, real(1.0));
+}
+
+void Telemetry::start() {
+  start_ = std::chrono::steady_clock::now();
+  // counters published before the start, like those of resumed workers,
+  // count towards the progress right away
+  std::vector<int64_t> threads(nthreads_);
+  global_tokens_.store(collect(threads).tokens, std::memory_order_relaxed);
+  last_log_ = snapshot_t();
+  last_print_ = snapshot_t();
+  monitor_ = std::thread([this]() { monitor(); });
+}
+
+void Telemetry::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopped_) return;
+    stopped_ = true;
+  }
+  wakeup_.notify_all();
+  if (monitor_.joinable()) monitor_.join();
+
+  std::vector<int64_t> threads(nthreads_);
+  snapshot_t s = collect(threads);
+  global_tokens_ = s.tokens;
+  if (args_->verbose > 0) {
+    printProgress(s, 0.0, true);
+    std::cerr << std::endl;
+  }
+  if (log_.is_open()) {
+    writeLog(s, threads, 0.0);
+    log_.close();
+  }
+}
+
+Telemetry::snapshot_t Telemetry::collect(std::vector<int64_t>& threads) const {
+  snapshot_t s;
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start_;
+  s.time = elapsed.count();
+  s.tokens = 0;
+  s.updates = 0;
+  s.loss_sum = 0.0;
+  s.loss_samples = 0;
+  s.idle = 0.0;
+  for (int32_t i = 0; i < nthreads_; i++) {
+    const thread_counters_t& c = counters_[i];
+    threads[i] = c.tokens.load(std::memory_order_relaxed);
+    s.tokens += threads[i];
+    s.updates += c.updates.load(std::memory_order_relaxed);
+    s.loss_sum += c.loss_sum.load(std::memory_order_relaxed);
+    s.loss_samples += c.loss_samples.load(std::memory_order_relaxed);
+    s.idle += c.idle.load(std::memory_order_relaxed);
+  }
+  return s;
+}
+
+void Telemetry::monitor() {
+  std::vector<int64_t> threads(nthreads_);
+  const double interval = std::max(0.0, args_->log_interval);
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopped_) {
+    wakeup_.wait_for(lock, std::chrono::milliseconds(POLL_MS));
+    if (stopped_) break;
+    snapshot_t s = collect(threads);
+    global_tokens_.store(s.tokens, std::memory_order_relaxed);
+    real lr = args_->lr * (1.0 - progress());
+    if (args_->verbose > 1) {
+      printProgress(s, lr, false);
+    }
+    if (log_.is_open() && s.time - last_log_.time >= interval) {
+      writeLog(s, threads, lr);
+    }
+  }
+}
+
+// loss over the sampled updates since the previous line
+static double windowLoss(double sum, int64_t samples, double fallback) {
+  return samples > 0 ? sum / samples : fallback;
+}
+
+void Telemetry::printProgress(const snapshot_t& s, real lr, bool final) {
+  real progress = final ? 1.0 : this->progress();
+  double wst = s.time > 0 ? s.tokens / s.time / nthreads_ : 0.0;
+  int eta = progress > 0 ? int(s.time / progress * (1 - progress)) : 0;
+  int etah = eta / 3600;
+  int etam = (eta - etah * 3600) / 60;
+  double loss = windowLoss(s.loss_sum - last_print_.loss_sum,
+                           s.loss_samples - last_print_.loss_samples,
+                           last_print_loss_);
+  last_print_ = s;
+  last_print_loss_ = loss;
+  std::cerr << std::fixed;
+  std::cerr << "\rProgress: " << std::setprecision(1) << 100 * progress << "%";
+  std::cerr << "  words/sec/thread: " << std::setprecision(0) << wst;
+  std::cerr << "  negatives: " << (args_->sharedNeg > 0 ? "shared" : "classic");
+  std::cerr << "  lr: " << std::setprecision(6) << lr;
+  std::cerr << "  loss: " << std::setprecision(6) << loss;
+  const int32_t readers = readers_.load(std::memory_order_relaxed);
+  if (readers > 0) {
+    double starved = s.time > 0 ? s.idle / s.time / nthreads_ : 0.0;
+    std::cerr << "  readers/workers: " << readers << "/" << nthreads_
+              << "  starved: " << std::setprecision(1) << 100 * starved << "%";
+  }
+  std::cerr << "  eta: " << etah << "h" << etam << "m ";
+  std::cerr << std::flush;
+}
+
+void Telemetry::writeLog(const snapshot_t& s,
+                         const std::vector<int64_t>& threads, real lr) {
+  double dt = s.time - last_log_.time;
+  double tps = dt > 0 ? (s.tokens - last_log_.tokens) / dt : 0.0;
+  double ups = dt > 0 ? (s.updates - last_log_.updates) / dt : 0.0;
+  double loss = windowLoss(s.loss_sum - last_log_.loss_sum,
+                           s.loss_samples - last_log_.loss_samples, last_loss_);
+  // spread of the per-thread token counts relative to their mean
+  int64_t lo = *std::min_element(threads.begin(), threads.end());
+  int64_t hi = *std::max_element(threads.begin(), threads.end());
+  double mean = double(s.tokens) / nthreads_;
+  double skew = mean > 0 ? (hi - lo) / mean : 0.0;
+  // share of the workers' time spent waiting for readers
+  double starved = dt > 0 ? (s.idle - last_log_.idle) / dt / nthreads_ : 0.0;
+
+  log_ << std::fixed << std::setprecision(3) << "{\"time\":" << s.time
+       << ",\"progress\":" << std::setprecision(6)
+       << real(s.tokens) / total_tokens_ << ",\"tokens\":" << s.tokens
+       << ",\"tokens_per_sec\":" << std::setprecision(1) << tps
+       << ",\"updates_per_sec\":" << ups << ",\"lr\":" << std::setprecision(6)
+       << lr << ",\"loss\":" << loss << ",\"skew\":" << std::setprecision(4)
+       << skew << ",\"readers\":" << readers_.load(std::memory_order_relaxed)
+       << ",\"starved\":" << starved << ",\"thread_tokens\":[";
+  for (int32_t i = 0; i < nthreads_; i++) {
+    log_ << (i > 0 ? "," : "") << threads[i];
+  }
+  log_ << "]}\n";
+  log_.flush();
+  last_log_ = s;
+  last_loss_ = loss;
+}
+
+}  // namespace fasttext
@@ -0,0 +1,115 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#ifndef FASTTEXT_TELEMETRY_H
+#define FASTTEXT_TELEMETRY_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "args.h"
+#include "real.h"
+
+namespace fasttext {
+
+// Counters of one worker. Only the owner writes them (relaxed stores of
+// running totals), the monitor only reads, and every worker has its own
+// cache line, so publishing costs the workers no contention.
+struct alignas(64) thread_counters_t {
+  std::atomic<int64_t> tokens;
+  std::atomic<int64_t> updates;
+  std::atomic<double> loss_sum;
+  std::atomic<int64_t> loss_samples;
+  // seconds spent waiting for batches from a reader
+  std::atomic<double> idle;
+
+  thread_counters_t();
+  void publish(int64_t, int64_t, double, int64_t);
+  void publishIdle(double);
+};
+
+// Training telemetry. A monitor thread wakes up every POLL_MS on a steady
+// clock, sums the worker counters, publishes the global progress the
+// workers derive their lr from, prints the progress line and appends a JSON
+// object per log interval to log_path.
+class Telemetry {
+ private:
+  struct snapshot_t {
+    double time;
+    int64_t tokens;
+    int64_t updates;
+    double loss_sum;
+    int64_t loss_samples;
+    double idle;
+  };
+
+  std::shared_ptr<Args> args_;
+  int32_t nthreads_;
+  int64_t total_tokens_;
+  thread_counters_t* counters_;
+
+  std::atomic<int64_t> global_tokens_;
+  std::atomic<int32_t> readers_;
+  std::chrono::steady_clock::time_point start_;
+  snapshot_t last_log_;
+  double last_loss_;
+  snapshot_t last_print_;
+  double last_print_loss_;
+  std::ofstream log_;
+
+  std::thread monitor_;
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  bool stopped_;
+
+  Telemetry(const Telemetry&);
+  Telemetry& operator=(const Telemetry&);
+
+  snapshot_t collect(std::vector<int64_t>&) const;
+  void monitor();
+  void printProgress(const snapshot_t&, real, bool);
+  void writeLog(const snapshot_t&, const std::vector<int64_t>&, real);
+
+ public:
+  static const int32_t POLL_MS = 100;
+
+  Telemetry(std::shared_ptr<Args>, int32_t, int64_t);
+  ~Telemetry();
+
+  thread_counters_t& counters(int32_t i) { return counters_[i]; }
+  real progress() const;
+  // the published progress, but never less than the caller's own tokens
+  // account for; a single worker thus gets an exact, repeatable schedule
+  real progress(int64_t) const;
+  // the tokens of all workers as of the last poll
+  int64_t tokens() const {
+    return global_tokens_.load(std::memory_order_relaxed);
+  }
+
+  // threads reading the input for the workers, 0 if each reads its own;
+  // shown with the share of time the workers starve waiting for them
+  void setReaders(int32_t n) { readers_.store(n, std::memory_order_relaxed); }
+
+  void start();
+  void stop();
+};
+
+}  // namespace fasttext
+
+#endif
@@ -11,12 +11,48 @@
 
 #include "utils.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
 #include <ios>
+#include <new>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef FASTTEXT_COUNT_ALLOCS
+static thread_local int64_t thread_alloc_count = 0;
+
+void* operator new(size_t size) {
+  thread_alloc_count++;
+  void* p = malloc(size ? size : 1);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+#endif
 
 namespace fasttext {
 
 namespace utils {
 
+int64_t allocCount() {
+#ifdef FASTTEXT_COUNT_ALLOCS
+  return thread_alloc_count;
+#else
+  return 0;
+#endif
+}
+
 int64_t size(std::ifstream& ifs) {
   ifs.seekg(std::streamoff(0), std::ios::end);
   return ifs.tellg();
@@ -27,6 +63,318 @@ void seek(std::ifstream& ifs, int64_t pos) {
   ifs.seekg(std::streampos(pos));
 }
 
+void parallelFor(int64_t n, int32_t nthreads,
+                 const std::function<void(int64_t)>& f) {
+  if (nthreads > n) nthreads = n;
+  if (nthreads <= 1) {
+    for (int64_t i = 0; i < n; i++) f(i);
+    return;
+  }
+  std::atomic<int64_t> next(0);
+  std::vector<std::thread> threads;
+  for (int32_t t = 0; t < nthreads; t++) {
+    threads.push_back(std::thread([&]() {
+      for (int64_t i = next++; i < n; i = next++) f(i);
+    }));
+  }
+  for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+}
+
+namespace {
+
+// ceil(log2(5^e)) for e > 0, and 1 for e = 0
+int32_t pow5bits(int32_t e) {
+  return int32_t((uint32_t(e) * 1217359) >> 19) + 1;
+}
+
+// floor(log10(2^e)) and floor(log10(5^e))
+int32_t log10Pow2(int32_t e) { return int32_t((uint32_t(e) * 78913) >> 18); }
+int32_t log10Pow5(int32_t e) { return int32_t((uint32_t(e) * 732923) >> 20); }
+
+// Ryu's multipliers for floats: the top 61 bits of 5^i, and 2^k / 5^i
+// rounded up to 59 bits. Computed once with 128-bit integers instead of
+// being pasted in as tables.
+struct float_pow5_t {
+  static const int32_t INV_BITCOUNT = 59;
+  static const int32_t BITCOUNT = 61;
+  uint64_t inv[31];
+  uint64_t pow[47];
+
+  float_pow5_t() {
+    unsigned __int128 p = 1;
+    for (int32_t i = 0; i < 47; i++) {
+      const int32_t bits = pow5bits(i);
+      pow[i] = bits > BITCOUNT ? uint64_t(p >> (bits - BITCOUNT))
+                               : uint64_t(p << (BITCOUNT - bits));
+      if (i < 31) {
+        // 2^128 / 5^i only fits as (2^128 - 1) / 5^i, with the same floor
+        const int32_t shift = bits - 1 + INV_BITCOUNT;
+        const unsigned __int128 num = shift < 128
+                                          ? (unsigned __int128)(1) << shift
+                                          : ~(unsigned __int128)(0);
+        inv[i] = uint64_t(num / p) + 1;
+      }
+      p *= 5;
+    }
+  }
+};
+
+const float_pow5_t float_pow5;
+
+uint32_t mulShift32(uint32_t m, uint64_t factor, int32_t shift) {
+  const uint64_t lo = uint64_t(m) * uint32_t(factor);
+  const uint64_t hi = uint64_t(m) * uint32_t(factor >> 32);
+  return uint32_t(((lo >> 32) + hi) >> (shift - 32));
+}
+
+bool multipleOfPowerOf5(uint32_t value, int32_t p) {
+  int32_t count = 0;
+  for (; value % 5 == 0; value /= 5) count++;
+  return count >= p;
+}
+
+bool multipleOfPowerOf2(uint32_t value, int32_t p) {
+  return (value & ((1u << p) - 1)) == 0;
+}
+
+// Shortest digits and decimal exponent of a finite, positive float given
+// by its raw exponent and mantissa fields, as in Ryu's f2d.
+void shortestDecimal(uint32_t exponent, uint32_t mantissa, uint32_t& digits,
+                     int32_t& e10) {
+  int32_t e2;
+  uint32_t m2;
+  if (exponent == 0) {
+    e2 = 1 - 127 - 23 - 2;
+    m2 = mantissa;
+  } else {
+    e2 = int32_t(exponent) - 127 - 23 - 2;
+    m2 = (1u << 23) | mantissa;
+  }
+  const bool acceptBounds = (m2 & 1) == 0;
+  const uint32_t mv = 4 * m2;
+  const uint32_t mp = 4 * m2 + 2;
+  const uint32_t mmShift = mantissa != 0 || exponent <= 1;
+  const uint32_t mm = 4 * m2 - 1 - mmShift;
+
+  uint32_t vr, vp, vm;
+  bool vmIsTrailingZeros = false;
+  bool vrIsTrailingZeros = false;
+  uint32_t lastRemovedDigit = 0;
+  if (e2 >= 0) {
+    const int32_t q = log10Pow2(e2);
+    e10 = q;
+    const int32_t k = float_pow5_t::INV_BITCOUNT + pow5bits(q) - 1;
+    const int32_t i = -e2 + q + k;
+    vr = mulShift32(mv, float_pow5.inv[q], i);
+    vp = mulShift32(mp, float_pow5.inv[q], i);
+    vm = mulShift32(mm, float_pow5.inv[q], i);
+    if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+      const int32_t l = float_pow5_t::INV_BITCOUNT + pow5bits(q - 1) - 1;
+      lastRemovedDigit =
+          mulShift32(mv, float_pow5.inv[q - 1], -e2 + q - 1 + l) % 10;
+    }
+    if (q <= 9) {
+      if (mv % 5 == 0) {
+        vrIsTrailingZeros = multipleOfPowerOf5(mv, q);
+      } else if (acceptBounds) {
+        vmIsTrailingZeros = multipleOfPowerOf5(mm, q);
+      } else {
+        vp -= multipleOfPowerOf5(mp, q);
+      }
+    }
+  } else {
+    const int32_t q = log10Pow5(-e2);
+    e10 = q + e2;
+    const int32_t i = -e2 - q;
+    const int32_t k = pow5bits(i) - float_pow5_t::BITCOUNT;
+    int32_t j = q - k;
+    vr = mulShift32(mv, float_pow5.pow[i], j);
+    vp = mulShift32(mp, float_pow5.pow[i], j);
+    vm = mulShift32(mm, float_pow5.pow[i], j);
+    if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+      j = q - 1 - (pow5bits(i + 1) - float_pow5_t::BITCOUNT);
+      lastRemovedDigit = mulShift32(mv, float_pow5.pow[i + 1], j) % 10;
+    }
+    if (q <= 1) {
+      vrIsTrailingZeros = true;
+      if (acceptBounds) {
+        vmIsTrailingZeros = mmShift == 1;
+      } else {
+        --vp;
+      }
+    } else if (q < 31) {
+      vrIsTrailingZeros = multipleOfPowerOf2(mv, q - 1);
+    }
+  }
+
+  // drop digits while the interval [vm, vp] still holds a shorter number
+  int32_t removed = 0;
+  if (vmIsTrailingZeros || vrIsTrailingZeros) {
+    while (vp / 10 > vm / 10) {
+      vmIsTrailingZeros &= vm % 10 == 0;
+      vrIsTrailingZeros &= lastRemovedDigit == 0;
+      lastRemovedDigit = vr % 10;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    if (vmIsTrailingZeros) {
+      while (vm % 10 == 0) {
+        vrIsTrailingZeros &= lastRemovedDigit == 0;
+        lastRemovedDigit = vr % 10;
+        vr /= 10;
+        vp /= 10;
+        vm /= 10;
+        removed++;
+      }
+    }
+    // round half to even when the exact value ends in 50...0
+    if (vrIsTrailingZeros && lastRemovedDigit == 5 && vr % 2 == 0) {
+      lastRemovedDigit = 4;
+    }
+    digits = vr + ((vr == vm && (!acceptBounds || !vmIsTrailingZeros)) ||
+                   lastRemovedDigit >= 5);
+  } else {
+    while (vp / 10 > vm / 10) {
+      lastRemovedDigit = vr % 10;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    digits = vr + (vr == vm || lastRemovedDigit >= 5);
+  }
+  e10 += removed;
+}
+
+}  // namespace
+
+int32_t formatFloat(float x, char* out) {
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  const uint32_t exponent = (bits >> 23) & 0xFF;
+  const uint32_t mantissa = bits & 0x7FFFFF;
+  char* p = out;
+  if (exponent == 0xFF && mantissa != 0) {
+    memcpy(p, "nan", 3);
+    return 3;
+  }
+  if (bits >> 31) *p++ = '-';
+  if (exponent == 0xFF) {
+    memcpy(p, "inf", 3);
+    return p - out + 3;
+  }
+  if (exponent == 0 && mantissa == 0) {
+    *p++ = '0';
+    return p - out;
+  }
+
+  uint32_t digits;
+  int32_t e10;
+  shortestDecimal(exponent, mantissa, digits, e10);
+  char buf[10];
+  int32_t n = 0;
+  for (; digits > 0; digits /= 10) buf[9 - n++] = '0' + digits % 10;
+  const char* d = buf + 10 - n;
+  // the value is 0.d * 10^point
+  const int32_t point = n + e10;
+  if (point > -4 && point <= 0) {
+    *p++ = '0';
+    *p++ = '.';
+    for (int32_t i = point; i < 0; i++) *p++ = '0';
+    memcpy(p, d, n);
+    p += n;
+  } else if (point > 0 && point <= 9) {
+    for (int32_t i = 0; i < std::max(n, point); i++) {
+      if (i == point) *p++ = '.';
+      *p++ = i < n ? d[i] : '0';
+    }
+  } else {
+    *p++ = d[0];
+    if (n > 1) {
+      *p++ = '.';
+      memcpy(p, d + 1, n - 1);
+      p += n - 1;
+    }
+    int32_t e = point - 1;
+    *p++ = 'e';
+    *p++ = e < 0 ? '-' : '+';
+    e = std::abs(e);
+    *p++ = '0' + e / 10;
+    *p++ = '0' + e % 10;
+  }
+  return p - out;
+}
+
+std::string fingerprint(const std::string& path) {
+  std::ostringstream key;
+  key << path;
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0) {
+    key << ' ' << st.st_size << ' ' << st.st_mtim.tv_sec << '.'
+        << st.st_mtim.tv_nsec;
+  }
+  return key.str();
+}
+
+void writeString(std::ostream& out, const std::string& s) {
+  writePod(out, int32_t(s.size()));
+  out.write(s.data(), s.size());
+}
+
+bool checkLength(std::istream& in, int64_t n, int64_t size) {
+  bool ok = n >= 0 && n <= std::numeric_limits<int64_t>::max() / size;
+  // short reads fail by themselves, only large lengths are worth the seeks
+  if (ok && n * size > (1 << 20)) {
+    const std::istream::pos_type pos = in.tellg();
+    if (pos != std::istream::pos_type(-1)) {
+      in.seekg(0, std::ios::end);
+      const std::istream::pos_type end = in.tellg();
+      in.seekg(pos);
+      ok = end != std::istream::pos_type(-1) && n * size <= end - pos;
+    }
+  }
+  if (!ok) in.setstate(std::ios::failbit);
+  return ok;
+}
+
+void readString(std::istream& in, std::string& s) {
+  int32_t n = 0;
+  readPod(in, n);
+  s.resize(in && checkLength(in, n, 1) ? n : 0);
+  in.read(&s[0], s.size());
+}
+
+MappedFile::MappedFile() : data_(nullptr), size_(0) {}
+
+MappedFile::~MappedFile() { close(); }
+
+bool MappedFile::open(const std::string& path) {
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+  void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) return false;
+  data_ = static_cast<char*>(p);
+  size_ = st.st_size;
+  return true;
+}
+
+void MappedFile::close() {
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+}
+
 }  // namespace utils
 
 }  // namespace fasttext
@@ -12,7 +12,13 @@
 #ifndef FASTTEXT_UTILS_H
 #define FASTTEXT_UTILS_H
 
+#include <cstdint>
 #include <fstream>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
 
 namespace fasttext {
 
@@ -21,6 +27,76 @@ namespace utils {
 int64_t size(std::ifstream&);
 void seek(std::ifstream&, int64_t);
 
+// Calls f(i) for every i in [0, n) from up to nthreads threads; indices are
+// handed out one by one, so uneven items balance themselves.
+void parallelFor(int64_t, int32_t, const std::function<void(int64_t)>&);
+
+// "path size mtime" of a file, or just the path if it cannot be stat'ed
+std::string fingerprint(const std::string&);
+
+// Writes the shortest decimal that reads back as exactly x (Ryu), plain or
+// with an exponent as printf's %g would pick, and returns its length. The
+// output is at most FLOAT_CHARS characters and not null-terminated.
+const int32_t FLOAT_CHARS = 16;
+int32_t formatFloat(float, char*);
+
+// Number of heap allocations made so far by the calling thread. Only counted
+// when built with -DFASTTEXT_COUNT_ALLOCS (make debug), otherwise always 0.
+int64_t allocCount();
+
+template <typename T>
+void writePod(std::ostream& out, const T& v) {
+  out.write((const char*)&v, sizeof(T));
+}
+
+template <typename T>
+void readPod(std::istream& in, T& v) {
+  in.read((char*)&v, sizeof(T));
+}
+
+template <typename T>
+void writeVector(std::ostream& out, const std::vector<T>& v) {
+  writePod(out, int64_t(v.size()));
+  out.write((const char*)v.data(), v.size() * sizeof(T));
+}
+
+// Whether a length read from in can be real: not negative and, when it is
+// large, no longer than what is left of a seekable stream. Otherwise in is
+// failed, so a corrupted length is reported like a truncated file instead
+// of allocating whatever it says.
+bool checkLength(std::istream&, int64_t, int64_t);
+
+template <typename T>
+void readVector(std::istream& in, std::vector<T>& v) {
+  int64_t n = 0;
+  readPod(in, n);
+  v.resize(in && checkLength(in, n, sizeof(T)) ? n : 0);
+  in.read((char*)v.data(), v.size() * sizeof(T));
+}
+
+void writeString(std::ostream&, const std::string&);
+void readString(std::istream&, std::string&);
+
+// Read-only memory mapping of a whole file. Pages are loaded on demand and
+// shared with every other process mapping the same file.
+class MappedFile {
+ private:
+  char* data_;
+  int64_t size_;
+
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  bool open(const std::string&);
+  void close();
+  const char* data() const { return data_; }
+  int64_t size() const { return size_; }
+};
+
 }  // namespace utils
 
 }  // namespace fasttext
@@ -16,7 +16,9 @@
 
 #include <iomanip>
 
+#include "kernels.h"
 #include "matrix.h"
+#include "qmatrix.h"
 
 namespace fasttext {
 
@@ -93,8 +95,10 @@ void Vector::addRow(const Matrix& A, int64_t i) {
   assert(i >= 0);
   assert(i < A.m_);
   assert(m_ == A.n_);
-  for (int64_t j = 0; j < A.n_; j++) {
-    data_[j] += A.data_[i * A.n_ + j];
+  if (A.isHalf()) {
+    kernels::axpyFromHalf(A.storage_, 1.0, A.half_ + i * A.n_, data_, A.n_);
+  } else {
+    kernels::add(A.data_ + i * A.n_, data_, A.n_);
   }
 }
 
@@ -102,14 +106,28 @@ void Vector::addRow(const Matrix& A, int64_t i, real a) {
   assert(i >= 0);
   assert(i < A.m_);
   assert(m_ == A.n_);
-  for (int64_t j = 0; j < A.n_; j++) {
-    data_[j] += a * A.data_[i * A.n_ + j];
+  if (A.isHalf()) {
+    kernels::axpyFromHalf(A.storage_, a, A.half_ + i * A.n_, data_, A.n_);
+  } else {
+    kernels::axpy(a, A.data_ + i * A.n_, data_, A.n_);
   }
 }
 
+void Vector::addRow(const QMatrix& A, int64_t i) {
+  assert(m_ == A.n_);
+  A.addRowTo(i, data_, 1.0);
+}
+
 void Vector::mul(const Matrix& A, const Vector& vec) {
   assert(A.m_ == m_);
   assert(A.n_ == vec.m_);
+  if (A.isHalf()) {
+    for (int64_t i = 0; i < m_; i++) {
+      data_[i] = kernels::dotHalf(A.storage_, A.half_ + i * A.n_, vec.data_,
+                                  A.n_);
+    }
+    return;
+  }
   for (int64_t i = 0; i < m_; i++) {
     data_[i] = 0.0;
     for (int64_t j = 0; j < A.n_; j++) {
@@ -20,6 +20,7 @@
 namespace fasttext {
 
 class Matrix;
+class QMatrix;
 
 class Vector {
  public:
@@ -43,6 +44,7 @@ class Vector {
   void l2_normalize();
   void addRow(const Matrix&, int64_t);
   void addRow(const Matrix&, int64_t, real);
+  void addRow(const QMatrix&, int64_t);
   void mul(const Matrix&, const Vector&);
   int64_t argmax();
 };
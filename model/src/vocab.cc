@@ -0,0 +1,176 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#include "vocab.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+
+#include "chunks.h"
+#include "dictionary.h"
+#include "utils.h"
+
+namespace fasttext {
+
+const int32_t VocabCounter::NSHARDS;
+const int64_t VocabCounter::ENTRY_BYTES;
+
+VocabCounter::VocabCounter(const Args& args, int64_t capacity)
+    : shards_(NSHARDS),
+      capacity_(capacity),
+      minLength_(args.minLength),
+      skipLatin_(args.skipLatin != 0),
+      ntokens_(0) {
+  for (int32_t i = 0; i < NSHARDS; i++) shards_[i].floor = 0;
+}
+
+bool VocabCounter::accept(const std::string& word) const {
+  if (word == Dictionary::EOS) return false;
+  int32_t length = 0;
+  for (size_t i = 0; i < word.size(); i++) {
+    const char c = word[i];
+    if (skipLatin_ && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) {
+      return false;
+    }
+    if ((c & 0xC0) != 0x80) length++;
+  }
+  return length >= minLength_;
+}
+
+void VocabCounter::count(std::istream& in) {
+  std::string token;
+  while (Dictionary::readWord(in, token)) {
+    if (accept(token)) add(token);
+  }
+}
+
+void VocabCounter::add(const std::string& word) {
+  ntokens_++;
+  shard_t& shard = shards_[std::hash<std::string>()(word) % NSHARDS];
+  auto it = shard.counts.find(word);
+  if (it != shard.counts.end()) {
+    it->second++;
+    return;
+  }
+  shard.counts.insert(std::make_pair(word, shard.floor + 1));
+  if (capacity_ > 0 && shard.counts.size() > 2 * capacity_) {
+    prune(shard, capacity_);
+  }
+}
+
+void VocabCounter::prune(shard_t& shard, int64_t capacity) {
+  if (shard.counts.size() <= capacity) return;
+  std::vector<int64_t> counts;
+  counts.reserve(shard.counts.size());
+  for (auto it = shard.counts.begin(); it != shard.counts.end(); ++it) {
+    counts.push_back(it->second);
+  }
+  std::nth_element(counts.begin(), counts.begin() + capacity, counts.end(),
+                   std::greater<int64_t>());
+  const int64_t threshold = counts[capacity];
+  for (auto it = shard.counts.begin(); it != shard.counts.end();) {
+    if (it->second <= threshold) {
+      it = shard.counts.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  shard.floor = std::max(shard.floor, threshold);
+}
+
+void VocabCounter::merge(VocabCounter& other, int32_t i) {
+  shard_t& shard = shards_[i];
+  shard_t& from = other.shards_[i];
+  for (auto it = from.counts.begin(); it != from.counts.end(); ++it) {
+    shard.counts[it->first] += it->second;
+  }
+  shard.floor += from.floor;
+  std::unordered_map<std::string, int64_t>().swap(from.counts);
+}
+
+void VocabCounter::build(const Args& args) {
+  auto start = std::chrono::steady_clock::now();
+  const int32_t nthreads = std::max(args.thread, 1);
+  int64_t capacity = 0;
+  if (args.vocabMemory > 0) {
+    capacity = (int64_t(args.vocabMemory) << 20) /
+               (ENTRY_BYTES * 2 * NSHARDS * nthreads);
+    capacity = std::max(capacity, int64_t(1));
+  }
+  std::vector<VocabCounter> counters(nthreads, VocabCounter(args, capacity));
+
+  if (!forEachTextChunk(args.input, nthreads,
+                        [&](int32_t t, std::istream& text) {
+                          counters[t].count(text);
+                        })) {
+    exit(EXIT_FAILURE);
+  }
+
+  VocabCounter& total = counters[0];
+  utils::parallelFor(NSHARDS, nthreads, [&](int64_t s) {
+    for (int32_t t = 1; t < nthreads; t++) total.merge(counters[t], s);
+    if (capacity > 0) total.prune(total.shards_[s], capacity * nthreads);
+  });
+  int64_t ntokens = 0;
+  for (int32_t t = 0; t < nthreads; t++) ntokens += counters[t].ntokens();
+
+  std::vector<std::pair<int64_t, const std::string*>> words;
+  int64_t floor = 0;
+  for (int32_t s = 0; s < NSHARDS; s++) {
+    const shard_t& shard = total.shards_[s];
+    for (auto it = shard.counts.begin(); it != shard.counts.end(); ++it) {
+      words.push_back(std::make_pair(it->second, &it->first));
+    }
+    floor = std::max(floor, shard.floor);
+  }
+  std::sort(words.begin(), words.end(),
+            [](const std::pair<int64_t, const std::string*>& a,
+               const std::pair<int64_t, const std::string*>& b) {
+              return a.first > b.first ||
+                     (a.first == b.first && *a.second < *b.second);
+            });
+  const int64_t ndistinct = words.size();
+  if (args.maxVocab > 0 && words.size() > args.maxVocab) {
+    words.resize(args.maxVocab);
+  }
+
+  std::string path = args.output + ".vocab";
+  std::ofstream ofs(path);
+  if (!ofs.is_open()) {
+    std::cerr << "Vocabulary file cannot be opened for saving!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < words.size(); i++) {
+    ofs << words[i].first << ' ' << *words[i].second << '\n';
+  }
+  ofs.close();
+  if (!ofs) {
+    std::cerr << "Error writing vocabulary " << path << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  std::cerr << "vocabulary: " << ntokens << " tokens, " << ndistinct
+            << " distinct words, " << words.size() << " written to " << path
+            << " in " << seconds << "s" << std::endl;
+  if (capacity > 0) {
+    std::cerr << "memory cap: " << capacity * nthreads * NSHARDS
+              << " words kept, counts overestimated by at most " << floor
+              << std::endl;
+  }
+}
+
+}  // namespace fasttext
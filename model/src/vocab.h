@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * Modified by: https://github.com/hbq1
+ */
+
+#ifndef FASTTEXT_VOCAB_H
+#define FASTTEXT_VOCAB_H
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "args.h"
+
+namespace fasttext {
+
+// Word frequencies of a text corpus, in the "freq word" format of
+// -dict_vocab_freq_path. Tokens are split like Dictionary::readWord and
+// filtered like get_vocabulary.sh: no latin letters and at least minLength
+// characters. Every thread counts its chunks into its own shards of words,
+// split by hash, and shard i of all threads is merged on one thread.
+//
+// With a memory cap a shard keeps at most capacity words, as a batched
+// space-saving summary: once it holds twice as many, the words at or below
+// the capacity-th count are dropped and that count becomes the shard's
+// floor. A word seen again after that restarts from the floor, so counts
+// are overestimated by at most the floor and no frequent word is lost.
+class VocabCounter {
+ private:
+  struct shard_t {
+    std::unordered_map<std::string, int64_t> counts;
+    int64_t floor;
+  };
+
+  std::vector<shard_t> shards_;
+  int64_t capacity_;
+  int32_t minLength_;
+  bool skipLatin_;
+  int64_t ntokens_;
+
+  bool accept(const std::string&) const;
+  void prune(shard_t&, int64_t);
+
+ public:
+  static const int32_t NSHARDS = 64;
+  // estimated bytes of one counted word: the string, its count and the
+  // hash node around them
+  static const int64_t ENTRY_BYTES = 128;
+
+  // capacity is the words kept per shard, 0 for exact counts
+  VocabCounter(const Args&, int64_t);
+
+  void count(std::istream&);
+  void add(const std::string&);
+  // adds shard i of other into the same shard of this counter
+  void merge(VocabCounter&, int32_t);
+  int64_t ntokens() const { return ntokens_; }
+
+  // counts args.input with args.thread threads and writes <output>.vocab
+  static void build(const Args&);
+};
+
+}  // namespace fasttext
+
+#endif
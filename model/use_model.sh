@@ -43,6 +43,15 @@ DICT_CONTEXT_INFO_PATH=${CORPUS_PATH}_context_src_info
 
 LOG_PATH=${RESULTDIR}/${RESULTFILE}
 
+# train_hashed and print_hashed hash the char ngrams of the vocabulary
+# instead of reading the get_ngrams.pl files
+NGRAM_SOURCE="${DICT_NGRAMS_PATH} ${DICT_NGRAMS_INFO_PATH}"
+if [[ "$ACTION" == *_hashed ]]
+then
+	NGRAM_SOURCE=hash
+	ACTION=${ACTION%_hashed}
+fi
+
 mkdir -p "${RESULTDIR}"
 
 make
@@ -67,13 +76,12 @@ then
 		-t 1e-4 \
 		-lrUpdateRate 100 \
 		-dict_vocab_freq_path ${DICT_VOCAB_FREQ_PATH} \
-		-source ngram ${DICT_NGRAMS_PATH} ${DICT_NGRAMS_INFO_PATH} \
+		-source ngram ${NGRAM_SOURCE} \
 		-source morph ${DICT_MORPH_PATH} ${DICT_MORPH_INFO_PATH} \
 		-source smart_morph ${DICT_SMART_MORPH_PATH} ${DICT_SMART_MORPH_INFO_PATH} \
 		-source analogy ${DICT_SYNS_PATH} ${DICT_SYN_INFO_PATH} \
 		-source syns_RT ${DICT_SYNS_RT_PATH} ${DICT_SYN_RT_INFO_PATH} \
-		-source contexts ${DICT_CONTEXTS_PATH} ${DICT_CONTEXT_INFO_PATH} \
-		-context_cooccurences_path ${CORPUS_PATH}_context_info
+		-source contexts ${DICT_CONTEXTS_PATH} ${DICT_CONTEXT_INFO_PATH}
 		#-pretrainedModel "${RESULTDIR}"/"${RESULTFILE}.bin" \
 		#2> "${RESULTDIR}"/train_log
 fi
@@ -84,7 +92,7 @@ then
 	cat "${DICT_VOCAB_PATH}" | \
 			./fasttext print-vectors "${RESULTDIR}"/"${RESULTFILE}".bin \
 			-dict_vocab_freq_path ${DICT_VOCAB_FREQ_PATH} \
-			-source ngram ${DICT_NGRAMS_PATH} ${DICT_NGRAMS_INFO_PATH} \
+			-source ngram ${NGRAM_SOURCE} \
 			-source morph ${DICT_MORPH_PATH} ${DICT_MORPH_INFO_PATH} \
 			-source smart_morph ${DICT_SMART_MORPH_PATH} ${DICT_SMART_MORPH_INFO_PATH} \
 			-source analogy ${DICT_SYNS_PATH} ${DICT_SYN_INFO_PATH} \